@@ -0,0 +1,218 @@
+#include "compress.h"
+
+#include <errno.h>
+
+#include <rte_byteorder.h>
+
+#ifdef HAVE_LZ4
+static void
+lz4_preferences(const struct compress_config* config, size_t len, LZ4F_preferences_t* prefs) {
+    memset(prefs, 0, sizeof(*prefs));
+    prefs->frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs->frameInfo.blockMode = LZ4F_blockIndependent;
+    prefs->frameInfo.contentSize = len;
+    prefs->compressionLevel = config->level;
+    prefs->autoFlush = 1;
+}
+#endif
+
+int
+compress_parse_opt(const char* arg, struct compress_config* config) {
+    const char* sep = strchr(arg, ':');
+    size_t name_len = sep ? (size_t)(sep - arg) : strlen(arg);
+    char* end;
+    long level;
+
+    if (name_len == 4 && !strncmp(arg, "zstd", name_len)) {
+#ifndef HAVE_ZSTD
+        return -ENOTSUP;
+#endif
+        config->algo = COMPRESS_ZSTD;
+        config->level = COMPRESS_ZSTD_LEVEL_DEFAULT;
+    } else if (name_len == 3 && !strncmp(arg, "lz4", name_len)) {
+#ifndef HAVE_LZ4
+        return -ENOTSUP;
+#endif
+        config->algo = COMPRESS_LZ4;
+        config->level = COMPRESS_LZ4_LEVEL_DEFAULT;
+    } else {
+        return -EINVAL;
+    }
+
+    if (sep) {
+        errno = 0;
+        level = strtol(sep + 1, &end, 10);
+        if (errno || end == sep + 1 || *end != '\0') {
+            return -EINVAL;
+        }
+#ifdef HAVE_ZSTD
+        if (config->algo == COMPRESS_ZSTD && (level < ZSTD_minCLevel() || level > ZSTD_maxCLevel())) {
+            return -EINVAL;
+        }
+#endif
+#ifdef HAVE_LZ4
+        if (config->algo == COMPRESS_LZ4 && (level < 0 || level > LZ4F_compressionLevel_max())) {
+            return -EINVAL;
+        }
+#endif
+        config->level = level;
+    }
+    return 0;
+}
+
+const char*
+compress_algo_name(uint16_t algo) {
+    switch (algo) {
+        case COMPRESS_ZSTD: return "zstd";
+        case COMPRESS_LZ4: return "lz4";
+        default: return "none";
+    }
+}
+
+const char*
+compress_extension(uint16_t algo) {
+    switch (algo) {
+        case COMPRESS_ZSTD: return ".zst";
+        case COMPRESS_LZ4: return ".lz4";
+        default: return "";
+    }
+}
+
+size_t
+compress_frame_bound(const struct compress_config* config, size_t len, unsigned int disk_blk_size) {
+    size_t bound = len;
+
+#ifdef HAVE_ZSTD
+    if (config->algo == COMPRESS_ZSTD) {
+        bound = ZSTD_compressBound(len);
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (config->algo == COMPRESS_LZ4) {
+        LZ4F_preferences_t prefs;
+
+        lz4_preferences(config, len, &prefs);
+        bound = LZ4F_compressFrameBound(len, &prefs);
+    }
+#endif
+
+    /* Room for the padding frame */
+    return RTE_ALIGN_CEIL(bound, disk_blk_size) + disk_blk_size;
+}
+
+int
+compressor_init(struct compressor* compressor, const struct compress_config* config) {
+    memset(compressor, 0, sizeof(*compressor));
+    compressor->config = *config;
+
+    switch (config->algo) {
+#ifdef HAVE_ZSTD
+        case COMPRESS_ZSTD:
+            compressor->zstd = ZSTD_createCCtx();
+            if (compressor->zstd == NULL) {
+                LOG_ERR("Cannot create a zstd context\n");
+                return -ENOMEM;
+            }
+            return 0;
+#endif
+#ifdef HAVE_LZ4
+        case COMPRESS_LZ4:
+            if (LZ4F_isError(LZ4F_createCompressionContext(&compressor->lz4, LZ4F_VERSION))) {
+                LOG_ERR("Cannot create an lz4 context\n");
+                return -ENOMEM;
+            }
+            return 0;
+#endif
+        default: return -ENOTSUP;
+    }
+}
+
+void
+compressor_exit(struct compressor* compressor) {
+#ifdef HAVE_ZSTD
+    if (compressor->zstd) {
+        ZSTD_freeCCtx(compressor->zstd);
+        compressor->zstd = NULL;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (compressor->lz4) {
+        LZ4F_freeCompressionContext(compressor->lz4);
+        compressor->lz4 = NULL;
+    }
+#endif
+}
+
+/*
+ * Compresses into a single frame. Returns its length, or a negative value.
+ */
+static ssize_t
+compress_raw(struct compressor* compressor, unsigned char* dst, size_t capacity, const unsigned char* src,
+             size_t len) {
+#ifdef HAVE_ZSTD
+    if (compressor->zstd) {
+        size_t ret = ZSTD_compressCCtx(compressor->zstd, dst, capacity, src, len, compressor->config.level);
+        if (ZSTD_isError(ret)) {
+            LOG_ERR("zstd compression failed: %s\n", ZSTD_getErrorName(ret));
+            return -EIO;
+        }
+        return ret;
+    }
+#endif
+#ifdef HAVE_LZ4
+    if (compressor->lz4) {
+        LZ4F_compressOptions_t options = {.stableSrc = 1};
+        LZ4F_preferences_t prefs;
+        size_t ret, total;
+
+        lz4_preferences(&compressor->config, len, &prefs);
+        ret = LZ4F_compressBegin(compressor->lz4, dst, capacity, &prefs);
+        if (LZ4F_isError(ret)) {
+            goto lz4_error;
+        }
+        total = ret;
+        ret = LZ4F_compressUpdate(compressor->lz4, dst + total, capacity - total, src, len, &options);
+        if (LZ4F_isError(ret)) {
+            goto lz4_error;
+        }
+        total += ret;
+        ret = LZ4F_compressEnd(compressor->lz4, dst + total, capacity - total, &options);
+        if (LZ4F_isError(ret)) {
+            goto lz4_error;
+        }
+        return total + ret;
+
+    lz4_error:
+        LOG_ERR("lz4 compression failed: %s\n", LZ4F_getErrorName(ret));
+        return -EIO;
+    }
+#endif
+    return -ENOTSUP;
+}
+
+ssize_t
+compress_frame(struct compressor* compressor, unsigned char* dst, size_t capacity, const unsigned char* src,
+               size_t len, unsigned int disk_blk_size) {
+    ssize_t written;
+    size_t pad;
+
+    written = compress_raw(compressor, dst, capacity - disk_blk_size, src, len);
+    if (written < 0) {
+        return written;
+    }
+
+    pad = (disk_blk_size - written % disk_blk_size) % disk_blk_size;
+    if (pad == 0) {
+        return written;
+    }
+    if (pad < COMPRESS_SKIPPABLE_MIN) {
+        pad += disk_blk_size;
+    }
+
+    /* Skippable frame: magic, length of the content, zeroed content */
+    *(uint32_t*)(dst + written) = rte_cpu_to_le_32(COMPRESS_SKIPPABLE_MAGIC);
+    *(uint32_t*)(dst + written + 4) = rte_cpu_to_le_32(pad - COMPRESS_SKIPPABLE_MIN);
+    memset(dst + written + COMPRESS_SKIPPABLE_MIN, 0, pad - COMPRESS_SKIPPABLE_MIN);
+
+    return written + pad;
+}
@@ -0,0 +1,69 @@
+#ifndef DPDKCAP_COMPRESS_H
+#define DPDKCAP_COMPRESS_H
+
+#include <sys/types.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "utils.h"
+
+/* Compression algorithms */
+#define COMPRESS_NONE               0
+#define COMPRESS_ZSTD               1
+#define COMPRESS_LZ4                2
+
+#define COMPRESS_ZSTD_LEVEL_DEFAULT 1
+#define COMPRESS_LZ4_LEVEL_DEFAULT  0
+
+/* Skippable frames, understood by both the zstd and the lz4 decoders */
+#define COMPRESS_SKIPPABLE_MAGIC    0x184D2A50
+#define COMPRESS_SKIPPABLE_MIN      8
+
+struct compress_config {
+    uint16_t algo;
+    int level;
+};
+
+/* A compression context, owned by a single lcore */
+struct compressor {
+    struct compress_config config;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx* zstd;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_cctx* lz4;
+#endif
+};
+
+/*
+ * Parses "zstd" or "lz4", optionally followed by ":LEVEL". Returns -ENOTSUP
+ * if dpdkcap was built without the library.
+ */
+int compress_parse_opt(const char* arg, struct compress_config* config);
+const char* compress_algo_name(uint16_t algo);
+
+/* Extension appended to the name of the output files */
+const char* compress_extension(uint16_t algo);
+
+/* Size needed to compress len bytes with compress_frame() */
+size_t compress_frame_bound(const struct compress_config* config, size_t len, unsigned int disk_blk_size);
+
+int compressor_init(struct compressor* compressor, const struct compress_config* config);
+void compressor_exit(struct compressor* compressor);
+
+/*
+ * Compresses len bytes from src into a single frame at dst, followed by a
+ * skippable frame padding the output to a multiple of disk_blk_size. The
+ * frames can thus be written with O_DIRECT, and concatenated files still
+ * decompress to the concatenated input. Returns the padded length, or a
+ * negative value on error.
+ */
+ssize_t compress_frame(struct compressor* compressor, unsigned char* dst, size_t capacity, const unsigned char* src,
+                       size_t len, unsigned int disk_blk_size);
+
+#endif
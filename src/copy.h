@@ -0,0 +1,72 @@
+#ifndef DPDKCAP_COPY_H
+#define DPDKCAP_COPY_H
+
+#include <rte_common.h>
+#include <rte_memcpy.h>
+
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
+/* Shortest copy streamed: below, the partial cache lines at both ends dominate */
+#define COPY_STREAM_MIN 256
+
+/*
+ * Copies into a buffer which the calling core does not read again, with
+ * non-temporal stores of whole cache lines where available (x86: AVX-512,
+ * AVX2 or SSE2, as compiled for), so that the copies neither evict the
+ * working set of the core from its caches nor read the destination lines
+ * from memory first. The partial lines at both ends go through the cache.
+ *
+ * Streaming stores are weakly ordered: copy_stream_fence() must be called
+ * before another core may read the buffer.
+ */
+static inline void
+copy_stream(void* dst, const void* src, size_t len) {
+#ifdef RTE_ARCH_X86
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t head;
+
+    if (len < COPY_STREAM_MIN) {
+        rte_memcpy(dst, src, len);
+        return;
+    }
+
+    head = RTE_PTR_ALIGN_CEIL(d, RTE_CACHE_LINE_SIZE) - d;
+    rte_memcpy(d, s, head);
+    d += head;
+    s += head;
+    len -= head;
+
+    for (; len >= RTE_CACHE_LINE_SIZE; len -= RTE_CACHE_LINE_SIZE) {
+#if defined(__AVX512F__)
+        _mm512_stream_si512((__m512i*)d, _mm512_loadu_si512(s));
+#elif defined(__AVX2__)
+        _mm256_stream_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+        _mm256_stream_si256((__m256i*)(d + 32), _mm256_loadu_si256((const __m256i*)(s + 32)));
+#else
+        _mm_stream_si128((__m128i*)d, _mm_loadu_si128((const __m128i*)s));
+        _mm_stream_si128((__m128i*)(d + 16), _mm_loadu_si128((const __m128i*)(s + 16)));
+        _mm_stream_si128((__m128i*)(d + 32), _mm_loadu_si128((const __m128i*)(s + 32)));
+        _mm_stream_si128((__m128i*)(d + 48), _mm_loadu_si128((const __m128i*)(s + 48)));
+#endif
+        d += RTE_CACHE_LINE_SIZE;
+        s += RTE_CACHE_LINE_SIZE;
+    }
+
+    rte_memcpy(d, s, len);
+#else
+    rte_memcpy(dst, src, len);
+#endif
+}
+
+/* Orders the streaming stores before the stores which follow, e.g. a ring enqueue */
+static inline void
+copy_stream_fence(void) {
+#ifdef RTE_ARCH_X86
+    _mm_sfence();
+#endif
+}
+
+#endif
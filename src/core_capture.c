@@ -1,3 +1,7 @@
+#include <rte_malloc.h>
+#include <rte_prefetch.h>
+
+#include "copy.h"
 #include "core_capture.h"
 
 struct ether_fc_frame {
@@ -76,13 +80,250 @@ wait_link_up(const struct capture_core_config* config, bool wait) {
     }
 }
 
+int
+capture_overload_parse_opt(const char* arg, uint16_t* policy, uint16_t* snaplen) {
+    char* end;
+    unsigned long len;
+
+    if (!strcmp(arg, "stall")) {
+        *policy = OVERLOAD_STALL;
+    } else if (!strcmp(arg, "drop")) {
+        *policy = OVERLOAD_DROP;
+    } else if (!strncmp(arg, "headers", 7) && (arg[7] == '\0' || arg[7] == ':')) {
+        *policy = OVERLOAD_HEADERS;
+        *snaplen = OVERLOAD_SNAPLEN_DEFAULT;
+        if (arg[7] == ':') {
+            errno = 0;
+            len = strtoul(arg + 8, &end, 10);
+            if (errno || *end || end == arg + 8 || len == 0 || len > UINT16_MAX) {
+                return -EINVAL;
+            }
+            *snaplen = len;
+        }
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/*
+ * Hands a full buffer over to the writing cores, and returns false when the
+ * full ring has no room
+ */
+static inline bool
+enqueue_buffer(const struct capture_core_config* config, struct pcap_buffer* buffer) {
+    uint64_t now = rte_rdtsc();
+    uint64_t rx_at = buffer->rx_at; /* the buffer belongs to the writing cores once enqueued */
+
+    buffer->enqueued_at = now;
+    if (!rte_ring_enqueue_bulk(config->pbuf_full_ring, (void**)&buffer, 1, NULL)) {
+        return false;
+    }
+    histogram_record(&config->stats->rx_to_enqueue, now - rx_at);
+    return true;
+}
+
+/* History of a capturing core in flight-recorder mode */
+struct recorder {
+    struct pcap_buffer** history; /* circular, oldest first */
+    struct pcap_buffer** spares;  /* emptied, taken before the free ring */
+    uint32_t size;
+    uint32_t head;
+    uint32_t nb_history;
+    uint32_t nb_spares;
+    uint64_t seq;        /* last trigger handled */
+    uint64_t dump_until; /* TSC until which the buffers are handed over */
+};
+
+/*
+ * Takes a free buffer, an emptied one of the history first. nb_free, when
+ * not NULL, gets the number of buffers left in the ring, or UINT32_MAX when
+ * no buffer was taken from the ring.
+ */
+static inline bool
+dequeue_free(struct rte_ring* ring, struct recorder* recorder, struct pcap_buffer** buffer, unsigned int* nb_free) {
+    unsigned int available;
+
+    if (nb_free) {
+        *nb_free = UINT32_MAX;
+    }
+    if (unlikely(recorder->nb_spares)) {
+        *buffer = recorder->spares[--recorder->nb_spares];
+        return true;
+    }
+    if (!rte_ring_sc_dequeue_bulk(ring, (void**)buffer, 1, &available)) {
+        return false;
+    }
+    if (nb_free) {
+        *nb_free = available;
+    }
+    return true;
+}
+
+/*
+ * Empties a buffer which is not written, and frees its mbufs
+ */
+static void
+discard_buffer(struct pcap_buffer* buffer, uint32_t* zc_held) {
+    uint32_t p, nb_mbufs = 0;
+
+    if (buffer->nb_mbufs) {
+        for (p = 0; p < buffer->packets; p++) {
+            if (buffer->mbufs[p]) {
+                buffer->mbufs[nb_mbufs++] = buffer->mbufs[p];
+            }
+        }
+        rte_pktmbuf_free_bulk(buffer->mbufs, nb_mbufs);
+        *zc_held -= buffer->nb_mbufs;
+        buffer->nb_mbufs = 0;
+    }
+    buffer->offset = 0;
+    buffer->packets = 0;
+    buffer->nb_flows = 0;
+}
+
+/*
+ * Empties the oldest buffer of the history
+ */
+static struct pcap_buffer*
+recorder_evict(struct recorder* recorder, uint32_t* zc_held, struct capture_core_stats* stats) {
+    struct pcap_buffer* buffer = recorder->history[recorder->head];
+
+    recorder->head = (recorder->head + 1) % recorder->size;
+    recorder->nb_history--;
+    discard_buffer(buffer, zc_held);
+
+    stats->evicted_buffers++;
+    stats->history_buffers = recorder->nb_history;
+    return buffer;
+}
+
+/*
+ * Keeps a full buffer as the newest of the history, after emptying the
+ * buffers older than the pre-trigger window
+ */
+static void
+recorder_push(struct recorder* recorder, const struct trigger* trigger, struct pcap_buffer* buffer, uint32_t* zc_held,
+              struct capture_core_stats* stats) {
+    uint64_t now = rte_rdtsc();
+
+    while (recorder->nb_history && recorder->history[recorder->head]->enqueued_at + trigger->pre_cycles < now) {
+        recorder->spares[recorder->nb_spares++] = recorder_evict(recorder, zc_held, stats);
+    }
+
+    buffer->enqueued_at = now;
+    recorder->history[(recorder->head + recorder->nb_history) % recorder->size] = buffer;
+    recorder->nb_history++;
+    stats->history_buffers = recorder->nb_history;
+}
+
+/*
+ * Hands the history of the pre-trigger window over to the writing cores,
+ * and starts the post-trigger window
+ */
+static void
+recorder_dump(const struct capture_core_config* config, struct recorder* recorder, const struct trigger* trigger,
+              uint32_t* zc_held) {
+    struct pcap_buffer* buffer;
+    uint64_t fired_at;
+
+    recorder->seq = trigger_seq(trigger);
+    fired_at = trigger->fired_at;
+    recorder->dump_until = fired_at + trigger->post_cycles;
+
+    while (recorder->nb_history) {
+        buffer = recorder->history[recorder->head];
+        if (buffer->enqueued_at + trigger->pre_cycles < fired_at) {
+            recorder->spares[recorder->nb_spares++] = recorder_evict(recorder, zc_held, config->stats);
+            continue;
+        }
+        /* The full ring has room for all the buffers of the queue */
+        buffer->enqueued_at = rte_rdtsc();
+        if (!rte_ring_enqueue_bulk(config->pbuf_full_ring, (void**)&buffer, 1, NULL)) {
+            break;
+        }
+        recorder->head = (recorder->head + 1) % recorder->size;
+        recorder->nb_history--;
+        config->stats->dumped_buffers++;
+    }
+    config->stats->history_buffers = recorder->nb_history;
+}
+
+/*
+ * Moves the packets kept in the reserve while overloaded at the head of a
+ * new buffer
+ */
+static void
+restore_reserve(struct pcap_buffer* buffer, struct pcap_buffer* reserve, uint16_t zero_copy, uint32_t* buffer_packets) {
+    rte_memcpy(buffer->buffer, reserve->buffer, reserve->offset);
+    buffer->offset = reserve->offset;
+    buffer->rx_at = reserve->rx_at;
+    buffer->first_ns = reserve->first_ns;
+    buffer->last_ns = reserve->last_ns;
+    buffer->sample_rate = reserve->sample_rate;
+    if (zero_copy) {
+        memset(buffer->mbufs, 0, reserve->packets * sizeof(struct rte_mbuf*));
+    }
+    *buffer_packets = reserve->packets;
+    reserve->offset = 0;
+    reserve->packets = 0;
+}
+
+/*
+ * Prefetches what the capture of a packet reads: the second cache line of
+ * its mbuf (dynamic fields such as the NIC timestamp, next segment), and the
+ * start of its data. The first cache line was written by the driver.
+ */
+static inline void
+capture_prefetch(struct rte_mbuf* mbuf) {
+    rte_mbuf_prefetch_part2(mbuf);
+    rte_prefetch0(rte_pktmbuf_mtod(mbuf, void*));
+}
+
+/*
+ * Copies the first len bytes of a packet, from all its segments
+ */
+static inline void
+copy_packet(unsigned char* dst, const struct rte_mbuf* mbuf, uint32_t len) {
+    uint32_t seg_len;
+
+    if (likely(mbuf->nb_segs == 1)) {
+        copy_stream(dst, rte_pktmbuf_mtod(mbuf, const void*), len);
+        return;
+    }
+    do {
+        seg_len = RTE_MIN(mbuf->data_len, len);
+        copy_stream(dst, rte_pktmbuf_mtod(mbuf, const void*), seg_len);
+        dst += seg_len;
+        len -= seg_len;
+        mbuf = mbuf->next;
+    } while (mbuf && len);
+}
+
+/*
+ * Adjusts the adaptive sampling rate once a buffer is taken, and logs the
+ * rate at most every SAMPLE_LOG_PERIOD_S
+ */
+static void
+adapt_sample_rate(const struct capture_core_config* config, struct sample* sample, unsigned int nb_free,
+                  time_t* logged_at) {
+    if (!sample_adapt(sample, nb_free, config->nb_pbufs)) {
+        return;
+    }
+    config->stats->sample_rate = sample->rate;
+    if (time(NULL) >= *logged_at + SAMPLE_LOG_PERIOD_S) {
+        *logged_at = time(NULL);
+        LOG_INFO("Port %u queue %u: sampling 1 in %u packets\n", config->port, config->queue, sample->rate);
+    }
+}
+
 /*
  * Capture the traffic from the given port/queue tuple
  */
 int
 capture_core(const struct capture_core_config* config) {
     const unsigned socket_id = rte_socket_id();
-    unsigned dev_socket_id;
+    int dev_socket_id;
 
     volatile bool* stop_condition = config->stop_condition;
 
@@ -92,6 +333,10 @@ capture_core(const struct capture_core_config* config) {
     const uint16_t burst_size = config->burst_size;
     struct rte_mbuf* bufs[burst_size];
     struct rte_mbuf* bufptr;
+    /* Records of a burst in the buffer: start offsets, followed by the end of the last one */
+    uint32_t records[burst_size + 1];
+    uint32_t caplens[burst_size];
+    uint64_t timestamps[burst_size];
 
     struct rte_mempool* pause_mbuf_pool = config->pause_mbuf_pool;
     const uint16_t flow_control = config->flow_control;
@@ -104,29 +349,104 @@ capture_core(const struct capture_core_config* config) {
     const uint32_t watermark = config->watermark;
 
     struct pcap_buffer* buffer = NULL;
-    struct pcap_packet_header* header;
-    size_t header_size = sizeof(struct pcap_packet_header);
-    uint32_t packet_length;
+    const uint16_t format = config->format;
+    const uint32_t interface_id = config->interface_id;
+    const unsigned int header_size =
+        format == PCAP_FORMAT_PCAPNG ? sizeof(struct pcapng_enhanced_packet_block) : sizeof(struct pcap_packet_header);
+    uint32_t caplen;
+
+    const uint32_t snaplen = config->snaplen;
+    const struct slice_config* slice = &config->slice;
+    const struct flow_rules* flow = config->flow;
+    const struct filter* filter = config->filter;
+    struct dedup dedup = {0};
+    struct sample sample = {0};
+    time_t sample_logged_at = 0;
+    struct flow_index flows = {0};
 
     const uint16_t mw_timestamp = config->mw_timestamp;
+    const uint16_t timestamp = config->timestamp;
+    const struct timestamp_dynfield ts_dynfield = config->ts_dynfield;
+    const struct timestamp_clock* tsc = config->tsc;
+    struct timestamp_model ts_model, tsc_model;
+    uint64_t ticks, ns, tsc_last = 0;
     struct timespec ts;
-    unsigned char* trailer_base;
+    bool ts_valid = false;
+    const unsigned char* trailer_base;
+    unsigned char trailer[8];
+
+    const uint16_t zero_copy = config->zero_copy;
+    const uint32_t zc_max_held = config->zc_max_held;
+    const uint32_t max_packets = zero_copy ? PCAP_BUFFER_ZC_MAX_PACKETS : UINT32_MAX;
+    uint32_t zc_held = 0;
+    bool zc_active = false;
+
+    /*
+     * Overload policy: while no buffer is available, the packets are dropped,
+     * or truncated into the reserve until a buffer is free again
+     */
+    const uint16_t overload = config->overload;
+    const uint32_t overload_snaplen = RTE_MIN(config->overload_snaplen, snaplen);
+    const uint32_t reserve_record_len = header_size + overload_snaplen + 8;
+    struct pcap_buffer reserve = {0};
+    struct pcap_buffer* pending = NULL;
+    struct pcap_buffer* target;
+    uint32_t* target_packets;
+    uint32_t caplen_max;
+    uint64_t overload_start = 0, overload_shed = 0, overload_shed_bytes = 0, overload_truncated = 0;
+    time_t overload_logged_at = 0;
+
+    /* Flight recorder: the full buffers are kept as history, and only handed over around triggers */
+    struct trigger* trigger = config->trigger;
+    struct recorder recorder = {0};
 
     const uint16_t disk_blk_size = config->disk_blk_size;
-    uint16_t i, nb_rx;
-    unsigned int overrun = 0, overrun_start = 0, flush = 0;
-    unsigned char* oldbuf = NULL;
+    uint64_t stall_start;
+    uint16_t i, nb_rx, nb_received;
+    const uint64_t flush_cycles = config->flush_ms * rte_get_tsc_hz() / 1000;
+    unsigned int nb_free = 0;
 
     LOG_INFO("Core %u is capturing packets for port %u\n", rte_lcore_id(), port);
 
-    dev_socket_id = rte_eth_dev_socket_id(port);
-    if (dev_socket_id != socket_id) {
+    dev_socket_id = port_socket_id(port);
+    if ((unsigned)dev_socket_id != socket_id) {
         LOG_WARN("Port %u on different socket from worker; performance will suffer\n", port);
     }
 
     /* Init stats */
     config->stats->core_id = rte_lcore_id();
     config->stats->pbuf_free_ring = config->pbuf_free_ring;
+    config->stats->free_pbufs_low = UINT32_MAX;
+
+    if (overload == OVERLOAD_HEADERS) {
+        reserve.size = RTE_MIN(OVERLOAD_RESERVE_LEN_MAX, watermark / 2);
+        reserve.buffer = rte_malloc_socket(NULL, reserve.size, 0, socket_id);
+        if (!reserve.buffer) {
+            rte_exit(EXIT_FAILURE, "Error: Could not allocate the overload reserve on Core %d\n", rte_lcore_id());
+        }
+    }
+
+    if (config->dedup.interval_us && dedup_init(&dedup, &config->dedup, socket_id) < 0) {
+        rte_exit(EXIT_FAILURE, "Error: Could not allocate the duplicate table on Core %d\n", rte_lcore_id());
+    }
+
+    if (config->sample.mode != SAMPLE_NONE) {
+        sample_init(&sample, &config->sample);
+        config->stats->sample_rate = sample.rate;
+    }
+
+    if (config->flow_index && flow_index_init(&flows, socket_id) < 0) {
+        rte_exit(EXIT_FAILURE, "Error: Could not allocate the flow index on Core %d\n", rte_lcore_id());
+    }
+
+    if (trigger) {
+        recorder.size = config->nb_pbufs;
+        recorder.history = rte_malloc_socket(NULL, recorder.size * sizeof(struct pcap_buffer*), 0, socket_id);
+        recorder.spares = rte_malloc_socket(NULL, recorder.size * sizeof(struct pcap_buffer*), 0, socket_id);
+        if (!recorder.history || !recorder.spares) {
+            rte_exit(EXIT_FAILURE, "Error: Could not allocate the flight recorder on Core %d\n", rte_lcore_id());
+        }
+    }
 
     wait_link_up(config, true);
 
@@ -154,102 +474,375 @@ capture_core(const struct capture_core_config* config) {
     /* Run until the application is quit or killed. */
     while (likely(!(*stop_condition))) {
 
+        /* Flight recorder: hand the history over when a trigger fires */
+        if (unlikely(trigger != NULL) && unlikely(trigger_seq(trigger) != recorder.seq)) {
+            recorder_dump(config, &recorder, trigger, &zc_held);
+        }
+
+        /* Overloaded: hand the full buffer over and take a free one as soon as possible */
+        if (unlikely(!buffer)) {
+            if (pending && enqueue_buffer(config, pending)) {
+                pending = NULL;
+            }
+            if (!pending && dequeue_free(pbuf_free_ring, &recorder, &buffer, &nb_free)) {
+                zc_held -= buffer->nb_mbufs;
+                buffer->nb_mbufs = 0;
+                config->stats->overload_cycles += rte_rdtsc() - overload_start;
+                overload_start = 0;
+
+                /* The packets kept meanwhile were sampled at the current rate */
+                if (config->sample.adaptive && nb_free != UINT32_MAX && !reserve.packets) {
+                    adapt_sample_rate(config, &sample, nb_free, &sample_logged_at);
+                }
+
+                /* The packets kept meanwhile start the new buffer */
+                if (reserve.packets) {
+                    restore_reserve(buffer, &reserve, zero_copy, &config->stats->buffer_packets);
+                }
+
+                if (time(NULL) >= overload_logged_at + OVERLOAD_LOG_PERIOD_S) {
+                    overload_logged_at = time(NULL);
+                    LOG_WARN("Port %u queue %u overloaded: %lu packets (%lu bytes) dropped and %lu truncated since "
+                             "the last report\n",
+                             port, queue, config->stats->shed_packets - overload_shed,
+                             config->stats->shed_bytes - overload_shed_bytes,
+                             config->stats->truncated_packets - overload_truncated);
+                    overload_shed = config->stats->shed_packets;
+                    overload_shed_bytes = config->stats->shed_bytes;
+                    overload_truncated = config->stats->truncated_packets;
+                }
+            }
+        }
+
         /* Retrieve packets and put them into the ring */
         nb_rx = rte_eth_rx_burst(port, queue, bufs, burst_size);
 
+        /* Drop unwanted packets before copying anything */
+        if ((flow || filter) && likely(nb_rx > 0)) {
+            nb_received = nb_rx;
+            if (flow) {
+                nb_rx = flow_burst(flow, bufs, nb_rx);
+            }
+            if (filter && nb_rx) {
+                nb_rx = filter_burst(filter, bufs, nb_rx);
+            }
+            config->stats->filtered += nb_received - nb_rx;
+        }
+
+        /* Drop the copies of recent packets */
+        if (dedup.buckets && likely(nb_rx > 0)) {
+            nb_received = nb_rx;
+            nb_rx = dedup_burst(&dedup, bufs, nb_rx);
+            config->stats->duplicates += nb_received - nb_rx;
+        }
+
+        /* Fire the flight recorder on the first matching packet outside a post-trigger window */
+        if (unlikely(trigger != NULL) && trigger->filter && nb_rx > 0 && rte_rdtsc() >= recorder.dump_until
+            && filter_match_any(trigger->filter, bufs, nb_rx)) {
+            trigger_fire(trigger, TRIGGER_FILTER);
+        }
+
+        /* Leave out the packets not sampled, once seen by the trigger filter */
+        if (sample.mode != SAMPLE_NONE && likely(nb_rx > 0)) {
+            nb_received = nb_rx;
+            nb_rx = sample_burst(&sample, bufs, nb_rx);
+            config->stats->sampled_out += nb_received - nb_rx;
+        }
+
+        /* Without a buffer, keep truncated packets in the reserve while it has room, or shed the burst */
+        target = buffer;
+        target_packets = &config->stats->buffer_packets;
+        caplen_max = snaplen;
+        if (unlikely(!buffer) && nb_rx > 0) {
+            if (overload == OVERLOAD_HEADERS && reserve.offset + nb_rx * reserve_record_len <= reserve.size
+                && reserve.packets + nb_rx <= max_packets - burst_size) {
+                target = &reserve;
+                target_packets = &reserve.packets;
+                caplen_max = overload_snaplen;
+                config->stats->truncated_packets += nb_rx;
+            } else {
+                for (i = 0; i < nb_rx; i++) {
+                    config->stats->shed_bytes += bufs[i]->pkt_len;
+                }
+                rte_pktmbuf_free_bulk(bufs, nb_rx);
+                config->stats->shed_packets += nb_rx;
+                nb_rx = 0;
+            }
+        }
+
         if (likely(nb_rx > 0)) {
 
-            if (!mw_timestamp) {
-                clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+            if (*target_packets == 0) {
+                target->rx_at = rte_rdtsc();
+                target->first_ns = UINT64_MAX;
+                target->last_ns = 0;
+                /* The rate only changes between buffers */
+                target->sample_rate = sample.mode != SAMPLE_NONE ? sample.rate : 1;
+            }
+
+            /* The software time is read once per burst, when needed */
+            ts_valid = false;
+            if (timestamp == TIMESTAMP_HW) {
+                timestamp_model_read(config->clock, &ts_model);
+            }
+            if (tsc) {
+                timestamp_model_read(tsc, &tsc_model);
+            }
+
+            /* Hand the mbufs over to the writing core, unless the mempool runs low */
+            zc_active = false;
+            if (zero_copy && likely(target == buffer)) {
+                zc_active = zc_held + nb_rx <= zc_max_held;
+                if (likely(zc_active)) {
+                    zc_held += nb_rx;
+                    buffer->nb_mbufs += nb_rx;
+                    config->stats->zc_packets += nb_rx;
+                } else {
+                    config->stats->zc_copied += nb_rx;
+                }
+                config->stats->zc_held = zc_held;
             }
 
+            /*
+             * Lay the records of the burst out first: capture lengths,
+             * timestamps, record headers and trailers, while the packet data
+             * is prefetched for the copies
+             */
+            for (i = 0; i < RTE_MIN(nb_rx, CAPTURE_PREFETCH_AHEAD); i++) {
+                capture_prefetch(bufs[i]);
+            }
             for (i = 0; i < nb_rx; i++) {
+                if (likely(i + CAPTURE_PREFETCH_AHEAD < nb_rx)) {
+                    capture_prefetch(bufs[i + CAPTURE_PREFETCH_AHEAD]);
+                }
                 bufptr = bufs[i];
 
-                header = (struct pcap_packet_header*)(buffer->buffer + buffer->offset);
-                buffer->offset += header_size;
+                /* Truncate to snaplen, then apply the slicing policy */
+                caplen = RTE_MIN(bufptr->pkt_len, caplen_max);
+                if (slice->enabled) {
+                    caplen = slice_length(bufptr, slice, caplen);
+                }
 
-                packet_length = bufptr->pkt_len;
+                if (mw_timestamp) {
+                    /* The trailer may have been sliced off, read it from the mbuf */
+                    trailer_base = rte_pktmbuf_read(bufptr, bufptr->pkt_len - 12, sizeof(trailer), trailer);
+                    if (likely(trailer_base != NULL)) {
+                        ns = ntohl(*(const uint32_t*)trailer_base) * NSEC_PER_SEC
+                           + ntohl(*(const uint32_t*)(trailer_base + 4));
+                    } else {
+                        ns = 0;
+                    }
+                } else if (timestamp == TIMESTAMP_HW && likely(timestamp_hw_get(bufptr, &ts_dynfield, &ticks))) {
+                    ns = timestamp_to_ns(&ts_model, ticks);
+                } else if (tsc) {
+                    /* Keep timestamps monotonic across recalibrations */
+                    ns = RTE_MAX(timestamp_to_ns(&tsc_model, rte_rdtsc()), tsc_last);
+                    tsc_last = ns;
+                } else {
+                    if (!ts_valid) {
+                        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+                        ts_valid = true;
+                    }
+                    ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+                }
+                target->first_ns = RTE_MIN(target->first_ns, ns);
+                target->last_ns = RTE_MAX(target->last_ns, ns);
 
-                header->packet_length = packet_length;
-                header->packet_length_wire = packet_length;
+                if (zero_copy && likely(target == buffer)) {
+                    /* Without copy, the writing core writes the data from the mbuf and frees it */
+                    buffer->mbufs[config->stats->buffer_packets + i] = zc_active ? bufptr : NULL;
+                }
 
-                if (unlikely(bufptr->nb_segs > 1)) {
-                    do {
-                        rte_memcpy(buffer->buffer + buffer->offset, rte_pktmbuf_mtod(bufptr, void*), bufptr->data_len);
-                        buffer->offset += bufptr->data_len;
-                        bufptr = bufptr->next;
-                    } while (bufptr);
-                    /* Reset the pointer to the original mbuf for freeing */
-                    bufptr = bufs[i];
-                } else {
-                    rte_memcpy(buffer->buffer + buffer->offset, rte_pktmbuf_mtod(bufptr, void*), packet_length);
-                    buffer->offset += packet_length;
+                records[i] = target->offset;
+                caplens[i] = caplen;
+                timestamps[i] = ns;
+                target->offset +=
+                    pcap_packet_header_write(target->buffer + target->offset, format, interface_id, ns, caplen,
+                                             bufptr->pkt_len);
+                if (!zc_active) {
+                    target->offset += caplen;
                 }
+                target->offset += pcap_packet_trailer_write(target->buffer + target->offset, format, caplen);
+            }
+            records[nb_rx] = target->offset;
 
-                if (mw_timestamp) {
-                    trailer_base = buffer->buffer + buffer->offset - 12;
-                    header->seconds = ntohl(*(uint32_t*)trailer_base);
-                    header->nanoseconds = ntohl(*(uint32_t*)(trailer_base + 4));
-                } else {
-                    header->seconds = (uint32_t)ts.tv_sec;
-                    header->nanoseconds = (uint32_t)ts.tv_nsec;
+            /* Then copy the data into the records, streamed past the caches of the core */
+            for (i = 0; i < nb_rx; i++) {
+                if (!zc_active) {
+                    copy_packet(target->buffer + records[i] + header_size, bufs[i], caplens[i]);
                 }
+                if (flows.slots && likely(target == buffer)) {
+                    flow_index_add(&flows, buffer, bufs[i], records[i], records[i + 1], timestamps[i]);
+                }
+            }
+            copy_stream_fence();
 
-                rte_pktmbuf_free(bufptr);
+            if (!zc_active) {
+                rte_pktmbuf_free_bulk(bufs, nb_rx);
             }
 
             /* Update stats */
             config->stats->packets += nb_rx;
-            config->stats->buffer_packets += nb_rx;
-            flush = 0;
-        } else {
-            flush++;
+            *target_packets += nb_rx;
         }
 
-        /* Enqueue buffer to be flushed if full and get a new one */
-        if (buffer->offset > watermark || (flush > 9999999 && buffer->offset > disk_blk_size)) {
+        /* Enqueue buffer to be flushed if full, or once its first packets are flush_ms old, and get a new one */
+        if (likely(buffer != NULL)
+            && (buffer->offset > watermark || config->stats->buffer_packets > max_packets - burst_size
+                || buffer->nb_flows > FLOW_INDEX_ENTRIES - burst_size
+                || (config->stats->buffer_packets && rte_rdtsc() - buffer->rx_at > flush_cycles))) {
             buffer->packets = config->stats->buffer_packets;
-            overrun = buffer->offset % disk_blk_size;
-            if (overrun) {
-                buffer->offset -= overrun;
-                overrun_start = buffer->offset;
-                oldbuf = buffer->buffer;
+            /* Keep whole packets in each buffer, so files can be rotated in between */
+            if (format == PCAP_FORMAT_PCAPNG) {
+                pcapng_buffer_pad(buffer, disk_blk_size);
+            } else if (!zero_copy) {
+                pcap_buffer_pad(buffer, disk_blk_size);
             }
-
-            while (!(rte_ring_sp_enqueue_bulk(pbuf_full_ring, (void**)&buffer, 1, NULL) || unlikely(*stop_condition))) {
-                if (flow_control) {
-                    config->stats->pause_frames +=
-                        send_pause_frames(port, queue, pause_frame, pause_mbufs, pause_burst_size, pause_mbuf_pool);
-                }
+            config->stats->buffer_packets = 0;
+            if (flows.slots) {
+                flow_index_reset(&flows);
             }
 
-            config->stats->buffer_packets = 0;
+            if (unlikely(trigger != NULL) && rte_rdtsc() >= recorder.dump_until) {
+                /* Keep the buffer as history, and reuse the oldest one when no buffer is free */
+                recorder_push(&recorder, trigger, buffer, &zc_held, config->stats);
+                if (!dequeue_free(pbuf_free_ring, &recorder, &buffer, &nb_free)) {
+                    buffer = recorder_evict(&recorder, &zc_held, config->stats);
+                }
+            } else if (overload != OVERLOAD_STALL) {
+                /* Keep polling the NIC when no buffer can be taken right away */
+                if (!enqueue_buffer(config, buffer)) {
+                    pending = buffer;
+                    buffer = NULL;
+                } else if (!dequeue_free(pbuf_free_ring, &recorder, &buffer, &nb_free)) {
+                    buffer = NULL;
+                }
+                if (unlikely(!buffer)) {
+                    overload_start = rte_rdtsc();
+                    config->stats->free_pbufs_low = 0;
+                    config->stats->overload_episodes++;
+                    config->stats->last_overload = time(NULL);
+                    continue;
+                }
+            } else {
+                stall_start = 0;
+                while (!enqueue_buffer(config, buffer)) {
+                    if (unlikely(*stop_condition)) {
+                        /* Handed over with the last buffers */
+                        pending = buffer;
+                        buffer = NULL;
+                        break;
+                    }
+                    if (!stall_start) {
+                        stall_start = rte_rdtsc();
+                        config->stats->full_ring_stalls++;
+                    }
+                    if (flow_control) {
+                        config->stats->pause_frames +=
+                            send_pause_frames(port, queue, pause_frame, pause_mbufs, pause_burst_size, pause_mbuf_pool);
+                    }
+                }
+                if (unlikely(stall_start)) {
+                    config->stats->full_ring_stall_cycles += rte_rdtsc() - stall_start;
+                }
 
-            while (!(rte_ring_sc_dequeue_bulk(pbuf_free_ring, (void**)&buffer, 1, NULL) || unlikely(*stop_condition))) {
-                if (flow_control) {
-                    config->stats->pause_frames +=
-                        send_pause_frames(port, queue, pause_frame, pause_mbufs, pause_burst_size, pause_mbuf_pool);
+                stall_start = 0;
+                while (buffer && !dequeue_free(pbuf_free_ring, &recorder, &buffer, &nb_free)) {
+                    if (unlikely(*stop_condition)) {
+                        buffer = NULL;
+                        break;
+                    }
+                    if (!stall_start) {
+                        stall_start = rte_rdtsc();
+                        config->stats->free_ring_stalls++;
+                    }
+                    if (flow_control) {
+                        config->stats->pause_frames +=
+                            send_pause_frames(port, queue, pause_frame, pause_mbufs, pause_burst_size, pause_mbuf_pool);
+                    }
+                }
+                if (unlikely(stall_start)) {
+                    config->stats->free_ring_stall_cycles += rte_rdtsc() - stall_start;
+                }
+                if (unlikely(!buffer)) {
+                    break;
                 }
             }
 
-            if (overrun) {
-                rte_memcpy(buffer->buffer, oldbuf + overrun_start, overrun);
-                buffer->offset += overrun;
+            /* Only a buffer taken from the ring tells how many are left */
+            if (nb_free != UINT32_MAX) {
+                if (unlikely(nb_free < config->stats->free_pbufs_low)) {
+                    config->stats->free_pbufs_low = nb_free;
+                }
+                if (config->sample.adaptive) {
+                    adapt_sample_rate(config, &sample, nb_free, &sample_logged_at);
+                }
             }
+
+            /* The mbufs of a returned buffer have been freed by the writing core */
+            zc_held -= buffer->nb_mbufs;
+            buffer->nb_mbufs = 0;
         }
     }
 
-    if (buffer->offset) {
+    /*
+     * Hand the last buffers over, then the end of stream: the writing cores
+     * run until they get the end of stream of each of their queues
+     */
+    if (pending && !pcap_buffer_enqueue_last(pbuf_full_ring, pending)) {
+        LOG_ERR("Port %u queue %u: the writing cores are stuck, %u packets lost\n", port, queue, pending->packets);
+    }
+    if (unlikely(overload_start)) {
+        config->stats->overload_cycles += rte_rdtsc() - overload_start;
+    }
+    if (!buffer && reserve.packets) {
+        /* The packets kept while overloaded go into a buffer freed by the writing cores */
+        stall_start = rte_get_tsc_cycles();
+        while (!dequeue_free(pbuf_free_ring, &recorder, &buffer, NULL)
+               && rte_get_tsc_cycles() - stall_start < PCAP_EOS_TIMEOUT_MS * rte_get_tsc_hz() / 1000) {
+            rte_pause();
+        }
+        if (buffer) {
+            zc_held -= buffer->nb_mbufs;
+            buffer->nb_mbufs = 0;
+            restore_reserve(buffer, &reserve, zero_copy, &config->stats->buffer_packets);
+        } else {
+            config->stats->shed_packets += reserve.packets;
+        }
+    }
+    /* Outside a post-trigger window, the history and the last packets are not written */
+    if (unlikely(trigger != NULL)) {
+        while (recorder.nb_history) {
+            recorder_evict(&recorder, &zc_held, config->stats);
+        }
+        if (buffer && rte_rdtsc() >= recorder.dump_until) {
+            buffer->packets = config->stats->buffer_packets;
+            discard_buffer(buffer, &zc_held);
+            buffer = NULL;
+        }
+    }
+    if (buffer && buffer->offset) {
         buffer->packets = config->stats->buffer_packets;
-        unsigned int underrun = disk_blk_size - (buffer->offset % disk_blk_size);
-        memset(buffer->buffer + buffer->offset, 0, underrun);
-        if (underrun > header_size) {
-            add_pad_packet((struct pcap_packet_header*)(buffer->buffer + buffer->offset), underrun);
+        if (format == PCAP_FORMAT_PCAPNG) {
+            pcapng_buffer_pad(buffer, disk_blk_size);
+        } else if (!zero_copy) {
+            pcap_buffer_pad(buffer, disk_blk_size);
+        }
+        config->stats->buffer_packets = 0;
+        if (!pcap_buffer_enqueue_last(pbuf_full_ring, buffer)) {
+            LOG_ERR("Port %u queue %u: the writing cores are stuck, %u packets lost\n", port, queue,
+                    buffer->packets);
         }
-        buffer->offset += underrun;
-        rte_ring_sp_enqueue_bulk(pbuf_full_ring, (void**)&buffer, 1, NULL);
     }
+    if (!pcap_buffer_enqueue_last(pbuf_full_ring, PCAP_BUFFER_EOS)) {
+        LOG_ERR("Port %u queue %u: could not hand the end of stream over\n", port, queue);
+    }
+
+    rte_free(reserve.buffer);
+    rte_free(recorder.history);
+    rte_free(recorder.spares);
+    dedup_exit(&dedup);
+    flow_index_exit(&flows);
 
     LOG_INFO("Closed capture core %d (port %d)\n", rte_lcore_id(), port);
 
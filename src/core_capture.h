@@ -4,13 +4,40 @@
 #include <rte_ethdev.h>
 #include <rte_mbuf.h>
 
+#include "dedup.h"
+#include "filter.h"
+#include "flow_index.h"
+#include "histogram.h"
+#include "nic.h"
 #include "pcap.h"
+#include "sample.h"
+#include "slice.h"
+#include "timestamp.h"
+#include "trigger.h"
 #include "utils.h"
 
 #define ETHER_TYPE_FLOW_CONTROL 0x8808
 #define OPCODE_PAUSE            0x0001
 #define PAUSE_TIME              65535
 
+/* What a capturing core does when no packet buffer is available */
+#define OVERLOAD_STALL   0 /* wait for a buffer, sending pause frames with flow control */
+#define OVERLOAD_DROP    1 /* keep polling the queue and drop the packets */
+#define OVERLOAD_HEADERS 2 /* keep truncated packets in a reserve while it has room */
+
+#define OVERLOAD_SNAPLEN_DEFAULT 128
+#define OVERLOAD_RESERVE_LEN_MAX (4 * 1024 * 1024)
+#define OVERLOAD_LOG_PERIOD_S    1
+
+/* Shortest period between two logs of the adaptive sampling rate */
+#define SAMPLE_LOG_PERIOD_S      10
+
+/* Packets of a burst prefetched ahead of the one being laid out */
+#define CAPTURE_PREFETCH_AHEAD   4
+
+/* Default age of a partial buffer before it is handed to the writing cores */
+#define FLUSH_MS_DEFAULT 1000
+
 /* Core configuration structures */
 struct capture_core_config {
     uint16_t port;
@@ -21,12 +48,31 @@ struct capture_core_config {
     uint16_t burst_size;
     uint16_t pause_burst_size;
     uint16_t snaplen;
+    uint16_t format;       /* PCAP_FORMAT_* */
+    uint32_t interface_id; /* pcapng interface of the queue */
+    const struct flow_rules* flow; /* flow rules not offloaded to the NIC, or NULL */
+    const struct filter* filter;   /* NULL to capture everything */
+    struct slice_config slice;
+    struct dedup_config dedup;
+    struct sample_config sample;
+    uint16_t flow_index; /* index the flows of each buffer */
     uint16_t disk_blk_size;
     uint16_t flow_control;
     uint16_t mw_timestamp;
+    uint16_t timestamp;                    /* timestamping mode, unless mw_timestamp */
+    const struct timestamp_clock* clock;   /* for TIMESTAMP_HW */
+    const struct timestamp_clock* tsc;     /* for TIMESTAMP_TSC, and packets without NIC timestamp */
+    struct timestamp_dynfield ts_dynfield; /* for TIMESTAMP_HW */
+    uint16_t zero_copy;
+    uint32_t zc_max_held; /* mbufs held by the writing cores before falling back to copies */
+    uint16_t overload;         /* OVERLOAD_* */
+    uint16_t overload_snaplen; /* for OVERLOAD_HEADERS */
     bool volatile* stop_condition;
     struct capture_core_stats* stats;
     uint32_t watermark;
+    uint32_t flush_ms; /* age of the first packets of a partial buffer before it is flushed */
+    struct trigger* trigger; /* flight recorder, or NULL */
+    uint32_t nb_pbufs;       /* buffers of the queue: history of the flight recorder, load of the sampling */
 } __rte_cache_aligned;
 
 /* Statistics structure */
@@ -35,9 +81,40 @@ struct capture_core_stats {
     uint64_t packets;        //Packets successfully received
     uint32_t buffer_packets; //Packets in one pcap buffer
     uint64_t pause_frames;   // Pause frames sent for flow control
+    uint64_t filtered;       // Packets rejected by the flow rules or the filter
+    uint64_t duplicates;     // Copies of recent packets dropped
+    uint64_t sampled_out;    // Packets left out by sampling
+    uint32_t sample_rate;    // 1 in sample_rate packets kept, 0 when not sampling
+    uint64_t zc_packets;     // Packets passed to the writing core without copy
+    uint64_t zc_copied;      // Packets copied because too many mbufs were held
+    uint32_t zc_held;        // Mbufs currently held by writing cores
     struct rte_ring* pbuf_free_ring;
+    struct histogram rx_to_enqueue; // From the first burst of a buffer to its enqueue
+    /* Stalls waiting for room in the full ring, or for a free buffer */
+    uint64_t full_ring_stalls;
+    uint64_t full_ring_stall_cycles;
+    uint64_t free_ring_stalls;
+    uint64_t free_ring_stall_cycles;
+    uint32_t free_pbufs_low; // Fewest free buffers left after taking one
+    /* Overload episodes, when packets were shed instead of stalling */
+    uint64_t overload_episodes;
+    uint64_t overload_cycles;
+    uint64_t shed_packets;      // Packets dropped while overloaded
+    uint64_t shed_bytes;        // Their wire length
+    uint64_t truncated_packets; // Packets kept truncated in the reserve
+    uint64_t last_overload;     // Start of the last episode, in seconds since the epoch
+    /* Flight recorder */
+    uint64_t history_buffers; // Buffers kept as history
+    uint64_t evicted_buffers; // Buffers emptied without being written
+    uint64_t dumped_buffers;  // History buffers handed over upon a trigger
 } __rte_cache_aligned;
 
+/*
+ * Parses an overload policy: "stall", "drop" or "headers[:LEN]", returns
+ * -EINVAL when invalid
+ */
+int capture_overload_parse_opt(const char* arg, uint16_t* policy, uint16_t* snaplen);
+
 /* Launches a capture task */
 int capture_core(const struct capture_core_config* config);
 
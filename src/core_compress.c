@@ -0,0 +1,132 @@
+#include "core_compress.h"
+
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+
+/*
+ * Gives the pcap buffers of each queue back uncompressed, until its end of
+ * stream, which is forwarded so that the writing cores stop
+ */
+static void
+discard_queues(struct compress_core_config* config) {
+    const uint16_t nb_queues = config->nb_queues;
+    struct pcap_buffer* buffer;
+    bool eos[nb_queues];
+    uint16_t q, nb_eos = 0;
+
+    memset(eos, 0, sizeof(eos));
+
+    while (nb_eos < nb_queues) {
+        for (q = 0; q < nb_queues; q++) {
+            if (eos[q] || !rte_ring_sc_dequeue_bulk(config->pbuf_full_rings[q], (void**)&buffer, 1, NULL)) {
+                continue;
+            }
+
+            if (unlikely(buffer == PCAP_BUFFER_EOS)) {
+                if (!pcap_buffer_enqueue_last(config->zbuf_full_rings[q], buffer)) {
+                    LOG_ERR("Core %u could not hand the end of stream over\n", rte_lcore_id());
+                }
+                eos[q] = true;
+                nb_eos++;
+                continue;
+            }
+
+            /* The packets of the buffer are lost */
+            config->stats->errors++;
+            buffer->offset = 0;
+            rte_ring_sp_enqueue_bulk(config->pbuf_free_rings[q], (void**)&buffer, 1, NULL);
+        }
+    }
+}
+
+/*
+ * Compresses the pcap buffers of a set of queues
+ */
+int
+compress_core(struct compress_core_config* config) {
+    struct compress_core_stats* stats = config->stats;
+    const uint16_t disk_blk_size = config->disk_blk_size;
+    const uint16_t nb_queues = config->nb_queues;
+    struct pcap_buffer *buffer, *zbuffer;
+    struct pcap_buffer* spare[nb_queues]; /* compressed buffers kept after a failure */
+    bool eos[nb_queues];
+    struct compressor compressor;
+    uint64_t start;
+    ssize_t len;
+    uint16_t q, nb_eos = 0;
+
+    LOG_INFO("Core %u is compressing %u queue(s) of port %u with %s level %d\n", rte_lcore_id(), nb_queues,
+             config->port, compress_algo_name(config->compress.algo), config->compress.level);
+
+    //Init stats
+    stats->core_id = rte_lcore_id();
+    stats->port = config->port;
+
+    if (compressor_init(&compressor, &config->compress) < 0) {
+        LOG_ERR("Core %u could not set up compression, the packets of its queues are lost\n", rte_lcore_id());
+        discard_queues(config);
+        return -1;
+    }
+
+    memset(spare, 0, sizeof(spare));
+    memset(eos, 0, sizeof(eos));
+
+    /* Run until the last buffers of each queue are compressed */
+    while (nb_eos < nb_queues) {
+        for (q = 0; q < nb_queues; q++) {
+            /* Only take a buffer when it can be compressed right away */
+            if (eos[q] || (!spare[q] && rte_ring_count(config->zbuf_free_rings[q]) == 0)
+                || !rte_ring_sc_dequeue_bulk(config->pbuf_full_rings[q], (void**)&buffer, 1, NULL)) {
+                continue;
+            }
+
+            /* Forward the end of stream of the queue after its last compressed buffer */
+            if (unlikely(buffer == PCAP_BUFFER_EOS)) {
+                if (!pcap_buffer_enqueue_last(config->zbuf_full_rings[q], buffer)) {
+                    LOG_ERR("Core %u could not hand the end of stream over\n", rte_lcore_id());
+                }
+                eos[q] = true;
+                nb_eos++;
+                continue;
+            }
+            if (spare[q]) {
+                zbuffer = spare[q];
+                spare[q] = NULL;
+            } else {
+                rte_ring_sc_dequeue_bulk(config->zbuf_free_rings[q], (void**)&zbuffer, 1, NULL);
+            }
+
+            start = rte_rdtsc();
+            len = compress_frame(&compressor, zbuffer->buffer, zbuffer->size, buffer->buffer, buffer->offset,
+                                 disk_blk_size);
+            stats->cycles += rte_rdtsc() - start;
+
+            if (likely(len >= 0)) {
+                stats->buffers++;
+                stats->bytes_in += buffer->offset;
+                stats->bytes_out += len;
+                zbuffer->offset = len;
+                zbuffer->packets = buffer->packets;
+            } else {
+                /* The packets of the buffer are lost */
+                stats->errors++;
+            }
+
+            buffer->offset = 0;
+            rte_ring_sp_enqueue_bulk(config->pbuf_free_rings[q], (void**)&buffer, 1, NULL);
+
+            if (likely(len >= 0)) {
+                zbuffer->enqueued_at = rte_rdtsc();
+                rte_ring_enqueue_bulk(config->zbuf_full_rings[q], (void**)&zbuffer, 1, NULL);
+            } else {
+                spare[q] = zbuffer;
+            }
+        }
+    }
+
+    compressor_exit(&compressor);
+
+    LOG_INFO("Closed compression core %u\n", rte_lcore_id());
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef DPDKCAP_CORE_COMPRESS_H
+#define DPDKCAP_CORE_COMPRESS_H
+
+#include <rte_ring.h>
+
+#include "compress.h"
+#include "pcap.h"
+#include "utils.h"
+
+/*
+ * Compression core configuration. A compression core serves a set of
+ * queues: it takes the full pcap buffers of each queue, compresses them
+ * into buffers of a second pool, and hands these to the writing cores.
+ * It stops once it has forwarded the end of stream of each queue.
+ */
+struct compress_core_config {
+    uint16_t port;
+    uint16_t nb_queues;
+    struct rte_ring** pbuf_full_rings; /* filled by the capture cores */
+    struct rte_ring** pbuf_free_rings; /* back to the capture cores */
+    struct rte_ring** zbuf_free_rings; /* compressed buffers, back from the writing cores */
+    struct rte_ring** zbuf_full_rings; /* to the writing cores, possibly shared */
+    struct compress_config compress;
+    uint16_t disk_blk_size;
+    struct compress_core_stats* stats;
+} __rte_cache_aligned;
+
+/* Statistics structure */
+struct compress_core_stats {
+    uint16_t core_id;
+    uint16_t port;
+    uint64_t buffers;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t cycles; /* spent compressing */
+    uint64_t errors;
+} __rte_cache_aligned;
+
+/* Launches a compression task */
+int compress_core(struct compress_core_config* config);
+
+#endif
@@ -1,18 +1,33 @@
 #include "core_write.h"
+#include "uring_writer.h"
 
 /*
  * Change file name from template
  */
 static void
-format_from_template(char* filename, const char* template, const int core_id) {
+format_from_template(char* filename, const struct output_file* output, const unsigned int file_idx, const time_t ts) {
 
     char str_buf[OUTPUT_FILENAME_LENGTH];
+    struct tm tm;
 
     //Change file name
-    strncpy(filename, template, OUTPUT_FILENAME_LENGTH);
-    snprintf(str_buf, 50, "%02d", core_id);
+    strncpy(filename, output->template, OUTPUT_FILENAME_LENGTH);
+    snprintf(str_buf, 50, "%02d", output->core_id);
     while (str_replace(filename, "\%COREID", str_buf))
         ;
+    snprintf(str_buf, 50, "%u", output->port);
+    while (str_replace(filename, OUTPUT_TEMPLATE_TOKEN_PORT, str_buf))
+        ;
+    snprintf(str_buf, 50, "%02u", output->queue);
+    while (str_replace(filename, OUTPUT_TEMPLATE_TOKEN_QUEUE, str_buf))
+        ;
+    snprintf(str_buf, 50, "%04u", file_idx);
+    while (str_replace(filename, OUTPUT_TEMPLATE_TOKEN_FILE_IDX, str_buf))
+        ;
+    gmtime_r(&ts, &tm);
+    strftime(str_buf, 50, "%Y%m%d-%H%M%S", &tm);
+    while (str_replace(filename, OUTPUT_TEMPLATE_TOKEN_TS, str_buf))
+        ;
     strncpy(str_buf, filename, OUTPUT_FILENAME_LENGTH);
 }
 
@@ -20,9 +35,15 @@ format_from_template(char* filename, const char* template, const int core_id) {
  * Open pcap file for writing
  */
 static inline int
-open_pcap(char* output_file, unsigned char* file_header, uint16_t disk_blk_size) {
+open_pcap(char* output_file, const struct output_file* output, bool direct, uint64_t* offset) {
 
-    int fd = open(output_file, O_CREAT | O_WRONLY | O_TRUNC | O_DIRECT | O_NOATIME, 0644);
+    int fd = -1, direct_errno = 0;
+    unsigned int header_len = output->file_header_len;
+
+    if (direct) {
+        fd = open(output_file, O_CREAT | O_WRONLY | O_TRUNC | O_DIRECT | O_NOATIME, 0644);
+        direct_errno = errno;
+    }
 
     if (fd < 0) {
         fd = open(output_file, O_CREAT | O_WRONLY | O_TRUNC | O_NOATIME, 0644);
@@ -33,18 +54,22 @@ open_pcap(char* output_file, unsigned char* file_header, uint16_t disk_blk_size)
             return 0;
         }
 
-        LOG_WARN("Core %d could not open %s in direct write mode: %d (%s)\n", rte_lcore_id(), output_file, errno,
-                 strerror(errno));
-        LOG_INFO("Core %d using normal write mode\n", rte_lcore_id());
-        disk_blk_size = sizeof(struct pcap_file_header);
+        if (direct) {
+            LOG_WARN("Core %d could not open %s in direct write mode: %d (%s)\n", rte_lcore_id(), output_file,
+                     direct_errno, strerror(direct_errno));
+            LOG_INFO("Core %d using normal write mode\n", rte_lcore_id());
+        }
+        header_len = output->file_header_size;
     }
 
-    int written = write(fd, file_header, disk_blk_size);
+    int written = write(fd, output->file_header, header_len);
     if (written < 0) {
         LOG_ERR("Core %d unable to write pcap file header: %d (%s)\n", rte_lcore_id(), errno, strerror(errno));
+        close(fd);
         return 0;
     }
 
+    *offset = written;
     return fd;
 }
 
@@ -60,100 +85,955 @@ close_pcap(int fd) {
     return retval;
 }
 
+static const char* const sidecar_suffixes[] = {
+    [SIDECAR_FLOWS] = FLOW_INDEX_SUFFIX,
+    [SIDECAR_TIMES] = TIME_INDEX_SUFFIX,
+};
+
+static const char* const sidecar_magics[] = {
+    [SIDECAR_FLOWS] = FLOW_INDEX_MAGIC,
+    [SIDECAR_TIMES] = TIME_INDEX_MAGIC,
+};
+
 /*
- * Write the packets from the pcap buffer into a file
+ * Name of a sidecar of an output file
  */
-int
-write_core(const struct write_core_config* config) {
-    const unsigned socket_id = rte_socket_id();
-    unsigned dev_socket_id;
+static inline void
+sidecar_name(char* name, const char* output_name, unsigned int kind) {
+    snprintf(name, SIDECAR_NAME_LENGTH, "%s%s", output_name, sidecar_suffixes[kind]);
+}
 
-    volatile bool* stop_condition = config->stop_condition;
+/*
+ * Opens a sidecar of an output file, and writes its header. Returns -1 on
+ * failure, the output file is then written without this sidecar.
+ */
+static int
+open_sidecar(const struct write_core_config* config, const struct output_file* output, const char* output_name,
+             unsigned int file_index, unsigned int kind) {
+    char name[SIDECAR_NAME_LENGTH];
+    struct index_header header;
+    int fd;
 
-    const uint16_t port = config->port;
+    sidecar_name(name, output_name, kind);
+    fd = open(name, O_CREAT | O_WRONLY | O_TRUNC | O_NOATIME, 0644);
+    if (fd < 0) {
+        LOG_ERR("Could not open index %s: %d (%s)\n", name, errno, strerror(errno));
+        return -1;
+    }
 
-    struct rte_ring* pbuf_free_ring = config->pbuf_free_ring;
-    struct rte_ring* pbuf_full_ring = config->pbuf_full_ring;
-    int pcap_file;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, sidecar_magics[kind], sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.disk_blk_size = config->disk_blk_size;
+    header.file_index = file_index;
+    header.port = output->port;
+    header.queue = output->queue;
+    header.seed = kind == SIDECAR_FLOWS ? FLOW_INDEX_SEED : 0;
+    header.sample_rate = config->sample_rate;
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        LOG_ERR("Could not write the header of index %s: %d (%s)\n", name, errno, strerror(errno));
+        close(fd);
+        unlink(name);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Opens the sidecars written next to an output file
+ */
+static void
+open_sidecars(const struct write_core_config* config, const struct output_file* output, const char* output_name,
+              unsigned int file_index, int* fds) {
+    unsigned int kind;
+
+    for (kind = 0; kind < SIDECAR_MAX; kind++) {
+        fds[kind] = config->sidecars & (1 << kind) ? open_sidecar(config, output, output_name, file_index, kind) : -1;
+    }
+}
+
+static void
+close_sidecars(int* fds) {
+    unsigned int kind;
+
+    for (kind = 0; kind < SIDECAR_MAX; kind++) {
+        if (fds[kind] >= 0) {
+            close(fds[kind]);
+            fds[kind] = -1;
+        }
+    }
+}
+
+/*
+ * Syncs the sidecars of an output file along with it
+ */
+static void
+sync_sidecars(const struct output_file* output) {
+    unsigned int kind;
+
+    for (kind = 0; kind < SIDECAR_MAX; kind++) {
+        if (output->sidecar_fds[kind] >= 0 && fdatasync(output->sidecar_fds[kind]) < 0) {
+            LOG_ERR("Could not sync the index of %s: %s\n", output->name, strerror(errno));
+        }
+    }
+}
+
+/*
+ * Appends the flow index of buffers, written (or, with io_uring, being
+ * written) at the current offset of the output file, into its sidecar. The
+ * position of the records of each buffer is kept in flows_at.
+ */
+static void
+write_flow_index(const struct write_core_config* config, const struct output_file* output,
+                 struct pcap_buffer** buffers, uint16_t nb_bufs, struct iovec* iov) {
+    int fd = output->sidecar_fds[SIDECAR_FLOWS];
+    uint64_t offset = output->offset;
+    uint64_t nb_records = 0;
+    off_t position = -1;
+    ssize_t len = 0;
+    uint32_t r;
+    uint16_t i;
+    int nb_iov = 0;
+
+    if (fd >= 0) {
+        position = lseek(fd, 0, SEEK_CUR);
+    }
+
+    for (i = 0; i < nb_bufs; i++) {
+        buffers[i]->flows_at = UINT64_MAX;
+        if (buffers[i]->nb_flows) {
+            for (r = 0; r < buffers[i]->nb_flows; r++) {
+                buffers[i]->flows[r].offset += offset;
+            }
+            if (position >= 0) {
+                buffers[i]->flows_at = position + len;
+            }
+            iov[nb_iov].iov_base = buffers[i]->flows;
+            iov[nb_iov].iov_len = buffers[i]->nb_flows * sizeof(struct flow_index_record);
+            len += iov[nb_iov].iov_len;
+            nb_iov++;
+            nb_records += buffers[i]->nb_flows;
+        }
+        offset += buffers[i]->offset;
+    }
+
+    if (fd < 0 || !nb_iov) {
+        return;
+    }
+    if (writev(fd, iov, nb_iov) != len) {
+        LOG_ERR("Could not write the flow index of %s: %d (%s)\n", output->name, errno, strerror(errno));
+        for (i = 0; i < nb_bufs; i++) {
+            buffers[i]->flows_at = UINT64_MAX;
+        }
+        return;
+    }
+    config->stats->flow_records += nb_records;
+}
+
+/*
+ * Empties the index records of a buffer whose io_uring write failed, so
+ * that they no longer point into the output file
+ */
+static void
+drop_indexes(const struct write_core_config* config, struct pcap_buffer* buffer) {
+    const struct output_file* output = &config->outputs[buffer->origin * config->nb_devices + buffer->device];
+    /* The sidecars of a rotated file stay open until its writes complete */
+    const int* fds = buffer->fd == output->fd ? output->sidecar_fds : output->retired_sidecar_fds;
+    ssize_t len = buffer->nb_flows * sizeof(struct flow_index_record);
+    const uint32_t empty[2] = {0, 0}; /* length and packets */
+    uint32_t r;
+
+    if (fds[SIDECAR_TIMES] >= 0 && buffer->times_at != UINT64_MAX
+        && pwrite(fds[SIDECAR_TIMES], empty, sizeof(empty),
+                  buffer->times_at + offsetof(struct time_index_record, length)) != sizeof(empty)) {
+        LOG_ERR("Could not drop the time index of a buffer: %d (%s)\n", errno, strerror(errno));
+    }
+
+    if (fds[SIDECAR_FLOWS] >= 0 && buffer->flows_at != UINT64_MAX && len) {
+        for (r = 0; r < buffer->nb_flows; r++) {
+            buffer->flows[r].length = 0;
+        }
+        if (pwrite(fds[SIDECAR_FLOWS], buffer->flows, len, buffer->flows_at) != len) {
+            LOG_ERR("Could not drop the flow index of a buffer: %d (%s)\n", errno, strerror(errno));
+        }
+        config->stats->flow_records -= buffer->nb_flows;
+    }
+}
 
+/*
+ * Appends the time index of buffers, written (or, with io_uring, being
+ * written) at the current offset of the output file, into its sidecar. The
+ * position of the record of each buffer is kept in times_at.
+ */
+static void
+write_time_index(const struct output_file* output, struct pcap_buffer** buffers, uint16_t nb_bufs) {
+    struct time_index_record records[nb_bufs];
+    int fd = output->sidecar_fds[SIDECAR_TIMES];
+    uint64_t offset = output->offset;
+    ssize_t len = nb_bufs * sizeof(struct time_index_record);
+    off_t position;
+    uint16_t i;
+
+    for (i = 0; i < nb_bufs; i++) {
+        buffers[i]->times_at = UINT64_MAX;
+    }
+    if (fd < 0) {
+        return;
+    }
+    position = lseek(fd, 0, SEEK_CUR);
+
+    for (i = 0; i < nb_bufs; i++) {
+        records[i].offset = offset;
+        records[i].length = buffers[i]->offset;
+        records[i].packets = buffers[i]->packets;
+        records[i].first_ns = buffers[i]->first_ns;
+        records[i].last_ns = buffers[i]->last_ns;
+        records[i].sample_rate = buffers[i]->sample_rate;
+        offset += buffers[i]->offset;
+    }
+
+    if (write(fd, records, len) != len) {
+        LOG_ERR("Could not write the time index of %s: %d (%s)\n", output->name, errno, strerror(errno));
+        return;
+    }
+    for (i = 0; position >= 0 && i < nb_bufs; i++) {
+        buffers[i]->times_at = position + i * sizeof(struct time_index_record);
+    }
+}
+
+/*
+ * Compresses a block written by the main lcore into a padded frame, like
+ * the buffers of the compression cores. Returns the frame (to be freed) and
+ * its length, or NULL.
+ */
+static unsigned char*
+compress_block(const struct write_core_config* config, const unsigned char* buf, unsigned int* len) {
+    struct compressor compressor;
+    unsigned char* frame;
+    size_t size;
+    ssize_t frame_len = -1;
+
+    size = compress_frame_bound(config->compress, *len, config->disk_blk_size);
+    frame = rte_zmalloc(NULL, size, config->disk_blk_size);
+    if (frame && compressor_init(&compressor, config->compress) == 0) {
+        frame_len = compress_frame(&compressor, frame, size, buf, *len, config->disk_blk_size);
+        compressor_exit(&compressor);
+    }
+    if (frame_len < 0) {
+        rte_free(frame);
+        return NULL;
+    }
+
+    *len = frame_len;
+    return frame;
+}
+
+/*
+ * Ends a pcapng file with the statistics of its interface
+ */
+static void
+write_interface_stats(const struct write_core_config* config, const struct output_file* output, int fd,
+                      uint64_t offset) {
+    struct pcapng_interface_stats isb;
+    struct rte_eth_stats port_stats;
+    struct timespec now;
+    unsigned char *buf, *frame;
+    unsigned int len, pad_len;
     uint16_t disk_blk_size = config->disk_blk_size;
-    unsigned char* file_header = rte_zmalloc(NULL, disk_blk_size, disk_blk_size);
-    uint16_t i, nb_bufs;
+
+    buf = rte_zmalloc(NULL, 2 * disk_blk_size, disk_blk_size);
+    if (!buf) {
+        LOG_ERR("Could not allocate the interface statistics of %s\n", output->name);
+        return;
+    }
+
+    memset(&isb, 0, sizeof(isb));
+    clock_gettime(CLOCK_REALTIME, &now);
+    isb.interface_id = output->interface_id;
+    isb.timestamp = now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    if (rte_eth_stats_get(output->port, &port_stats) == 0) {
+        if (output->queue < RTE_ETHDEV_QUEUE_STAT_CNTRS) {
+            isb.received = port_stats.q_ipackets[output->queue];
+        }
+        /* Drops are only counted per port, they are reported with the first queue */
+        if (output->queue == 0) {
+            isb.has_drops = true;
+            isb.if_dropped = port_stats.imissed;
+            isb.os_dropped = port_stats.rx_nombuf;
+            isb.comment = "Drop counters are for the whole port";
+        }
+    }
+
+    len = pcapng_isb_build(buf, &isb);
+    if (config->compress) {
+        frame = compress_block(config, buf, &len);
+        rte_free(buf);
+        if (!frame) {
+            LOG_ERR("Could not compress the interface statistics of %s\n", output->name);
+            return;
+        }
+        buf = frame;
+    } else {
+        pad_len = pcapng_pad_length(offset + len, disk_blk_size);
+        if (pad_len) {
+            pcapng_pad(buf + len, pad_len);
+            len += pad_len;
+        }
+    }
+
+    if (pwrite(fd, buf, len, offset) != (ssize_t)len) {
+        LOG_ERR("Could not write the interface statistics: %d (%s)\n", errno, strerror(errno));
+    }
+    rte_free(buf);
+}
+
+/*
+ * Completes and closes an output file
+ */
+static void
+finish_file(const struct write_core_config* config, const struct output_file* output, int fd, uint64_t offset) {
+    if (config->format == PCAP_FORMAT_PCAPNG) {
+        write_interface_stats(config, output, fd, offset);
+    }
+    close_pcap(fd);
+}
+
+/*
+ * Switches to the successor file, if the main lcore has prepared it.
+ * Returns the descriptor of the previous file, or -1.
+ */
+static inline int
+rotate_file(struct output_file* output, struct write_core_stats* stats) {
+    int fd;
+
+    if (__atomic_load_n(&output->next_state, __ATOMIC_ACQUIRE) != NEXT_FILE_READY) {
+        return -1;
+    }
+
+    fd = output->fd;
+    output->retired_offset = output->offset;
+    output->fd = output->next_fd;
+    output->offset = output->next_offset;
+    output->next_fd = -1;
+    /* The sidecars are written synchronously, the main lcore may close them right away */
+    rte_memcpy(output->retired_sidecar_fds, output->sidecar_fds, sizeof(output->sidecar_fds));
+    rte_memcpy(output->sidecar_fds, output->next_sidecar_fds, sizeof(output->sidecar_fds));
+    memset(output->next_sidecar_fds, -1, sizeof(output->next_sidecar_fds));
+    __atomic_store_n(&output->next_state, NEXT_FILE_NONE, __ATOMIC_RELAXED);
+    output->index++;
+    output->size = 0;
+    output->opened_at = time(NULL);
+    rte_memcpy(output->name, output->next_name, OUTPUT_FILENAME_LENGTH);
+
+    rte_memcpy(stats->output_file, output->name, OUTPUT_FILENAME_LENGTH);
+    stats->current_file_bytes = 0;
+    stats->files++;
+
+    return fd;
+}
+
+/*
+ * Hands a rotated file over to the main lcore, which closes it and prepares
+ * the next successor. Writes to the file must have completed.
+ */
+static inline void
+retire_file(struct output_file* output, int fd) {
+    output->retired_fd = fd;
+    __atomic_store_n(&output->next_state, NEXT_FILE_REQUESTED, __ATOMIC_RELEASE);
+}
+
+static void
+prepare_file(const struct write_core_config* config, struct output_file* output) {
+    char file_name[OUTPUT_FILENAME_LENGTH];
+    char sidecar[SIDECAR_NAME_LENGTH], new_sidecar[SIDECAR_NAME_LENGTH];
+    unsigned int kind;
+    int fd;
+
+    if (__atomic_load_n(&output->next_state, __ATOMIC_ACQUIRE) != NEXT_FILE_REQUESTED) {
+        return;
+    }
+
+    //Close the file left by the last rotation
+    if (output->retired_fd >= 0) {
+        finish_file(config, output, output->retired_fd, output->retired_offset);
+        output->retired_fd = -1;
+    }
+    close_sidecars(output->retired_sidecar_fds);
+
+    //Give the current file its actual opening time
+    format_from_template(file_name, output, output->index, output->opened_at);
+    if (strcmp(file_name, output->name)) {
+        if (rename(output->name, file_name)) {
+            LOG_WARN("Could not rename %s to %s: %d (%s)\n", output->name, file_name, errno, strerror(errno));
+        } else {
+            for (kind = 0; kind < SIDECAR_MAX; kind++) {
+                if (!(config->sidecars & (1 << kind))) {
+                    continue;
+                }
+                sidecar_name(sidecar, output->name, kind);
+                sidecar_name(new_sidecar, file_name, kind);
+                if (rename(sidecar, new_sidecar)) {
+                    LOG_WARN("Could not rename %s to %s: %d (%s)\n", sidecar, new_sidecar, errno, strerror(errno));
+                }
+            }
+            rte_memcpy(output->name, file_name, OUTPUT_FILENAME_LENGTH);
+            rte_memcpy(config->stats->output_file, file_name, OUTPUT_FILENAME_LENGTH);
+        }
+    }
+
+    //Open the successor, retried on the next call on failure
+    format_from_template(output->next_name, output, output->index + 1, time(NULL));
+    fd = open_pcap(output->next_name, output, !config->zero_copy, &output->next_offset);
+    if (!fd) {
+        return;
+    }
+
+    output->next_fd = fd;
+    open_sidecars(config, output, output->next_name, output->index + 1, output->next_sidecar_fds);
+    __atomic_store_n(&output->next_state, NEXT_FILE_READY, __ATOMIC_RELEASE);
+}
+
+void
+write_core_prepare_files(const struct write_core_config* config) {
+    unsigned int i;
+
+    for (i = 0; i < config->nb_outputs; i++) {
+        prepare_file(config, &config->outputs[i]);
+    }
+}
+
+static void
+close_file(const struct write_core_config* config, struct output_file* output) {
+    char sidecar[SIDECAR_NAME_LENGTH];
+    unsigned int kind;
+
+    if (output->retired_fd >= 0) {
+        finish_file(config, output, output->retired_fd, output->retired_offset);
+        output->retired_fd = -1;
+    }
+    close_sidecars(output->retired_sidecar_fds);
+
+    if (output->fd > 0) {
+        finish_file(config, output, output->fd, output->offset);
+        output->fd = -1;
+    }
+    close_sidecars(output->sidecar_fds);
+
+    //Remove the unused successor
+    if (__atomic_load_n(&output->next_state, __ATOMIC_ACQUIRE) == NEXT_FILE_READY) {
+        close_pcap(output->next_fd);
+        unlink(output->next_name);
+        output->next_fd = -1;
+        for (kind = 0; kind < SIDECAR_MAX; kind++) {
+            if (output->next_sidecar_fds[kind] >= 0) {
+                sidecar_name(sidecar, output->next_name, kind);
+                unlink(sidecar);
+            }
+        }
+        close_sidecars(output->next_sidecar_fds);
+    }
+    output->next_state = NEXT_FILE_NONE;
+}
+
+void
+write_core_close_files(const struct write_core_config* config) {
+    unsigned int i;
+
+    for (i = 0; i < config->nb_outputs; i++) {
+        close_file(config, &config->outputs[i]);
+    }
+}
+
+/*
+ * Releases the mbufs held by zero-copy buffers, in bulk
+ */
+static void
+release_mbufs(struct pcap_buffer** buffers, uint16_t nb_bufs) {
+    struct pcap_buffer* buffer;
+    uint32_t p, nb_mbufs;
+    uint16_t i;
+
+    for (i = 0; i < nb_bufs; i++) {
+        buffer = buffers[i];
+        nb_mbufs = 0;
+        for (p = 0; p < buffer->packets; p++) {
+            if (buffer->mbufs[p]) {
+                buffer->mbufs[nb_mbufs++] = buffer->mbufs[p];
+            }
+        }
+        rte_pktmbuf_free_bulk(buffer->mbufs, nb_mbufs);
+    }
+}
+
+/*
+ * Writes zero-copy buffers. Packet headers and copied packets are taken from
+ * the buffers, and the packet data from the mbufs. The caller frees the
+ * mbufs with release_mbufs(), whether the write succeeded or not.
+ */
+static ssize_t
+write_zero_copy(int fd, struct pcap_buffer** buffers, uint16_t nb_bufs, struct iovec* iov) {
+    struct pcap_packet_header* header;
+    struct rte_mbuf* mbuf;
+    struct pcap_buffer* buffer;
+    unsigned char* pos;
+    uint32_t p, caplen, seg_len, len;
+    int nb_iov = 0;
+    ssize_t written, total = 0;
+    uint16_t i;
+
+    for (i = 0; i < nb_bufs; i++) {
+        buffer = buffers[i];
+        pos = buffer->buffer;
+
+        for (p = 0; p < buffer->packets; p++) {
+            header = (struct pcap_packet_header*)pos;
+            mbuf = buffer->mbufs[p];
+
+            /* Flush the iovecs before running out of them */
+            if (unlikely(nb_iov + 1 + (mbuf ? mbuf->nb_segs : 0) > IOV_MAX)) {
+                written = writev(fd, iov, nb_iov);
+                if (unlikely(written < 0)) {
+                    return written;
+                }
+                total += written;
+                nb_iov = 0;
+            }
+
+            /* Packet header, followed by the packet data when it was copied */
+            len = sizeof(struct pcap_packet_header) + (mbuf ? 0 : header->packet_length);
+            if (nb_iov && (unsigned char*)iov[nb_iov - 1].iov_base + iov[nb_iov - 1].iov_len == pos) {
+                iov[nb_iov - 1].iov_len += len;
+            } else {
+                iov[nb_iov].iov_base = pos;
+                iov[nb_iov].iov_len = len;
+                nb_iov++;
+            }
+            pos += len;
+
+            /* Packet data from the mbuf segments */
+            caplen = mbuf ? header->packet_length : 0;
+            while (mbuf && caplen) {
+                seg_len = RTE_MIN(mbuf->data_len, caplen);
+                iov[nb_iov].iov_base = rte_pktmbuf_mtod(mbuf, void*);
+                iov[nb_iov].iov_len = seg_len;
+                nb_iov++;
+                caplen -= seg_len;
+                mbuf = mbuf->next;
+            }
+        }
+    }
+
+    if (nb_iov) {
+        written = writev(fd, iov, nb_iov);
+        if (unlikely(written < 0)) {
+            return written;
+        }
+        total += written;
+    }
+
+    return total;
+}
+
+
+/*
+ * Returns buffers to the queues which filled them
+ */
+static inline void
+return_buffers(const struct write_core_config* config, struct pcap_buffer** buffers, uint16_t nb_bufs) {
+    struct rte_ring* ring;
+    uint16_t i, n;
+
+    for (i = 0; i < nb_bufs; i += n) {
+        ring = config->pbuf_free_rings[buffers[i]->origin];
+        for (n = 1; i + n < nb_bufs && buffers[i + n]->origin == buffers[i]->origin; n++)
+            ;
+        /* The free ring of a queue has room for all its buffers */
+        while (!rte_ring_enqueue_bulk(ring, (void**)&buffers[i], n, NULL))
+            rte_pause();
+    }
+}
+
+/*
+ * Returns buffers which cannot be written to the capture cores, emptied
+ */
+static void
+discard_buffers(const struct write_core_config* config, struct pcap_buffer** buffers, uint16_t nb_bufs) {
+    uint16_t i;
+
+    if (config->zero_copy) {
+        release_mbufs(buffers, nb_bufs);
+    }
+    for (i = 0; i < nb_bufs; i++) {
+        buffers[i]->offset = 0;
+        buffers[i]->packets = 0;
+        buffers[i]->nb_flows = 0;
+    }
+    return_buffers(config, buffers, nb_bufs);
+}
+
+/*
+ * Returns written buffers to the capture cores
+ */
+static inline void
+release_buffers(const struct write_core_config* config, struct stripe* stripe, struct pcap_buffer** buffers,
+                int* results, uint16_t nb_bufs) {
+    uint64_t now = rte_rdtsc();
+    uint16_t i;
+
+    for (i = 0; i < nb_bufs; i++) {
+        histogram_record(&config->stats->write, now - buffers[i]->queued_at);
+        stripe_complete(stripe, buffers[i]->device, now - buffers[i]->queued_at, results[i]);
+        if (unlikely(results[i] < 0)) {
+            LOG_ERR("Could not write into file: %d (%s)\n", -results[i], strerror(-results[i]));
+            drop_indexes(config, buffers[i]);
+        } else {
+            config->stats->packets += buffers[i]->packets;
+            config->stats->bytes += results[i];
+        }
+        buffers[i]->offset = 0;
+        buffers[i]->nb_flows = 0;
+    }
+
+    return_buffers(config, buffers, nb_bufs);
+}
+
+/*
+ * Opens the first file of a queue, on its first buffer
+ */
+static int
+open_output(const struct write_core_config* config, struct output_file* output) {
+    output->core_id = rte_lcore_id();
+    output->index = 0;
+    output->size = 0;
+    output->opened_at = time(NULL);
+    output->retiring_fd = -1;
+    output->rotate_deadline = UINT64_MAX;
+    output->sync_deadline = UINT64_MAX;
+    output->synced_size = 0;
+    format_from_template(output->name, output, output->index, output->opened_at);
+
+    LOG_INFO("Core %d is writing port %u queue %u using file template: %s.\n", rte_lcore_id(), output->port,
+             output->queue, output->template);
+
+    if (port_socket_id(output->port) != (int)rte_socket_id()) {
+        LOG_WARN("Port %u on different socket from worker; performance will suffer\n", output->port);
+    }
+
+    output->fd = open_pcap(output->name, output, !config->zero_copy, &output->offset);
+    if (!output->fd) {
+        return -1;
+    }
+    open_sidecars(config, output, output->name, output->index, output->sidecar_fds);
+
+    rte_memcpy(config->stats->output_file, output->name, OUTPUT_FILENAME_LENGTH);
+    config->stats->current_file_bytes = 0;
+    config->stats->files++;
+
+    if (config->flush_sync) {
+        output->sync_deadline = rte_get_tsc_cycles() + config->flush_ms * rte_get_tsc_hz() / 1000;
+    }
+
+    //Ask the main lcore for the successor file
+    if (config->rotate_bytes || config->rotate_seconds) {
+        if (config->rotate_seconds) {
+            output->rotate_deadline = rte_get_tsc_cycles() + config->rotate_seconds * rte_get_tsc_hz();
+        }
+        __atomic_store_n(&output->next_state, NEXT_FILE_REQUESTED, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+/*
+ * Write the packets from the pcap buffers into files
+ */
+int
+write_core(const struct write_core_config* config) {
+    struct rte_ring* pbuf_full_ring = config->pbuf_full_ring;
+    struct output_file* output;
+    struct output_file* active[config->nb_outputs];
+    unsigned int a, nb_active = 0;
+
+    uint16_t i, n, nb_bufs, max_bufs, nb_eos;
     int written, retval = 0;
     uint16_t burst_size = config->burst_size;
     struct pcap_buffer* buffers[burst_size];
+    int devices[burst_size];
+    struct stripe stripe;
+    uint64_t start, cycles;
     struct iovec iov[burst_size];
 
-    char file_name[OUTPUT_FILENAME_LENGTH];
-    unsigned int stop = 0;
-    uint64_t file_size = 0;
+    struct iovec* zc_iov = NULL;
 
-    LOG_INFO("Core %d is writing using file template: %s.\n", rte_lcore_id(), config->output_file_template);
+    uint16_t io_engine = config->io_engine;
+    struct uring_writer uw;
+    struct pcap_buffer* done[burst_size];
+    int results[burst_size];
+    uint16_t nb_done;
+    uint64_t length;
+    int result;
 
-    //Update filename
-    format_from_template(file_name, config->output_file_template, rte_lcore_id());
+    const uint64_t rotate_bytes = config->rotate_bytes;
+    const uint64_t rotate_cycles = config->rotate_seconds * rte_get_tsc_hz();
+    const uint64_t flush_cycles = config->flush_ms * rte_get_tsc_hz() / 1000;
+    uint64_t now, idle_since = 0;
+
+    LOG_INFO("Core %d is writing.\n", rte_lcore_id());
 
     //Init stats
     config->stats->core_id = rte_lcore_id();
     config->stats->pbuf_full_ring = config->pbuf_full_ring;
 
-    rte_memcpy(config->stats->output_file, file_name, OUTPUT_FILENAME_LENGTH);
+    stripe_init(&stripe, config->devices, config->nb_devices);
 
-    dev_socket_id = rte_eth_dev_socket_id(port);
-    if (dev_socket_id != socket_id) {
-        LOG_WARN("Port %u on different socket from worker; performance will suffer\n", port);
+    //Setup the io_uring engine
+    memset(&uw, 0, sizeof(uw));
+    if (io_engine == IO_ENGINE_URING) {
+        if (uring_writer_init(&uw, config->io_depth, config->buffers, config->nb_buffers) < 0) {
+            LOG_WARN("Core %d falling back to synchronous writes\n", rte_lcore_id());
+            io_engine = IO_ENGINE_SYNC;
+        } else {
+            LOG_INFO("Core %d using io_uring with %u writes in flight\n", rte_lcore_id(), config->io_depth);
+        }
     }
 
-    //Init the common pcap header
-    pcap_header_init(file_header, config->snaplen, disk_blk_size);
-
-    //Open new file
-    pcap_file = open_pcap(file_name, file_header, disk_blk_size);
-    if (!pcap_file) {
-        retval = -1;
-        goto cleanup;
+    if (config->zero_copy) {
+        zc_iov = rte_malloc(NULL, IOV_MAX * sizeof(struct iovec), 0);
+        if (!zc_iov) {
+            LOG_ERR("Core %d could not allocate zero-copy iovecs\n", rte_lcore_id());
+            retval = -1;
+            goto cleanup;
+        }
     }
 
-    while (1) {
-        /* Stop condition */
-        if (unlikely(stop > 9999999)) {
-            break;
+    /* Every buffer precedes the end of stream of its queue in the ring */
+    while (__atomic_load_n(config->eos_seen, __ATOMIC_ACQUIRE) < config->nb_producers) {
+        now = rte_get_tsc_cycles();
+        for (a = 0; a < nb_active; a++) {
+            output = active[a];
+
+            /* Rotation on a buffer (thus disk block) boundary, postponed if the successor is not ready yet */
+            if (unlikely(output->retiring_fd < 0
+                         && ((rotate_bytes && output->size >= rotate_bytes) || now >= output->rotate_deadline))) {
+                output->retiring_fd = rotate_file(output, config->stats);
+                if (output->retiring_fd >= 0 && rotate_cycles) {
+                    output->rotate_deadline = now + rotate_cycles;
+                }
+            }
+
+            /* The rotated file can be closed once its writes are complete */
+            if (unlikely(output->retiring_fd >= 0) && !uring_writer_inflight_fd(&uw, output->retiring_fd)) {
+                retire_file(output, output->retiring_fd);
+                output->retiring_fd = -1;
+            }
+
+            /* Bound the delay until the written packets reach the disk */
+            if (unlikely(now >= output->sync_deadline)) {
+                if (output->size != output->synced_size) {
+                    start = rte_rdtsc();
+                    if (fdatasync(output->fd) < 0) {
+                        LOG_ERR("Could not sync file %s: %s\n", output->name, strerror(errno));
+                    }
+                    sync_sidecars(output);
+                    config->stats->syncs++;
+                    config->stats->sync_cycles += rte_rdtsc() - start;
+                    output->synced_size = output->size;
+                }
+                output->sync_deadline = now + flush_cycles;
+            }
         }
 
-        if (unlikely(*stop_condition)) {
-            stop++;
+        max_bufs = burst_size;
+        if (io_engine == IO_ENGINE_URING) {
+            nb_done = uring_writer_reap(&uw, done, results, burst_size, false);
+            if (nb_done) {
+                release_buffers(config, &stripe, done, results, nb_done);
+            }
+            max_bufs = RTE_MIN(burst_size, uring_writer_free_slots(&uw));
         }
 
-        nb_bufs = rte_ring_sc_dequeue_burst(pbuf_full_ring, (void**)buffers, burst_size, NULL);
+        nb_bufs = rte_ring_dequeue_burst(pbuf_full_ring, (void**)buffers, max_bufs, NULL);
+
+        /* Count the ends of stream apart */
+        for (i = n = 0; i < nb_bufs; i++) {
+            if (likely(buffers[i] != PCAP_BUFFER_EOS)) {
+                buffers[n++] = buffers[i];
+            }
+        }
+        nb_eos = nb_bufs - n;
+        nb_bufs = n;
+        if (unlikely(nb_eos)) {
+            __atomic_add_fetch(config->eos_seen, nb_eos, __ATOMIC_RELEASE);
+        }
 
         if (unlikely(nb_bufs < 1)) {
+            /* Back off once idle for a whole flush period */
+            if (!idle_since) {
+                idle_since = now;
+            } else if (now - idle_since > flush_cycles && !uw.inflight) {
+                rte_delay_us_sleep(WRITE_IDLE_SLEEP_US);
+            } else {
+                rte_pause();
+            }
             continue;
         }
+        idle_since = 0;
 
+        /* The TSC of the other cores may lag slightly behind */
+        start = rte_rdtsc();
         for (i = 0; i < nb_bufs; i++) {
-            iov[i].iov_base = buffers[i]->buffer;
-            iov[i].iov_len = buffers[i]->offset;
-            config->stats->packets += buffers[i]->packets;
-            buffers[i]->offset = 0;
+            histogram_record(&config->stats->ring_wait,
+                             RTE_MAX(start, buffers[i]->enqueued_at) - buffers[i]->enqueued_at);
+            devices[i] = stripe_next(&stripe, now);
         }
-        written = writev(pcap_file, iov, nb_bufs);
 
-        while (!(rte_ring_sp_enqueue_bulk(pbuf_free_ring, (void**)buffers, nb_bufs, NULL) || unlikely(*stop_condition)))
-            ;
+        /* Write each run of buffers coming from the same queue and striped to the same device into their file */
+        for (i = 0; i < nb_bufs; i += n) {
+            for (n = 1; i + n < nb_bufs && buffers[i + n]->origin == buffers[i]->origin && devices[i + n] == devices[i];
+                 n++)
+                ;
 
-        if (unlikely(written < 0)) {
-            LOG_ERR("Could not write into file: %d (%s)\n", errno, strerror(errno));
+            /* All the devices are full, the packets are lost */
+            if (unlikely(devices[i] < 0)) {
+                discard_buffers(config, &buffers[i], n);
+                continue;
+            }
+
+            output = &config->outputs[buffers[i]->origin * config->nb_devices + devices[i]];
+            if (unlikely(output->fd <= 0)) {
+                if (open_output(config, output) < 0) {
+                    discard_buffers(config, &buffers[i], nb_bufs - i);
+                    retval = -1;
+                    goto drain;
+                }
+                active[nb_active++] = output;
+            }
+
+            if (io_engine == IO_ENGINE_URING) {
+                /* Queue one write per buffer, recycled upon completion */
+                for (uint16_t j = i; j < i + n; j++) {
+                    buffers[j]->device = devices[i];
+                    buffers[j]->queued_at = now;
+                    buffers[j]->fd = output->fd;
+                    buffers[j]->flows_at = UINT64_MAX;
+                    buffers[j]->times_at = UINT64_MAX;
+                    if (unlikely(uring_writer_queue(&uw, output->fd, output->offset, buffers[j]) < 0)) {
+                        /* No submission entry left, write the buffer right away */
+                        result = pwrite(output->fd, buffers[j]->buffer, buffers[j]->offset, output->offset);
+                        if (unlikely(result != (int)buffers[j]->offset)) {
+                            result = result < 0 ? -errno : -EIO;
+                        } else {
+                            if (config->sidecars & (1 << SIDECAR_TIMES)) {
+                                write_time_index(output, &buffers[j], 1);
+                            }
+                            if (config->sidecars & (1 << SIDECAR_FLOWS)) {
+                                write_flow_index(config, output, &buffers[j], 1, iov);
+                            }
+                            output->offset += result;
+                            output->size += result;
+                        }
+                        release_buffers(config, &stripe, &buffers[j], &result, 1);
+                        continue;
+                    }
+                    /* Its records are emptied by drop_indexes() should the write fail */
+                    if (config->sidecars & (1 << SIDECAR_TIMES)) {
+                        write_time_index(output, &buffers[j], 1);
+                    }
+                    if (config->sidecars & (1 << SIDECAR_FLOWS)) {
+                        write_flow_index(config, output, &buffers[j], 1, iov);
+                    }
+                    output->offset += buffers[j]->offset;
+                    output->size += buffers[j]->offset;
+                }
+                config->stats->current_file_bytes = output->size;
+                continue;
+            }
+
+            start = rte_rdtsc();
+            length = 0;
+            if (config->zero_copy) {
+                written = write_zero_copy(output->fd, &buffers[i], n, zc_iov);
+                release_mbufs(&buffers[i], n);
+                for (uint16_t j = i; j < i + n; j++) {
+                    config->stats->packets += buffers[j]->packets;
+                }
+            } else {
+                for (uint16_t j = i; j < i + n; j++) {
+                    iov[j - i].iov_base = buffers[j]->buffer;
+                    iov[j - i].iov_len = buffers[j]->offset;
+                    length += buffers[j]->offset;
+                    config->stats->packets += buffers[j]->packets;
+                }
+                written = writev(output->fd, iov, n);
+            }
+            if (unlikely(written < 0)) {
+                written = -errno;
+            }
+            cycles = rte_rdtsc() - start;
+            histogram_record(&config->stats->write, cycles);
+            stripe_complete(&stripe, devices[i], cycles, written);
+
+            /* Only the buffers fully written are indexed */
+            if (written >= 0 && (uint64_t)written == length) {
+                if (config->sidecars & (1 << SIDECAR_TIMES)) {
+                    write_time_index(output, &buffers[i], n);
+                }
+                if (config->sidecars & (1 << SIDECAR_FLOWS)) {
+                    write_flow_index(config, output, &buffers[i], n, iov);
+                }
+            }
+            for (uint16_t j = i; j < i + n; j++) {
+                buffers[j]->offset = 0;
+                buffers[j]->nb_flows = 0;
+            }
+            return_buffers(config, &buffers[i], n);
+
+            if (unlikely(written < 0)) {
+                LOG_ERR("Could not write into file: %d (%s)\n", -written, strerror(-written));
+                continue;
+            }
+
+            output->offset += written;
+            output->size += written;
+            config->stats->current_file_bytes = output->size;
+            config->stats->bytes += written;
+        }
+
+        if (io_engine == IO_ENGINE_URING) {
+            uring_writer_submit(&uw);
         }
+    }
+
+drain:
+    //Wait for the writes in flight
+    if (io_engine == IO_ENGINE_URING) {
+        uring_writer_submit(&uw);
+    }
+    while (uw.inflight) {
+        nb_done = uring_writer_reap(&uw, done, results, burst_size, true);
+        release_buffers(config, &stripe, done, results, nb_done);
+    }
 
-        file_size += written;
-        config->stats->current_file_bytes = file_size;
-        config->stats->bytes += written;
+    //The main lcore closes the files, once synced
+    for (a = 0; a < nb_active; a++) {
+        start = rte_rdtsc();
+        if (fdatasync(active[a]->fd) < 0) {
+            LOG_ERR("Could not sync file %s: %s\n", active[a]->name, strerror(errno));
+        }
+        sync_sidecars(active[a]);
+        config->stats->syncs++;
+        config->stats->sync_cycles += rte_rdtsc() - start;
+        if (active[a]->retiring_fd >= 0) {
+            active[a]->retired_fd = active[a]->retiring_fd;
+        }
     }
 
 cleanup:
-    //Close pcap file
-    close_pcap(pcap_file);
-    rte_free(file_header);
+    if (io_engine == IO_ENGINE_URING) {
+        uring_writer_exit(&uw);
+    }
+    rte_free(zc_iov);
 
     LOG_INFO("Closed writing core %d\n", rte_lcore_id());
 
@@ -3,28 +3,117 @@
 #define DPDKCAP_CORE_WRITE_H
 
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/uio.h>
 
+#include <rte_cycles.h>
 #include <rte_ethdev.h>
 #include <rte_malloc.h>
 #include <rte_mbuf.h>
 
+#include "compress.h"
+#include "index_format.h"
+#include "histogram.h"
+#include "nic.h"
 #include "pcap.h"
+#include "stripe.h"
 #include "utils.h"
 
-#define OUTPUT_FILENAME_LENGTH 100
+#define OUTPUT_FILENAME_LENGTH         256
 
-/* Writing core configuration */
-struct write_core_config {
+#define OUTPUT_TEMPLATE_TOKEN_FILE_IDX "\%FILEIDX"
+#define OUTPUT_TEMPLATE_TOKEN_TS       "\%TS"
+#define OUTPUT_TEMPLATE_TOKEN_PORT     "\%PORT"
+#define OUTPUT_TEMPLATE_TOKEN_QUEUE    "\%QUEUE"
+
+/* States of the successor of an output file */
+#define NEXT_FILE_NONE                 0
+#define NEXT_FILE_REQUESTED            1
+#define NEXT_FILE_READY                2
+
+/* Index sidecars written next to the output files */
+#define SIDECAR_FLOWS                  0 /* flow index, FLOW_INDEX_SUFFIX */
+#define SIDECAR_TIMES                  1 /* time index, TIME_INDEX_SUFFIX */
+#define SIDECAR_MAX                    2
+#define SIDECAR_NAME_LENGTH            (OUTPUT_FILENAME_LENGTH + 8)
+
+/* Writing engines */
+#define IO_ENGINE_SYNC                 0
+#define IO_ENGINE_URING                1
+
+/* Sleep of a writing core once idle for flush_ms */
+#define WRITE_IDLE_SLEEP_US            100
+
+/*
+ * Output file of a writing core for the buffers of a queue on a device. When rotation is
+ * enabled, the writing core requests a successor file which is opened (and
+ * its header written) by the main lcore, so that rotating never stalls the
+ * writing core.
+ */
+struct output_file {
+    int fd; /* 0 until the first buffer of the queue on the device */
+    unsigned int core_id;
     uint16_t port;
-    struct rte_ring* pbuf_free_ring;
+    uint16_t queue;
+    uint32_t interface_id; /* pcapng interface of the queue */
+    const char* template;
+    unsigned int index;
+    uint64_t size;
+    uint64_t offset;
+    time_t opened_at;
+    uint64_t rotate_deadline;
+    uint64_t sync_deadline; /* next fdatasync(), with flush_sync */
+    uint64_t synced_size;
+    int retiring_fd; /* rotated, waiting for its writes to complete */
+    int sidecar_fds[SIDECAR_MAX]; /* -1 when not written */
+    char name[OUTPUT_FILENAME_LENGTH];
+    unsigned char* file_header;
+    unsigned int file_header_len;  /* padded to a disk block */
+    unsigned int file_header_size; /* without padding */
+    /* Owned by the main lcore while next_state is NEXT_FILE_REQUESTED */
+    int retired_fd;
+    int retired_sidecar_fds[SIDECAR_MAX];
+    uint64_t retired_offset;
+    int next_fd;
+    int next_sidecar_fds[SIDECAR_MAX];
+    uint64_t next_offset;
+    char next_name[OUTPUT_FILENAME_LENGTH];
+    uint32_t next_state;
+} __rte_cache_aligned;
+
+/*
+ * Writing core configuration. A writing core either serves a single queue,
+ * or shares the full ring of all the queues with the other writing cores.
+ * Buffers are striped over the output devices, written into a file per
+ * queue and device, and returned to their queue. Writing cores stop once
+ * the end of stream of each queue feeding the ring has been dequeued.
+ */
+struct write_core_config {
+    uint16_t format; /* PCAP_FORMAT_* */
     struct rte_ring* pbuf_full_ring;
+    struct rte_ring** pbuf_free_rings; /* indexed by buffer origin */
+    struct output_file* outputs;       /* indexed by buffer origin * nb_devices + device */
+    unsigned int nb_outputs;
+    struct output_device* devices;
+    unsigned int nb_devices;
     uint16_t burst_size;
     uint16_t snaplen;
     uint16_t disk_blk_size;
-    bool volatile* stop_condition;
+    uint64_t rotate_bytes;
+    uint32_t rotate_seconds;
+    uint32_t flush_ms;   /* idle time before backing off, and fdatasync() period */
+    uint16_t flush_sync; /* fdatasync() the files written every flush_ms */
+    uint16_t io_engine;
+    uint16_t io_depth;
+    uint16_t zero_copy;
+    uint16_t sidecars; /* 1 << SIDECAR_* of the indexes written next to each output file */
+    uint32_t sample_rate; /* of the capture, recorded in the sidecars */
+    const struct compress_config* compress; /* buffers compressed by a compression core, or NULL */
+    struct pcap_buffer** buffers;           /* registered with io_uring */
+    unsigned int nb_buffers;
+    unsigned int nb_producers; /* queues feeding the full ring */
+    unsigned int* eos_seen;    /* ends of stream dequeued, shared by the writing cores of the full ring */
     struct write_core_stats* stats;
-    char* output_file_template;
 } __rte_cache_aligned;
 
 /* Statistics structure */
@@ -32,12 +121,27 @@ struct write_core_stats {
     char output_file[OUTPUT_FILENAME_LENGTH];
     uint16_t core_id;
     uint64_t current_file_bytes;
+    uint64_t files;
     uint64_t packets;
     uint64_t bytes;
+    uint64_t syncs;       /* fdatasync() of the output files */
+    uint64_t sync_cycles; /* spent in fdatasync() */
+    uint64_t flow_records; /* flow index records written */
     struct rte_ring* pbuf_full_ring;
+    struct histogram ring_wait; /* from the enqueue of a buffer to its dequeue */
+    struct histogram write;     /* writev() of a batch, or io_uring write of a buffer */
 } __rte_cache_aligned;
 
 /* Launches a write task */
 int write_core(const struct write_core_config* config);
 
+/* Prepares the successor files of a writing core (main lcore) */
+void write_core_prepare_files(const struct write_core_config* config);
+
+/*
+ * Closes the files left by a writing core once it has exited, including its
+ * last file (main lcore)
+ */
+void write_core_close_files(const struct write_core_config* config);
+
 #endif
@@ -0,0 +1,60 @@
+#include "dedup.h"
+
+#include <errno.h>
+
+#include <rte_malloc.h>
+
+int
+dedup_parse_opt(const char* arg, struct dedup_config* config) {
+    unsigned long value;
+    char* end;
+
+    errno = 0;
+    value = strtoul(arg, &end, 10);
+    if (errno || end == arg || value == 0 || value > UINT32_MAX) {
+        return -EINVAL;
+    }
+    config->interval_us = value;
+    config->window = DEDUP_WINDOW_DEFAULT;
+
+    if (*end == ':') {
+        arg = end + 1;
+        value = strtoul(arg, &end, 10);
+        if (errno || end == arg || value > UINT16_MAX) {
+            return -EINVAL;
+        }
+        /* 0 hashes the whole first segment */
+        config->window = value ? value : UINT16_MAX;
+    }
+    return *end ? -EINVAL : 0;
+}
+
+int
+dedup_init(struct dedup* dedup, const struct dedup_config* config, int socket_id) {
+    uint64_t interval = (uint64_t)config->interval_us * rte_get_tsc_hz() / 1000000;
+    const uint32_t now = rte_rdtsc() >> DEDUP_TSC_SHIFT;
+    unsigned int b, e;
+
+    dedup->interval = RTE_MIN(interval >> DEDUP_TSC_SHIFT, (uint64_t)UINT32_MAX / 2);
+    dedup->window = config->window;
+    dedup->buckets = rte_malloc_socket(NULL, DEDUP_BUCKETS * sizeof(struct dedup_bucket), RTE_CACHE_LINE_SIZE,
+                                       socket_id);
+    if (!dedup->buckets) {
+        return -ENOMEM;
+    }
+
+    /* Start with expired entries */
+    for (b = 0; b < DEDUP_BUCKETS; b++) {
+        for (e = 0; e < DEDUP_BUCKET_ENTRIES; e++) {
+            dedup->buckets[b].sigs[e] = 0;
+            dedup->buckets[b].times[e] = now - dedup->interval - 1;
+        }
+    }
+    return 0;
+}
+
+void
+dedup_exit(struct dedup* dedup) {
+    rte_free(dedup->buckets);
+    dedup->buckets = NULL;
+}
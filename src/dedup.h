@@ -0,0 +1,140 @@
+#ifndef DPDKCAP_DEDUP_H
+#define DPDKCAP_DEDUP_H
+
+#include <rte_cycles.h>
+#include <rte_hash_crc.h>
+#include <rte_mbuf.h>
+#include <rte_prefetch.h>
+
+#include "packet.h"
+#include "utils.h"
+
+#define DEDUP_WINDOW_DEFAULT 128
+
+/*
+ * Table of the recent packets of a capture core: buckets of one cache line,
+ * 4096 of them (256KB) to stay in L2. Times are TSC >> DEDUP_TSC_SHIFT, so
+ * they wrap after about half an hour at 2.5GHz.
+ */
+#define DEDUP_BUCKET_ENTRIES 8
+#define DEDUP_BUCKETS        4096
+#define DEDUP_TSC_SHIFT      10
+
+#define DEDUP_SEED_BUCKET    0x9e3779b9
+#define DEDUP_SEED_SIG       0x85ebca6b
+
+/* Duplicate suppression, enabled when interval_us is not 0 */
+struct dedup_config {
+    uint32_t interval_us; /* copies seen within are dropped */
+    uint16_t window;      /* bytes hashed from the start of the frame */
+};
+
+struct dedup_bucket {
+    uint32_t sigs[DEDUP_BUCKET_ENTRIES];
+    uint32_t times[DEDUP_BUCKET_ENTRIES];
+} __rte_cache_aligned;
+
+struct dedup {
+    struct dedup_bucket* buckets;
+    uint32_t interval; /* in TSC >> DEDUP_TSC_SHIFT */
+    uint16_t window;
+};
+
+/* Parses "INTERVAL_US[:BYTES]" */
+int dedup_parse_opt(const char* arg, struct dedup_config* config);
+
+/* Allocates the table of a capture core on its socket */
+int dedup_init(struct dedup* dedup, const struct dedup_config* config, int socket_id);
+
+void dedup_exit(struct dedup* dedup);
+
+static inline void
+dedup_crc(const uint8_t* data, uint32_t len, uint32_t* bucket, uint32_t* sig) {
+    *bucket = rte_hash_crc(data, len, *bucket);
+    *sig = rte_hash_crc(data, len, *sig);
+}
+
+/*
+ * Hashes the first window bytes of a packet (of its first segment), along
+ * with its length. For IP packets, the L2 header, TTL (or hop limit) and
+ * IPv4 checksum are left out, so that copies taken on both sides of a
+ * router match.
+ */
+static inline void
+dedup_hash(const struct dedup* dedup, const struct rte_mbuf* mbuf, uint32_t* bucket, uint32_t* sig) {
+    const uint8_t* data = rte_pktmbuf_mtod(mbuf, const uint8_t*);
+    uint32_t len = RTE_MIN(mbuf->data_len, dedup->window);
+    struct packet_info info;
+    uint32_t l3;
+
+    *bucket = rte_hash_crc_4byte(mbuf->pkt_len, DEDUP_SEED_BUCKET);
+    *sig = rte_hash_crc_4byte(mbuf->pkt_len, DEDUP_SEED_SIG);
+
+    packet_parse(mbuf, &info);
+    l3 = info.l3_offset;
+    if (info.ip_version == 4 && l3 + sizeof(struct rte_ipv4_hdr) <= len) {
+        dedup_crc(data + l3, 8, bucket, sig);      /* up to the fragment offset */
+        dedup_crc(data + l3 + 9, 1, bucket, sig);  /* protocol */
+        dedup_crc(data + l3 + 12, len - l3 - 12, bucket, sig);
+    } else if (info.ip_version == 6 && l3 + sizeof(struct rte_ipv6_hdr) <= len) {
+        dedup_crc(data + l3, 7, bucket, sig);      /* up to the next header */
+        dedup_crc(data + l3 + 8, len - l3 - 8, bucket, sig);
+    } else {
+        dedup_crc(data, len, bucket, sig);
+    }
+}
+
+/*
+ * Drops the packets of a burst already seen within the interval. The kept
+ * mbufs are moved to the front of bufs, the duplicates are freed. Returns
+ * the number of kept mbufs.
+ */
+static inline uint16_t
+dedup_burst(struct dedup* dedup, struct rte_mbuf** bufs, uint16_t nb_rx) {
+    uint32_t buckets[nb_rx], sigs[nb_rx];
+    struct rte_mbuf* duplicates[nb_rx];
+    const uint32_t now = rte_rdtsc() >> DEDUP_TSC_SHIFT;
+    struct dedup_bucket* bucket;
+    uint32_t age, oldest;
+    uint16_t i, nb_kept = 0, nb_duplicates = 0;
+    unsigned int e, victim;
+
+    /* Hash the whole burst first, so that the buckets are fetched meanwhile */
+    for (i = 0; i < nb_rx; i++) {
+        dedup_hash(dedup, bufs[i], &buckets[i], &sigs[i]);
+        buckets[i] &= DEDUP_BUCKETS - 1;
+        rte_prefetch0(&dedup->buckets[buckets[i]]);
+    }
+
+    for (i = 0; i < nb_rx; i++) {
+        bucket = &dedup->buckets[buckets[i]];
+        victim = 0;
+        oldest = 0;
+        for (e = 0; e < DEDUP_BUCKET_ENTRIES; e++) {
+            age = now - bucket->times[e];
+            if (bucket->sigs[e] == sigs[i] && age <= dedup->interval) {
+                break;
+            }
+            if (age >= oldest) {
+                oldest = age;
+                victim = e;
+            }
+        }
+
+        if (e < DEDUP_BUCKET_ENTRIES) {
+            duplicates[nb_duplicates++] = bufs[i];
+            continue;
+        }
+        bucket->sigs[victim] = sigs[i];
+        bucket->times[victim] = now;
+        bufs[nb_kept++] = bufs[i];
+    }
+
+    if (nb_duplicates) {
+        rte_pktmbuf_free_bulk(duplicates, nb_duplicates);
+    }
+
+    return nb_kept;
+}
+
+#endif
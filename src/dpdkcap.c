@@ -8,13 +8,26 @@
 #include <rte_ethdev.h>
 #include <rte_malloc.h>
 #include <rte_string_fns.h>
+#include <rte_timer.h>
 #include <rte_version.h>
 
+#include "compress.h"
 #include "core_capture.h"
+#include "core_compress.h"
 #include "core_write.h"
+#include "dedup.h"
+#include "filter.h"
+#include "flow_index.h"
 #include "nic.h"
 #include "pcap.h"
+#include "sample.h"
+#include "slice.h"
 #include "stats.h"
+#include "stripe.h"
+#include "telemetry.h"
+#include "timestamp.h"
+#include "trigger.h"
+#include "uring_writer.h"
 #include "utils.h"
 
 #define RX_DESC_DEFAULT               1024
@@ -40,6 +53,8 @@
 
 #define OUTPUT_TEMPLATE_LENGTH        2 * OUTPUT_FILENAME_LENGTH
 
+#define HOUSEKEEPING_PERIOD_MS        100
+
 /* ARGP */
 const char* argp_program_version = "dpdkcap 1.1";
 static char doc[] = "A DPDK-based packet capture tool";
@@ -50,9 +65,93 @@ static struct argp_option options[] = {
      "Output FILE template (don't add the "
      "extension). Use \"" OUTPUT_TEMPLATE_TOKEN_CORE_ID "\" for "
      "inserting the lcore id into the file name (automatically added if not "
-     "used). (default: " OUTPUT_TEMPLATE_DEFAULT ")",
+     "used). When rotating files, use \"" OUTPUT_TEMPLATE_TOKEN_FILE_IDX "\" for the "
+     "index of the file (automatically added if not used) and \"" OUTPUT_TEMPLATE_TOKEN_TS "\" "
+     "for its opening time (UTC). \"" OUTPUT_TEMPLATE_TOKEN_PORT "\" and \"" OUTPUT_TEMPLATE_TOKEN_QUEUE "\" are "
+     "replaced by the port and queue of the packets (automatically added "
+     "with --writer-cores). (default: " OUTPUT_TEMPLATE_DEFAULT ")",
+     0},
+    {"rotate-size", 702, "SIZE", 0,
+     "Rotate output files once they reach SIZE bytes (K, M, G and T suffixes "
+     "allowed). Files are rotated on packet buffer boundaries, so they may "
+     "slightly exceed SIZE.",
+     0},
+    {"rotate-seconds", 703, "SECONDS", 0, "Rotate output files every SECONDS seconds.", 0},
+    {"flush-ms", 718, "MS", 0,
+     "Hand a partially filled packet buffer to the writing cores once its "
+     "first packets are MS milliseconds old. Writing cores idle for MS "
+     "milliseconds back off to short sleeps. (default: " STR(FLUSH_MS_DEFAULT) ")",
+     0},
+    {"fdatasync", 719, 0, 0, "fdatasync() the output files every --flush-ms milliseconds while they are written.", 0},
+    {"flow-index", 724, 0, 0,
+     "Write a flow index next to each output file (" FLOW_INDEX_SUFFIX " suffix): one record per flow and "
+     "packet buffer, with the range of the file holding its packets and their first and last timestamps. "
+     "dpdkcap-flow extracts a connection by reading only these ranges. Cannot be combined with "
+     "--zero-copy, --compress or --overload headers.",
+     0},
+    {"time-index", 725, 0, 0,
+     "Write a time index next to each output file (" TIME_INDEX_SUFFIX " suffix): one record per packet "
+     "buffer, with its offset in the file, packet count and first and last timestamps. dpdkcap-extract "
+     "copies a time range by reading only the buffers overlapping it. Cannot be combined with "
+     "--zero-copy or --compress.",
+     0},
+    {"io-engine", 704, "ENGINE", 0,
+     "Engine used by the writing cores: \"sync\" (one blocking writev() per "
+     "batch of buffers) or \"uring\" (several asynchronous io_uring writes in "
+     "flight per core). (default: sync)",
+     0},
+    {"zero-copy", 706, 0, 0,
+     "Do not copy packets into packet buffers: the writing cores write the "
+     "packet data straight from the mbufs. Packets are copied again while "
+     "half of the mbufs of a queue are held by the writing cores. Output "
+     "files are not opened in direct mode. Requires the sync writing engine.",
+     0},
+    {"writer-cores", 714, "NUM", 0,
+     "Number of writing cores, sharing the packet buffers of all the queues "
+     "instead of one writing core per queue. Each writing core keeps a file "
+     "per queue. (default: one per queue)",
+     0},
+    {"socket-dir", 707, "SOCKET:DIR", 0,
+     "Write the files of the queues whose port is attached to NUMA node "
+     "SOCKET into DIR instead of the directory of the output template, e.g. "
+     "to keep each writing core on the NVMe drives of its own node. Can be "
+     "given once per node.",
+     0},
+    {"output-dirs", 715, "DIR[:WEIGHT],...", 0,
+     "Stripe the packet buffers over the files of several directories, e.g. "
+     "one per NVMe drive, instead of the directory of the output template. "
+     "Each directory receives a share of the buffers proportional to its "
+     "WEIGHT (default: " STR(STRIPE_WEIGHT_DEFAULT) "). A full directory is no longer used, and a "
+     "directory much slower than the others is skipped for a while. Cannot "
+     "be combined with --socket-dir.",
+     0},
+    {"io-depth", 705, "NUM", 0,
+     "Number of io_uring writes in flight per writing core "
+     "(default: " STR(URING_DEPTH_DEFAULT) ")",
+     0},
+    {"format", 711, "FORMAT", 0,
+     "Output file format: \"pcap\" (nanosecond pcap) or \"pcapng\" (one "
+     "interface per captured queue, with interface statistics at the end of "
+     "each file). (default: pcap)",
+     0},
+    {"compress", 712, "ALGO[:LEVEL]", 0,
+     "Compress the packet buffers with \"zstd\" or \"lz4\" on dedicated "
+     "compression cores before writing them. Each buffer becomes a frame "
+     "padded to a disk block, so files stay written in direct mode and "
+     "decompress with the zstd or lz4 tools. (default level: zstd "
+     STR(COMPRESS_ZSTD_LEVEL_DEFAULT) ", lz4 " STR(COMPRESS_LZ4_LEVEL_DEFAULT) ")",
+     0},
+    {"compress-cores", 713, "NUM", 0,
+     "Number of compression cores per port, each compressing the buffers "
+     "of a share of the queues of the port (default: 1)",
      0},
     {"stats", 'S', 0, 0, "Print stats every few seconds.", 0},
+    {"metrics", 716, "ADDR", 0,
+     "Serve the statistics in the Prometheus text format over HTTP, on "
+     "ADDR being \"PORT\" (on 127.0.0.1), \"HOST:PORT\" or the path of a "
+     "Unix socket. The statistics are also available as /dpdkcap/* "
+     "telemetry commands.",
+     0},
     {"nb-mbuf", 'm', "NB_MBUF", 0,
      "Number of memory buffers per core per port "
      "used to store the DMA'd packets by the nic driver. Optimal values, "
@@ -94,9 +193,77 @@ static struct argp_option options[] = {
                                            "                      port 3 has 1024 RX desc per queue.",
      0},
     {"burst_size", 'b', "NUM", 0, "Size of receive burst (default: " STR(BURST_SIZE_DEFAULT) ")", 0},
+    {"snaplen", 's', "SNAPLEN", 0,
+     "Maximum number of bytes captured per packet "
+     "(default: " STR(PCAP_SNAPLEN_DEFAULT) ")",
+     0},
+    {"slice", 701, "POLICY", 0,
+     "Header-only slicing policy. Either \"" SLICE_POLICY_HEADERS "\" to keep "
+     "only the L2/L3/L4 headers, or a list of <class>=<bytes> giving the number "
+     "of payload bytes kept after the headers per protocol class (l2, ip, tcp, "
+     "udp), e.g. \"tcp=64,udp=32\". Classes not listed keep headers only. "
+     "Packets are still truncated to SNAPLEN.",
+     0},
+    {"filter", 709, "EXPRESSION", 0,
+     "Only capture the packets matching the tcpdump filter EXPRESSION, e.g. "
+     "\"tcp port 443 or udp\". Packets are filtered by the capture cores "
+     "before being copied. Requires DPDK built with libpcap.",
+     0},
+    {"flight-recorder", 720, "PRE[:POST]", 0,
+     "Keep the packet buffers of each queue in memory as a circular history "
+     "instead of writing them. When a trigger fires (SIGUSR2, the "
+     "/dpdkcap/trigger telemetry command, --trigger-filter or "
+     "--trigger-drops), the last PRE seconds of history are written, followed "
+     "by the next POST seconds of capture (default: " STR(TRIGGER_POST_S_DEFAULT) "). "
+     "The history is bounded by --nb_pbuf and --pbuf_len.",
+     0},
+    {"trigger-filter", 721, "EXPRESSION", 0,
+     "Fire the flight recorder on a captured packet matching the tcpdump "
+     "filter EXPRESSION. Requires DPDK built with libpcap.",
+     0},
+    {"trigger-drops", 722, "RATE", 0,
+     "Fire the flight recorder when the ports drop, or the capture cores "
+     "shed, more than RATE packets per second.",
+     0},
+    {"dedup", 723, "US[:BYTES]", 0,
+     "Drop the copies of a packet captured by a queue within US "
+     "microseconds, e.g. from SPAN sessions. Packets are compared on their "
+     "length and first BYTES bytes (default: " STR(DEDUP_WINDOW_DEFAULT) ", 0 for the whole first "
+     "segment), leaving out the L2 header, TTL and checksum of IP packets.",
+     0},
+    {"sample", 726, "MODE:RATE", 0,
+     "Keep 1 in RATE packets of each queue, leaving the others out before any copy. MODE is \"count\" "
+     "(every RATE-th packet), \"random\" (each packet with a probability of 1/RATE) or \"flow\" (all the "
+     "packets of 1 in RATE flows, on their RSS hash). With \"MODE:auto[:MAX]\", the rate follows the free "
+     "packet buffers of the queue, between 1 and MAX (default: " STR(SAMPLE_RATE_MAX_DEFAULT) "), and requires "
+     "--time-index.",
+     0},
+    {"flow-rules", 710, "RULES", 0,
+     "Drop or keep packets in the NIC with rte_flow rules. RULES is a list "
+     "of rules separated by ';', the first matching rule applies. Each rule "
+     "is \"keep\" or \"drop\" followed by fields among: ether TYPE, vlan ID, "
+     "tcp, udp, proto NUM, src ADDR[/LEN], dst ADDR[/LEN], sport PORT, dport "
+     "PORT. Packets matching no rule are dropped if there is a keep rule. "
+     "Rules the NIC cannot offload are applied by the capture cores.",
+     0},
     {"portmask", 'p', "PORTMASK", 0, "Ethernet ports mask (default: 0x1).", 0},
     {"flow-control", 'z', 0, 0, "Enable flow control.", 0},
+    {"overload", 717, "POLICY", 0,
+     "What capture cores do when no packet buffer is free: \"stall\" "
+     "(wait for one, the default), \"drop\" (keep polling the queues and "
+     "drop the packets) or \"headers[:LEN]\" (keep the first LEN bytes of "
+     "the packets, " STR(OVERLOAD_SNAPLEN_DEFAULT) " by default, while a small "
+     "reserve has room, then drop).",
+     0},
     {"mw-timestamp", 't', 0, 0, "Use MetaWatch trailer timestamps.", 0},
+    {"timestamp", 708, "MODE", 0,
+     "Packet timestamps: \"" TIMESTAMP_MODE_COARSE "\" (system clock, read once "
+     "per burst), \"" TIMESTAMP_MODE_TSC "\" (TSC read per packet) or "
+     "\"" TIMESTAMP_MODE_HW "\" (NIC RX timestamps). TSC and NIC clocks are "
+     "converted to UTC by following the system clock, which should be "
+     "PTP-disciplined. Ports without RX timestamps fall back to "
+     "\"" TIMESTAMP_MODE_TSC "\". (default: " TIMESTAMP_MODE_COARSE ")",
+     0},
     {"logs", 700, "FILE", 0,
      "Writes the logs into FILE instead of "
      "stderr.",
@@ -111,15 +278,44 @@ struct arguments {
     uint16_t disk_blk_size;
     uint16_t nb_queues_per_port;
     uint16_t flow_control;
+    uint16_t overload;
+    uint16_t overload_snaplen;
     uint16_t mw_timestamp;
+    uint16_t timestamp;
     uint16_t snaplen;
+    struct slice_config slice;
+    struct dedup_config dedup;
+    struct sample_config sample;
     uint32_t nb_mbufs;
     uint32_t mbuf_len;
     uint32_t nb_pbufs;
     uint32_t pbuf_len;
+    uint32_t rotate_seconds;
+    uint32_t flush_ms;
+    uint16_t flush_sync;
+    uint16_t flow_index;
+    uint16_t time_index;
+    uint64_t rotate_bytes;
+    uint16_t io_engine;
+    uint16_t io_depth;
+    uint16_t zero_copy;
+    uint16_t format;
+    struct compress_config compress;
+    uint16_t compress_cores;
+    uint16_t writer_cores;
     uint64_t portmask;
     char* output_file_template;
+    char* socket_dirs[RTE_MAX_NUMA_NODES];
+    struct output_device devices[STRIPE_MAX_DEVICES];
+    unsigned int nb_devices;
     char* log_file;
+    char* metrics_addr;
+    char* filter;
+    uint32_t recorder_pre;
+    uint32_t recorder_post;
+    char* trigger_filter;
+    uint64_t trigger_drops;
+    struct flow_rules* flow_rules;
     char* num_rx_desc_str_matrix;
 } __rte_cache_aligned;
 
@@ -206,10 +402,26 @@ parse_matrix_opt(char* arg, unsigned long* matrix, unsigned long max_len) {
     return 0;
 }
 
+static int
+parse_socket_dir_opt(char* arg, char** socket_dirs) {
+    unsigned long socket;
+    char* end;
+
+    errno = 0;
+    socket = strtoul(arg, &end, 10);
+    if (errno || end == arg || *end != ':' || end[1] == '\0' || socket >= RTE_MAX_NUMA_NODES) {
+        return -EINVAL;
+    }
+    socket_dirs[socket] = end + 1;
+    return 0;
+}
+
 static error_t
 parse_opt(int key, char* arg, struct argp_state* state) {
     struct arguments* args = state->input;
+    unsigned long snaplen;
     char* end;
+    int result;
 
     errno = 0;
     end = NULL;
@@ -222,18 +434,146 @@ parse_opt(int key, char* arg, struct argp_state* state) {
                 return -EINVAL;
             }
             break;
-        case 'w': strncpy(args->output_file_template, arg, OUTPUT_FILENAME_LENGTH); break;
+        case 'w': strncpy(args->output_file_template, arg, OUTPUT_FILENAME_LENGTH - 1); break;
         case 'S': args->stats = 1; break;
         case 'm': args->nb_mbufs = strtoul(arg, &end, 10); break;
         case 'i': args->mbuf_len = strtoul(arg, &end, 10); break;
         case 'n': args->nb_pbufs = strtoul(arg, &end, 10); break;
         case 'j': args->pbuf_len = strtoul(arg, &end, 10); break;
         case 'b': args->burst_size = strtoul(arg, &end, 10); break;
+        case 's':
+            snaplen = strtoul(arg, &end, 10);
+            if (snaplen == 0 || snaplen > PCAP_SNAPLEN_DEFAULT) {
+                LOG_ERR("Invalid snaplen '%s'\n", arg);
+                return -EINVAL;
+            }
+            args->snaplen = snaplen;
+            break;
+        case 701:
+            if (slice_parse_opt(arg, &args->slice) < 0) {
+                LOG_ERR("Invalid slicing policy '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
         case 'd': args->num_rx_desc_str_matrix = arg; break;
         case 'q': args->nb_queues_per_port = strtoul(arg, &end, 10); break;
         case 't': args->mw_timestamp = 1; break;
+        case 708:
+            if (timestamp_parse_opt(arg, &args->timestamp) < 0) {
+                LOG_ERR("Invalid timestamp mode '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
         case 'z': args->flow_control = 1; break;
+        case 717:
+            if (capture_overload_parse_opt(arg, &args->overload, &args->overload_snaplen) < 0) {
+                LOG_ERR("Invalid overload policy '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
         case 700: args->log_file = arg; break;
+        case 709: args->filter = arg; break;
+        case 720:
+            if (trigger_parse_opt(arg, &args->recorder_pre, &args->recorder_post) < 0) {
+                LOG_ERR("Invalid flight recorder windows '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 721: args->trigger_filter = arg; break;
+        case 723:
+            if (dedup_parse_opt(arg, &args->dedup) < 0) {
+                LOG_ERR("Invalid duplicate suppression '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 726:
+            if (sample_parse_opt(arg, &args->sample) < 0) {
+                LOG_ERR("Invalid sampling '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 722:
+            args->trigger_drops = strtoul(arg, &end, 10);
+            if (args->trigger_drops == 0) {
+                LOG_ERR("Invalid drop rate '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 711:
+            if (!strcmp(arg, "pcap")) {
+                args->format = PCAP_FORMAT_PCAP;
+            } else if (!strcmp(arg, "pcapng")) {
+                args->format = PCAP_FORMAT_PCAPNG;
+            } else {
+                LOG_ERR("Invalid output format '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 712:
+            if (compress_parse_opt(arg, &args->compress) < 0) {
+                LOG_ERR("Invalid or unsupported compression '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 713: args->compress_cores = strtoul(arg, &end, 10); break;
+        case 714:
+            args->writer_cores = strtoul(arg, &end, 10);
+            if (args->writer_cores == 0) {
+                LOG_ERR("Invalid number of writing cores '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 716: args->metrics_addr = arg; break;
+        case 715:
+            result = stripe_parse_opt(arg, args->devices);
+            if (result < 0) {
+                LOG_ERR("Invalid output directories '%s'\n", arg);
+                return -EINVAL;
+            }
+            args->nb_devices = result;
+            break;
+        case 710:
+            args->flow_rules = calloc(1, sizeof(struct flow_rules));
+            if (flow_parse_opt(arg, args->flow_rules) < 0) {
+                LOG_ERR("Invalid flow rules '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 702:
+            if (parse_size(arg, &args->rotate_bytes) < 0) {
+                LOG_ERR("Invalid rotation size '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 703: args->rotate_seconds = strtoul(arg, &end, 10); break;
+        case 718:
+            args->flush_ms = strtoul(arg, &end, 10);
+            if (args->flush_ms == 0) {
+                LOG_ERR("Invalid flush delay '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 719: args->flush_sync = 1; break;
+        case 724: args->flow_index = 1; break;
+        case 725: args->time_index = 1; break;
+        case 704:
+            if (!strcmp(arg, "sync")) {
+                args->io_engine = IO_ENGINE_SYNC;
+            } else if (!strcmp(arg, "uring")) {
+                args->io_engine = IO_ENGINE_URING;
+            } else {
+                LOG_ERR("Invalid writing engine '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
+        case 705: args->io_depth = strtoul(arg, &end, 10); break;
+        case 706: args->zero_copy = 1; break;
+        case 707:
+            if (parse_socket_dir_opt(arg, args->socket_dirs) < 0) {
+                LOG_ERR("Invalid socket directory '%s'\n", arg);
+                return -EINVAL;
+            }
+            break;
         default: return ARGP_ERR_UNKNOWN;
     }
     if (errno || (end != NULL && *end != '\0')) {
@@ -258,6 +598,150 @@ signal_handler(int sig) {
     stop_condition = true;
 }
 
+/* Set by SIGUSR1, the histograms are logged by the main lcore */
+static volatile bool dump_histograms = false;
+
+static void
+dump_signal_handler(__attribute__((unused)) int sig) {
+    dump_histograms = true;
+}
+
+/* Flight recorder, enabled when pre_cycles is not 0 */
+static struct trigger trigger;
+
+static void
+trigger_signal_handler(__attribute__((unused)) int sig) {
+    if (trigger.pre_cycles) {
+        trigger_fire(&trigger, TRIGGER_SIGNAL);
+    }
+}
+
+/*
+ * Periodic tasks run on the main lcore, off the capture and write paths
+ */
+struct housekeeping_data {
+    struct write_core_config* write_core_configs;
+    unsigned int nb_write_cores;
+    struct timestamp_clock** clocks;
+    unsigned int nb_clocks;
+    struct trigger* trigger; /* NULL without flight recorder */
+};
+
+static struct rte_timer housekeeping_timer;
+static struct rte_timer calibration_timer;
+
+static void
+housekeeping(__attribute__((unused)) struct rte_timer* timer, void* arg) {
+    struct housekeeping_data* data = arg;
+    unsigned int i;
+
+    for (i = 0; i < data->nb_write_cores; i++) {
+        write_core_prepare_files(&data->write_core_configs[i]);
+    }
+
+    if (dump_histograms) {
+        dump_histograms = false;
+        telemetry_log_histograms(false);
+    }
+
+    if (data->trigger) {
+        trigger_poll(data->trigger);
+    }
+}
+
+static void
+calibrate_clocks(__attribute__((unused)) struct rte_timer* timer, void* arg) {
+    struct housekeeping_data* data = arg;
+    unsigned int i;
+
+    for (i = 0; i < data->nb_clocks; i++) {
+        if (data->clocks[i]) {
+            timestamp_clock_calibrate(data->clocks[i]);
+        }
+    }
+}
+
+/*
+ * Reads the logical block size of the disk holding the files of a template.
+ * Returns 0 when it cannot be found.
+ */
+static uint16_t
+probe_disk_blk_size(const char* template, unsigned int* maj_dev) {
+    char tmp_path[OUTPUT_TEMPLATE_LENGTH + 16];
+    char sysfs_path[100];
+    char tmp_buf[10];
+    struct stat stat_buf;
+    uint16_t blk_size = 0;
+    int fd;
+
+    *maj_dev = 0;
+    snprintf(tmp_path, sizeof(tmp_path), "%s_tmp_file", template);
+
+    fd = open(tmp_path, O_CREAT | O_RDONLY, 0644);
+    if (fd < 0) {
+        LOG_WARN("Warning: Could not open temporary file to read disk block size: %d (%s)\n", errno, strerror(errno));
+        return 0;
+    }
+
+    if (fstat(fd, &stat_buf) < 0) {
+        LOG_WARN("Warning: Could not stat temporary file to read disk block size: %d (%s)\n", errno, strerror(errno));
+    } else {
+        *maj_dev = major(stat_buf.st_dev);
+    }
+
+    close(fd);
+    remove(tmp_path);
+
+    if (*maj_dev == 0) {
+        return 0;
+    }
+
+    sprintf(sysfs_path, "/sys/dev/block/%u:0/queue/logical_block_size", *maj_dev);
+    fd = open(sysfs_path, O_RDONLY);
+    if (fd < 0) {
+        LOG_WARN("Warning: Could not read disk block size: %d (%s)\n", errno, strerror(errno));
+        return 0;
+    }
+
+    memset(tmp_buf, 0, sizeof(tmp_buf));
+    if (read(fd, tmp_buf, 9) < 1) {
+        LOG_WARN("Warning: Could not read disk block size: %d (%s)\n", errno, strerror(errno));
+    } else {
+        blk_size = strtoul(tmp_buf, NULL, 10);
+    }
+
+    close(fd);
+    return blk_size;
+}
+
+/*
+ * Picks an unused worker lcore, preferably on the given NUMA socket
+ */
+static unsigned int
+pick_lcore(bool* used, int socket) {
+    unsigned int lcore_id;
+
+    for (lcore_id = rte_get_next_lcore(-1, 1, 0); lcore_id < RTE_MAX_LCORE;
+         lcore_id = rte_get_next_lcore(lcore_id, 1, 0)) {
+        if (!used[lcore_id] && (int)rte_lcore_to_socket_id(lcore_id) == socket) {
+            used[lcore_id] = true;
+            return lcore_id;
+        }
+    }
+
+    for (lcore_id = rte_get_next_lcore(-1, 1, 0); lcore_id < RTE_MAX_LCORE;
+         lcore_id = rte_get_next_lcore(lcore_id, 1, 0)) {
+        if (!used[lcore_id]) {
+            LOG_WARN("No free lcore left on socket %d, using lcore %u on socket %u\n", socket, lcore_id,
+                     rte_lcore_to_socket_id(lcore_id));
+            used[lcore_id] = true;
+            return lcore_id;
+        }
+    }
+
+    rte_exit(EXIT_FAILURE, "Error: No free lcore left\n");
+}
+
 /*
  * The main function, which does initialization and calls the per-lcore
  * functions.
@@ -269,25 +753,54 @@ main(int argc, char* argv[]) {
     struct capture_core_config* capture_core_configs;
     struct write_core_config* write_core_configs;
     struct write_core_stats* write_core_stats;
+    struct output_file* output_files;
+    unsigned int* eos_counts;
     struct capture_core_stats* capture_core_stats;
     struct rte_ring** pbuf_full_rings;
     struct rte_ring** pbuf_free_rings;
+    struct rte_ring* shared_full_ring = NULL;
     struct pcap_buffer** buffers;
+    struct compress_core_config* compress_core_configs = NULL;
+    struct compress_core_stats* compress_core_stats = NULL;
+    struct rte_ring** zbuf_full_rings = NULL;
+    struct rte_ring** zbuf_free_rings = NULL;
+    struct pcap_buffer** zbuffers = NULL;
+    uint16_t nb_compress_cores = 0;
+    uint16_t nb_write_cores;
+    unsigned int free_ring_flags;
+    uint32_t zbuf_len = 0;
+    unsigned char* file_header;
+    unsigned int file_header_len, file_header_size;
+    struct pcapng_interface* interfaces = NULL;
+    char sample_description[PCAPNG_COMMENT_LENGTH];
+    char* socket_templates[RTE_MAX_NUMA_NODES] = {NULL};
     struct rte_mempool** rx_pools;
     struct rte_mempool** tx_pools;
+    struct timestamp_clock** clocks;
+    struct filter filter = {0};
+    struct filter trigger_filter = {0};
+    struct timestamp_dynfield ts_dynfield = {0};
+    uint16_t port_timestamp;
+    uint16_t flow_software;
 
     uint16_t port;
     unsigned int lcoreid_list[MAX_LCORES];
     unsigned int nb_lcores;
-    unsigned int i, j, k, l, m;
+    unsigned int i, j, k, l, m, w, d;
+    unsigned int nb_devices;
     unsigned int required_cores;
     unsigned int lcore_id;
+    bool lcore_used[RTE_MAX_LCORE] = {false};
+    int socket;
+    uint16_t blk_size;
     int result;
 
     FILE* log_file;
 
     /* Setup the signal handler */
     signal(SIGINT, signal_handler);
+    signal(SIGUSR1, dump_signal_handler);
+    signal(SIGUSR2, trigger_signal_handler);
 
     /* Initialize the Environment Abstraction Layer (EAL). */
     int ret = rte_eal_init(argc, argv);
@@ -306,20 +819,49 @@ main(int argc, char* argv[]) {
         .disk_blk_size = DISK_BLK_SIZE,
         .nb_queues_per_port = 1,
         .flow_control = 0,
+        .overload = OVERLOAD_STALL,
+        .overload_snaplen = OVERLOAD_SNAPLEN_DEFAULT,
         .mw_timestamp = 0,
+        .timestamp = TIMESTAMP_COARSE,
         .snaplen = PCAP_SNAPLEN_DEFAULT,
+        .slice = {0},
+        .dedup = {0},
+        .sample = {0},
         .nb_mbufs = NUM_MBUFS_DEFAULT,
         .mbuf_len = RTE_MBUF_DEFAULT_BUF_SIZE,
         .pbuf_len = PCAP_BUF_LEN_DEFAULT,
         .nb_pbufs = NUM_PBUFS_DEFAULT,
+        .rotate_seconds = 0,
+        .flush_ms = FLUSH_MS_DEFAULT,
+        .flush_sync = 0,
+        .flow_index = 0,
+        .time_index = 0,
+        .rotate_bytes = 0,
+        .io_engine = IO_ENGINE_SYNC,
+        .io_depth = URING_DEPTH_DEFAULT,
+        .zero_copy = 0,
+        .format = PCAP_FORMAT_PCAP,
+        .compress = {0},
+        .compress_cores = 1,
+        .writer_cores = 0,
         .portmask = 0x1,
         .output_file_template = NULL,
+        .socket_dirs = {NULL},
+        .devices = {{0}},
+        .nb_devices = 0,
         .log_file = NULL,
+        .metrics_addr = NULL,
+        .filter = NULL,
+        .recorder_pre = 0,
+        .recorder_post = 0,
+        .trigger_filter = NULL,
+        .trigger_drops = 0,
+        .flow_rules = NULL,
         .num_rx_desc_str_matrix = NULL,
     };
 
-    args.output_file_template = calloc(OUTPUT_FILENAME_LENGTH, 1);
-    strncpy(args.output_file_template, OUTPUT_TEMPLATE_DEFAULT, OUTPUT_FILENAME_LENGTH);
+    args.output_file_template = calloc(OUTPUT_TEMPLATE_LENGTH, 1);
+    strncpy(args.output_file_template, OUTPUT_TEMPLATE_DEFAULT, OUTPUT_FILENAME_LENGTH - 1);
 
     /* Parse arguments */
     argp_parse(&argp, argc, argv, 0, 0, &args);
@@ -337,54 +879,83 @@ main(int argc, char* argv[]) {
         }
     }
 
-    char* tmp_path = strdup(args.output_file_template);
-    strcat(tmp_path, "_tmp_file");
-    unsigned int maj_dev = 0;
+    /* Add suffixes to output if needed */
+    if (!strstr(args.output_file_template, OUTPUT_TEMPLATE_TOKEN_CORE_ID)) {
+        strcat(args.output_file_template, "_" OUTPUT_TEMPLATE_TOKEN_CORE_ID);
+    }
 
-    int fd = open(tmp_path, O_CREAT | O_RDONLY, 0644);
-    if (fd < 0) {
-        LOG_WARN("Warning: Could not open temporary file to read disk block size: %d (%s)\n", errno, strerror(errno));
-        goto next;
+    /* Shared writing cores keep a file per queue */
+    if (args.writer_cores && !strstr(args.output_file_template, OUTPUT_TEMPLATE_TOKEN_PORT)) {
+        strcat(args.output_file_template, "_" OUTPUT_TEMPLATE_TOKEN_PORT);
     }
 
-    struct stat stat_buf;
-    if (fstat(fd, &stat_buf) < 0) {
-        LOG_WARN("Warning: Could not stat temporary file to read disk block size: %d (%s)\n", errno, strerror(errno));
-    } else {
-        maj_dev = major(stat_buf.st_dev);
+    if (args.writer_cores && !strstr(args.output_file_template, OUTPUT_TEMPLATE_TOKEN_QUEUE)) {
+        strcat(args.output_file_template, "_" OUTPUT_TEMPLATE_TOKEN_QUEUE);
     }
 
-    close(fd);
-    remove(tmp_path);
+    if ((args.rotate_bytes || args.rotate_seconds)
+        && !strstr(args.output_file_template, OUTPUT_TEMPLATE_TOKEN_FILE_IDX)) {
+        strcat(args.output_file_template, "_" OUTPUT_TEMPLATE_TOKEN_FILE_IDX);
+    }
 
-    if (maj_dev != 0) {
-        char sysfs_path[100];
-        sprintf(sysfs_path, "/sys/dev/block/%u:0/queue/logical_block_size", maj_dev);
-        fd = open(sysfs_path, O_RDONLY);
+    strcat(args.output_file_template, args.format == PCAP_FORMAT_PCAPNG ? ".pcapng" : ".pcap");
+    strcat(args.output_file_template, compress_extension(args.compress.algo));
 
-        if (fd < 0) {
-            LOG_WARN("Warning: Could not read disk block size: %d (%s)\n", errno, strerror(errno));
-            goto next;
+    /* Per-socket templates: the directory of the template is replaced */
+    const char* template_name = strrchr(args.output_file_template, '/');
+    template_name = template_name ? template_name + 1 : args.output_file_template;
+    for (i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+        if (args.socket_dirs[i]) {
+            socket_templates[i] = calloc(OUTPUT_TEMPLATE_LENGTH, 1);
+            snprintf(socket_templates[i], OUTPUT_TEMPLATE_LENGTH, "%s/%s", args.socket_dirs[i], template_name);
         }
+    }
 
-        char tmp_buf[10];
-        if (read(fd, tmp_buf, 9) < 1) {
-            LOG_WARN("Warning: Could not read disk block size: %d (%s)\n", errno, strerror(errno));
-        } else {
-            args.disk_blk_size = strtoul(tmp_buf, NULL, 10);
+    /* Striping templates: the directory of the template is replaced as well */
+    if (args.nb_devices) {
+        for (i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+            if (args.socket_dirs[i]) {
+                rte_exit(EXIT_FAILURE, "--output-dirs cannot be combined with --socket-dir.\n");
+            }
         }
-
-        close(fd);
+        for (d = 0; d < args.nb_devices; d++) {
+            args.devices[d].template = calloc(OUTPUT_TEMPLATE_LENGTH, 1);
+            snprintf(args.devices[d].template, OUTPUT_TEMPLATE_LENGTH, "%s/%s", args.devices[d].dir, template_name);
+        }
+    } else {
+        /* A single device, whose files follow the socket templates */
+        args.devices[0].weight = STRIPE_WEIGHT_DEFAULT;
+        args.devices[0].dir = ".";
     }
 
-next:
+    nb_devices = RTE_MAX(args.nb_devices, 1U);
 
-    /* Add suffixes to output if needed */
-    if (!strstr(args.output_file_template, OUTPUT_TEMPLATE_TOKEN_CORE_ID)) {
-        strcat(args.output_file_template, "_" OUTPUT_TEMPLATE_TOKEN_CORE_ID);
+    /* Read the disk block size, keeping the largest one if several disks are used */
+    unsigned int maj_dev = 0;
+    blk_size = probe_disk_blk_size(args.nb_devices ? args.devices[0].template : args.output_file_template, &maj_dev);
+    if (blk_size) {
+        args.disk_blk_size = blk_size;
+    }
+    for (d = 0; d < args.nb_devices; d++) {
+        unsigned int device_maj_dev;
+        blk_size = probe_disk_blk_size(args.devices[d].template, &device_maj_dev);
+        LOG_INFO("Output directory %s: weight %u (disk (%d:0) block size = %d)\n", args.devices[d].dir,
+                 args.devices[d].weight, device_maj_dev, blk_size);
+        if (blk_size > args.disk_blk_size) {
+            args.disk_blk_size = blk_size;
+        }
+    }
+    for (i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+        if (socket_templates[i]) {
+            unsigned int socket_maj_dev;
+            blk_size = probe_disk_blk_size(socket_templates[i], &socket_maj_dev);
+            LOG_INFO("Socket %u output directory: %s (disk (%d:0) block size = %d)\n", i, args.socket_dirs[i],
+                     socket_maj_dev, blk_size);
+            if (blk_size > args.disk_blk_size) {
+                args.disk_blk_size = blk_size;
+            }
+        }
     }
-
-    strcat(args.output_file_template, ".pcap");
 
     /* Check if at least one port is available */
     uint16_t avail_ports = rte_eth_dev_count_avail();
@@ -421,21 +992,132 @@ next:
     uint32_t nb_pbufs = rte_align32pow2(args.nb_pbufs);
     uint32_t pbuf_len = rte_align32pow2(args.pbuf_len);
     uint32_t rx_burst_len = mbuf_len * args.burst_size;
-    uint32_t watermark = pbuf_len - rx_burst_len;
+    /* Leave room for the padding added when flushing a buffer */
+    uint32_t watermark = pbuf_len - rx_burst_len - 2 * args.disk_blk_size;
 
     LOG_INFO("Cores/Queues Per Port: %d Burst Size: %d\n", nb_queues_per_port, args.burst_size);
     LOG_INFO("MBufs: Num: %d Len: %d B  PBufs: Num: %d Len: %d B\n", nb_mbufs, mbuf_len, nb_pbufs, pbuf_len);
     LOG_INFO("RX Burst Len: %d Watermark: %d\n", rx_burst_len, watermark);
     LOG_INFO("Flow control: %s Pause Burst Size: %d\n", args.flow_control ? "ON" : "OFF", args.pause_burst_size);
+    if (args.overload == OVERLOAD_HEADERS) {
+        LOG_INFO("Overload policy: headers (%u bytes)\n", args.overload_snaplen);
+    } else {
+        LOG_INFO("Overload policy: %s\n", args.overload == OVERLOAD_DROP ? "drop" : "stall");
+    }
     LOG_INFO("Use MetaWatch trailer timestamps: %s\n", args.mw_timestamp ? "ON" : "OFF");
+    if (!args.mw_timestamp) {
+        LOG_INFO("Timestamps: %s\n", timestamp_mode_name(args.timestamp));
+    }
+    LOG_INFO("Snaplen: %d B  Slicing: %s\n", args.snaplen, args.slice.enabled ? "ON" : "OFF");
+    if (args.dedup.interval_us) {
+        LOG_INFO("Duplicate suppression: within %u us, on %u bytes\n", args.dedup.interval_us, args.dedup.window);
+    }
+    if (args.sample.mode != SAMPLE_NONE) {
+        sample_describe(&args.sample, sample_description, sizeof(sample_description));
+        LOG_INFO("Sampling: %s\n", sample_description);
+    }
+    if (args.slice.enabled) {
+        LOG_INFO("Slicing payload bytes: l2=%d ip=%d tcp=%d udp=%d\n", args.slice.payload[PACKET_CLASS_L2],
+                 args.slice.payload[PACKET_CLASS_IP], args.slice.payload[PACKET_CLASS_TCP],
+                 args.slice.payload[PACKET_CLASS_UDP]);
+    }
     LOG_INFO("Disk (%d:0) block size = %d\n", maj_dev, args.disk_blk_size);
+    LOG_INFO("File rotation: size: %s, every %u s\n", args.rotate_bytes ? bytes_format(args.rotate_bytes) : "OFF",
+             args.rotate_seconds);
+    LOG_INFO("Flush: partial buffers after %u ms, fdatasync: %s\n", args.flush_ms, args.flush_sync ? "ON" : "OFF");
+    LOG_INFO("Writing engine: %s (depth: %d)\n", args.io_engine == IO_ENGINE_URING ? "io_uring" : "sync",
+             args.io_depth);
+
+    LOG_INFO("Zero-copy: %s\n", args.zero_copy ? "ON" : "OFF");
+    LOG_INFO("Flow index: %s Time index: %s\n", args.flow_index ? "ON" : "OFF", args.time_index ? "ON" : "OFF");
+
+    if (args.compress.algo != COMPRESS_NONE) {
+        if (args.compress_cores == 0) {
+            rte_exit(EXIT_FAILURE, "At least one compression core per port is needed.\n");
+        }
+        if (args.compress_cores > nb_queues_per_port) {
+            LOG_WARN("Only %u compression cores per port are used, one per queue\n", nb_queues_per_port);
+            args.compress_cores = nb_queues_per_port;
+        }
+        nb_compress_cores = args.compress_cores * nb_ports;
+        zbuf_len = compress_frame_bound(&args.compress, pbuf_len, args.disk_blk_size);
+        LOG_INFO("Compression: %s level %d, %u core(s) per port, compressed buffer len: %u B\n",
+                 compress_algo_name(args.compress.algo), args.compress.level, args.compress_cores, zbuf_len);
+    }
 
-    if (pbuf_len < 2 * rx_burst_len) {
-        rte_exit(EXIT_FAILURE, "Packet buffer length should be atleast %d B.\n", 2 * rx_burst_len);
+    nb_write_cores = args.writer_cores ? args.writer_cores : nb_queues;
+    LOG_INFO("Writing cores: %u (%s)\n", nb_write_cores, args.writer_cores ? "shared by all queues" : "one per queue");
+
+    if (args.filter) {
+        LOG_INFO("Filter: %s\n", args.filter);
+        if (filter_init(&filter, args.filter, args.snaplen)) {
+            rte_exit(EXIT_FAILURE, "Cannot compile the packet filter.\n");
+        }
+    }
+
+    if ((args.trigger_filter || args.trigger_drops) && !args.recorder_pre) {
+        rte_exit(EXIT_FAILURE, "Triggers require --flight-recorder.\n");
+    }
+    if (args.recorder_pre) {
+        LOG_INFO("Flight recorder: %u s before and %u s after triggers\n", args.recorder_pre, args.recorder_post);
+        trigger.pre_cycles = args.recorder_pre * rte_get_tsc_hz();
+        trigger.post_cycles = args.recorder_post * rte_get_tsc_hz();
+        trigger.drop_rate = args.trigger_drops;
+        if (args.trigger_filter) {
+            LOG_INFO("Trigger filter: %s\n", args.trigger_filter);
+            if (filter_init(&trigger_filter, args.trigger_filter, args.snaplen)) {
+                rte_exit(EXIT_FAILURE, "Cannot compile the trigger filter.\n");
+            }
+            trigger.filter = &trigger_filter;
+        }
+    }
+
+    if (args.mw_timestamp && args.timestamp != TIMESTAMP_COARSE) {
+        rte_exit(EXIT_FAILURE, "MetaWatch timestamps cannot be combined with --timestamp.\n");
+    }
+
+    if (args.io_depth == 0) {
+        rte_exit(EXIT_FAILURE, "The io_uring depth should be at least 1.\n");
+    }
+
+    if (args.zero_copy && args.format != PCAP_FORMAT_PCAP) {
+        rte_exit(EXIT_FAILURE, "Zero-copy requires the pcap format.\n");
+    }
+
+    if (args.zero_copy && args.compress.algo != COMPRESS_NONE) {
+        rte_exit(EXIT_FAILURE, "Zero-copy cannot be combined with compression.\n");
+    }
+
+    if (args.zero_copy && args.io_engine != IO_ENGINE_SYNC) {
+        rte_exit(EXIT_FAILURE, "Zero-copy requires the sync writing engine.\n");
+    }
+
+    /* Index records locate the packets copied into the buffers, as written */
+    if ((args.flow_index || args.time_index) && (args.zero_copy || args.compress.algo != COMPRESS_NONE)) {
+        rte_exit(EXIT_FAILURE, "Flow and time indexes cannot be combined with zero-copy or compression.\n");
+    }
+
+    /* The history keeps the buffers of the queue busy */
+    if (args.sample.adaptive && args.recorder_pre) {
+        rte_exit(EXIT_FAILURE, "Adaptive sampling cannot be combined with the flight recorder.\n");
+    }
+
+    /* The time index records the rate of each buffer */
+    if (args.sample.adaptive && !args.time_index) {
+        rte_exit(EXIT_FAILURE, "Adaptive sampling requires the time index.\n");
+    }
+
+    if (args.flow_index && args.overload == OVERLOAD_HEADERS) {
+        rte_exit(EXIT_FAILURE, "The flow index cannot be combined with the headers overload policy.\n");
+    }
+
+    if (pbuf_len < 2 * (rx_burst_len + args.disk_blk_size)) {
+        rte_exit(EXIT_FAILURE, "Packet buffer length should be atleast %d B.\n",
+                 2 * (rx_burst_len + args.disk_blk_size));
     }
 
     /* Checks core number */
-    required_cores = 2 * nb_queues + 1;
+    required_cores = nb_queues + nb_compress_cores + nb_write_cores + 1;
     if (rte_lcore_count() < required_cores) {
         rte_exit(EXIT_FAILURE, "Assign at least %d cores to dpdkcap. %d found.\n", required_cores, rte_lcore_count());
     }
@@ -444,10 +1126,13 @@ next:
 
     /* Init config stats and buffer lists */
     capture_core_configs = calloc(nb_queues, sizeof(struct capture_core_config));
-    write_core_configs = calloc(nb_queues, sizeof(struct write_core_config));
+    write_core_configs = calloc(nb_write_cores, sizeof(struct write_core_config));
 
     capture_core_stats = calloc(nb_queues, sizeof(struct capture_core_stats));
-    write_core_stats = calloc(nb_queues, sizeof(struct write_core_stats));
+    write_core_stats = calloc(nb_write_cores, sizeof(struct write_core_stats));
+    /* Each writing core has a file per queue and device, only opened when it writes buffers of the queue there */
+    output_files = calloc(nb_write_cores * nb_queues * nb_devices, sizeof(struct output_file));
+    eos_counts = calloc(nb_write_cores, sizeof(unsigned int));
 
     rx_pools = calloc(nb_queues, sizeof(struct mempool*));
     tx_pools = calloc(nb_queues, sizeof(struct mempool*));
@@ -457,13 +1142,115 @@ next:
 
     buffers = calloc(nb_queues * nb_pbufs, sizeof(struct pcap_buffer*));
 
-    lcore_id = rte_get_next_lcore(-1, 1, 0);
+    if (nb_compress_cores) {
+        compress_core_configs = calloc(nb_compress_cores, sizeof(struct compress_core_config));
+        compress_core_stats = calloc(nb_compress_cores, sizeof(struct compress_core_stats));
+        zbuf_full_rings = calloc(nb_queues, sizeof(struct ring*));
+        zbuf_free_rings = calloc(nb_queues, sizeof(struct ring*));
+        zbuffers = calloc(nb_queues * nb_pbufs, sizeof(struct pcap_buffer*));
+    }
+
+    /* One clock per port for NIC timestamps, and a shared TSC clock last */
+    clocks = calloc(nb_ports + 1, sizeof(struct timestamp_clock*));
+    if (args.timestamp != TIMESTAMP_COARSE) {
+        clocks[nb_ports] = rte_zmalloc(NULL, sizeof(struct timestamp_clock), RTE_CACHE_LINE_SIZE);
+        if (clocks[nb_ports] == NULL) {
+            rte_exit(EXIT_FAILURE, "Cannot allocate the TSC clock\n");
+        }
+        if (timestamp_clock_init_tsc(clocks[nb_ports])) {
+            rte_exit(EXIT_FAILURE, "Cannot use the TSC for timestamps\n");
+        }
+    }
+
+    /* Common file header, written by the writing cores and the main lcore */
+    if (args.format == PCAP_FORMAT_PCAPNG) {
+        /* One interface per queue, identified by its global index */
+        interfaces = calloc(nb_queues, sizeof(struct pcapng_interface));
+        for (i = 0; i < nb_ports; i++) {
+            char dev_name[RTE_ETH_NAME_MAX_LEN] = "";
+            struct rte_eth_dev_info dev_info;
+
+            port = args.port_list[i];
+            rte_eth_dev_get_name_by_port(port, dev_name);
+            memset(&dev_info, 0, sizeof(dev_info));
+            rte_eth_dev_info_get(port, &dev_info);
+            for (j = 0; j < nb_queues_per_port; j++) {
+                k = i * nb_queues_per_port + j;
+                snprintf(interfaces[k].name, sizeof(interfaces[k].name), "port%u:%u", port, j);
+                snprintf(interfaces[k].description, sizeof(interfaces[k].description), "%s (%s) queue %u",
+                         dev_name, dev_info.driver_name ? dev_info.driver_name : "unknown", j);
+                /* Readers of sampled files need the rate to scale the counts back */
+                if (args.sample.mode != SAMPLE_NONE) {
+                    sample_describe(&args.sample, interfaces[k].comment, sizeof(interfaces[k].comment));
+                }
+            }
+        }
+        file_header_size = pcapng_header_build(NULL, argp_program_version, args.snaplen, interfaces, nb_queues);
+        file_header_len = file_header_size + pcapng_pad_length(file_header_size, args.disk_blk_size);
+    } else {
+        file_header_size = sizeof(struct pcap_file_header);
+        file_header_len = args.disk_blk_size;
+    }
+
+    file_header = rte_zmalloc(NULL, file_header_len, args.disk_blk_size);
+    if (file_header == NULL) {
+        rte_exit(EXIT_FAILURE, "Cannot allocate the pcap file header\n");
+    }
+
+    if (args.format == PCAP_FORMAT_PCAPNG) {
+        pcapng_header_build(file_header, argp_program_version, args.snaplen, interfaces, nb_queues);
+        if (file_header_len > file_header_size) {
+            pcapng_pad(file_header + file_header_size, file_header_len - file_header_size);
+        }
+        free(interfaces);
+    } else {
+        pcap_header_init(file_header, args.snaplen, args.disk_blk_size);
+    }
+
+    /* Compressed files start with the header compressed on its own */
+    if (nb_compress_cores) {
+        struct compressor compressor;
+        size_t size = compress_frame_bound(&args.compress, file_header_size, args.disk_blk_size);
+        unsigned char* compressed = rte_zmalloc(NULL, size, args.disk_blk_size);
+        ssize_t len = -1;
+
+        if (compressed && compressor_init(&compressor, &args.compress) == 0) {
+            len = compress_frame(&compressor, compressed, size, file_header, file_header_size, args.disk_blk_size);
+            compressor_exit(&compressor);
+        }
+        if (len < 0) {
+            rte_exit(EXIT_FAILURE, "Cannot compress the pcap file header\n");
+        }
+
+        rte_free(file_header);
+        file_header = compressed;
+        file_header_len = len;
+        file_header_size = len;
+    }
+
+    /* Writing cores either have their own queue, or share a ring fed by all the queues */
+    if (args.writer_cores) {
+        shared_full_ring = rte_ring_create("PCF_RING_SHARED", rte_align32pow2(nb_queues * nb_pbufs) * 2,
+                                           SOCKET_ID_ANY, 0);
+        if (shared_full_ring == NULL) {
+            rte_exit(EXIT_FAILURE, "Cannot create shared pbuf full ring: (%d) %s\n", rte_errno,
+                     rte_strerror(rte_errno));
+        }
+        free_ring_flags = RING_F_SC_DEQ;
+    } else {
+        free_ring_flags = RING_F_SP_ENQ | RING_F_SC_DEQ;
+    }
+
     nb_lcores = 0;
 
     /* For each port */
     for (i = 0; i < nb_ports; i++) {
         port = args.port_list[i];
 
+        /* Keep the queue resources and workers on the NUMA node of the port */
+        socket = port_socket_id(port);
+        LOG_INFO("Port %u is on socket %d\n", port, socket);
+
         /* Allocate memory */
         for (j = 0; j < nb_queues_per_port; j++) {
 
@@ -471,7 +1258,7 @@ next:
             char name[32];
 
             sprintf(name, "RX_POOL_%d_%d", i, j);
-            rx_pools[k] = rte_pktmbuf_pool_create(name, nb_mbufs, MBUF_CACHE_SIZE, 0, mbuf_len, rte_socket_id());
+            rx_pools[k] = rte_pktmbuf_pool_create(name, nb_mbufs, MBUF_CACHE_SIZE, 0, mbuf_len, socket);
 
             if (rx_pools[k] == NULL) {
                 rte_exit(EXIT_FAILURE, "Cannot create mbuf pool: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
@@ -479,7 +1266,7 @@ next:
 
             sprintf(name, "TX_POOL_%d_%d", i, j);
             tx_pools[k] =
-                rte_pktmbuf_pool_create(name, PAUSE_MBUF_POOL_SIZE, MBUF_CACHE_SIZE, 0, mbuf_len, rte_socket_id());
+                rte_pktmbuf_pool_create(name, PAUSE_MBUF_POOL_SIZE, MBUF_CACHE_SIZE, 0, mbuf_len, socket);
 
             if (tx_pools[k] == NULL) {
                 rte_exit(EXIT_FAILURE, "Cannot create pause frame mbuf pool: (%d) %s\n", rte_errno,
@@ -487,14 +1274,19 @@ next:
             }
 
             sprintf(name, "PCE_RING_%d_%d", i, j);
-            pbuf_free_rings[k] = rte_ring_create(name, nb_pbufs * 2, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+            pbuf_free_rings[k] = rte_ring_create(name, nb_pbufs * 2, socket,
+                                                 nb_compress_cores ? RING_F_SP_ENQ | RING_F_SC_DEQ : free_ring_flags);
 
             if (pbuf_free_rings[k] == NULL) {
                 rte_exit(EXIT_FAILURE, "Cannot create pbuf free ring: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
             }
 
             sprintf(name, "PCF_RING_%d_%d", i, j);
-            pbuf_full_rings[k] = rte_ring_create(name, nb_pbufs * 2, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+            if (shared_full_ring && !nb_compress_cores) {
+                pbuf_full_rings[k] = shared_full_ring;
+            } else {
+                pbuf_full_rings[k] = rte_ring_create(name, nb_pbufs * 2, socket, RING_F_SP_ENQ | RING_F_SC_DEQ);
+            }
 
             if (pbuf_full_rings[k] == NULL) {
                 rte_exit(EXIT_FAILURE, "Cannot create pbuf full ring: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
@@ -506,26 +1298,106 @@ next:
                 buffers[m] = calloc(1, sizeof(struct pcap_buffer));
                 buffers[m]->offset = 0;
                 buffers[m]->packets = 0;
-                buffers[m]->buffer = rte_malloc(NULL, pbuf_len, args.disk_blk_size);
+                buffers[m]->size = pbuf_len;
+                buffers[m]->index = m;
+                buffers[m]->origin = k;
+                buffers[m]->buffer = rte_malloc_socket(NULL, pbuf_len, args.disk_blk_size, socket);
 
                 if (buffers[m]->buffer == NULL) {
                     rte_exit(EXIT_FAILURE, "Cannot create pbuf buffer: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
                 }
+
+                if (args.flow_index) {
+                    buffers[m]->flows = rte_malloc_socket(NULL, FLOW_INDEX_ENTRIES * sizeof(struct flow_index_record),
+                                                          RTE_CACHE_LINE_SIZE, socket);
+                    if (buffers[m]->flows == NULL) {
+                        rte_exit(EXIT_FAILURE, "Cannot create pbuf flow index: (%d) %s\n", rte_errno,
+                                 rte_strerror(rte_errno));
+                    }
+                }
+
+                if (args.zero_copy) {
+                    buffers[m]->mbufs =
+                        rte_malloc_socket(NULL, PCAP_BUFFER_ZC_MAX_PACKETS * sizeof(struct rte_mbuf*),
+                                          RTE_CACHE_LINE_SIZE, socket);
+                    if (buffers[m]->mbufs == NULL) {
+                        rte_exit(EXIT_FAILURE, "Cannot create pbuf mbuf list: (%d) %s\n", rte_errno,
+                                 rte_strerror(rte_errno));
+                    }
+                }
             }
 
             m = i * nb_queues_per_port * nb_pbufs + j * nb_pbufs;
             rte_ring_sp_enqueue_bulk(pbuf_free_rings[k], (void**)&buffers[m], nb_pbufs, NULL);
+
+            if (!nb_compress_cores) {
+                continue;
+            }
+
+            /* Compressed buffers, between the compression core and the writing core */
+            sprintf(name, "ZCE_RING_%d_%d", i, j);
+            zbuf_free_rings[k] = rte_ring_create(name, nb_pbufs * 2, socket, free_ring_flags);
+
+            if (zbuf_free_rings[k] == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot create zbuf free ring: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
+            }
+
+            sprintf(name, "ZCF_RING_%d_%d", i, j);
+            if (shared_full_ring) {
+                zbuf_full_rings[k] = shared_full_ring;
+            } else {
+                zbuf_full_rings[k] = rte_ring_create(name, nb_pbufs * 2, socket, RING_F_SP_ENQ | RING_F_SC_DEQ);
+            }
+
+            if (zbuf_full_rings[k] == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot create zbuf full ring: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
+            }
+
+            for (l = 0; l < nb_pbufs; l++) {
+                m = k * nb_pbufs + l;
+
+                zbuffers[m] = calloc(1, sizeof(struct pcap_buffer));
+                zbuffers[m]->size = zbuf_len;
+                zbuffers[m]->index = m;
+                zbuffers[m]->origin = k;
+                zbuffers[m]->buffer = rte_malloc_socket(NULL, zbuf_len, args.disk_blk_size, socket);
+
+                if (zbuffers[m]->buffer == NULL) {
+                    rte_exit(EXIT_FAILURE, "Cannot create zbuf buffer: (%d) %s\n", rte_errno, rte_strerror(rte_errno));
+                }
+            }
+
+            rte_ring_sp_enqueue_bulk(zbuf_free_rings[k], (void**)&zbuffers[k * nb_pbufs], nb_pbufs, NULL);
         }
 
         /* Initialise and start the port */
+        port_timestamp = args.timestamp;
+        uint16_t hw_timestamp = port_timestamp == TIMESTAMP_HW;
         result =
             port_init(port, nb_queues_per_port, (num_rx_desc_matrix[i] != 0) ? num_rx_desc_matrix[i] : RX_DESC_DEFAULT,
-                      &rx_pools[i * nb_queues_per_port], args.flow_control);
+                      &rx_pools[i * nb_queues_per_port], args.flow_control, &hw_timestamp, args.flow_rules,
+                      &flow_software);
 
         if (result) {
             rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu8 "\n", port);
         }
 
+        /* Follow the NIC clock */
+        if (hw_timestamp) {
+            clocks[i] = rte_zmalloc_socket(NULL, sizeof(struct timestamp_clock), RTE_CACHE_LINE_SIZE, socket);
+            if (clocks[i] == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot allocate the clock of port %u\n", port);
+            }
+            if (timestamp_clock_init_hw(clocks[i], port, &ts_dynfield)) {
+                rte_free(clocks[i]);
+                clocks[i] = NULL;
+            }
+        }
+        if (port_timestamp == TIMESTAMP_HW && clocks[i] == NULL) {
+            LOG_WARN("Port %u falls back to " TIMESTAMP_MODE_TSC " timestamps\n", port);
+            port_timestamp = TIMESTAMP_TSC;
+        }
+
         for (j = 0; j < nb_queues_per_port; j++) {
 
             k = i * nb_queues_per_port + j;
@@ -542,12 +1414,32 @@ next:
             config->pause_burst_size = args.pause_burst_size;
             config->disk_blk_size = args.disk_blk_size;
             config->flow_control = args.flow_control;
+            config->overload = args.overload;
+            config->overload_snaplen = args.overload_snaplen;
+            config->flush_ms = args.flush_ms;
+            config->dedup = args.dedup;
+            config->sample = args.sample;
+            config->flow_index = args.flow_index;
+            config->trigger = args.recorder_pre ? &trigger : NULL;
+            config->nb_pbufs = nb_pbufs;
             config->mw_timestamp = args.mw_timestamp;
+            config->timestamp = port_timestamp;
+            config->clock = clocks[i];
+            config->tsc = clocks[nb_ports];
+            config->ts_dynfield = ts_dynfield;
+            config->zero_copy = args.zero_copy;
+            config->zc_max_held = nb_mbufs / 2;
             config->snaplen = args.snaplen;
+            config->format = args.format;
+            config->interface_id = k;
+            config->flow = flow_software ? args.flow_rules : NULL;
+            config->filter = args.filter ? &filter : NULL;
+            config->slice = args.slice;
             config->watermark = watermark;
             config->stats = &(capture_core_stats[k]);
 
             //Launch capture core
+            lcore_id = pick_lcore(lcore_used, socket);
             LOG_INFO("Launching capture process: worker=%u, port=%u, core=%u, queue=%u\n", k, port, lcore_id, j);
             result = rte_eal_remote_launch((lcore_function_t*)capture_core, config, lcore_id);
             if (result) {
@@ -558,41 +1450,132 @@ next:
             //Add the core to the list
             lcoreid_list[nb_lcores] = lcore_id;
             nb_lcores++;
-
-            lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
         }
 
-        /* Writing cores */
-        for (j = 0; j < nb_queues_per_port; j++) {
+        /* Compression cores, each serving a contiguous range of queues */
+        for (j = 0; j < (nb_compress_cores ? args.compress_cores : 0U); j++) {
+            unsigned int first = j * nb_queues_per_port / args.compress_cores;
+            unsigned int last = (j + 1) * nb_queues_per_port / args.compress_cores;
 
-            k = i * nb_queues_per_port + j;
+            k = i * args.compress_cores + j;
 
-            //Configure writing core
-            struct write_core_config* config = &(write_core_configs[k]);
+            //Configure compression core
+            struct compress_core_config* config = &(compress_core_configs[k]);
             config->port = port;
-            config->pbuf_free_ring = pbuf_free_rings[k];
-            config->pbuf_full_ring = pbuf_full_rings[k];
-            config->stop_condition = &stop_condition;
-            config->burst_size = nb_pbufs;
+            config->nb_queues = last - first;
+            config->pbuf_full_rings = &pbuf_full_rings[i * nb_queues_per_port + first];
+            config->pbuf_free_rings = &pbuf_free_rings[i * nb_queues_per_port + first];
+            config->zbuf_free_rings = &zbuf_free_rings[i * nb_queues_per_port + first];
+            config->zbuf_full_rings = &zbuf_full_rings[i * nb_queues_per_port + first];
+            config->compress = args.compress;
             config->disk_blk_size = args.disk_blk_size;
-            config->snaplen = args.snaplen;
-            config->stats = &(write_core_stats[k]);
-            config->output_file_template = args.output_file_template;
+            config->stats = &(compress_core_stats[k]);
 
-            //Launch writing core
-            LOG_INFO("Launching write process: worker=%u, port=%u, core=%u, queue=%u\n", k, port, lcore_id, j);
-            result = rte_eal_remote_launch((lcore_function_t*)write_core, config, lcore_id);
+            //Launch compression core
+            lcore_id = pick_lcore(lcore_used, socket);
+            LOG_INFO("Launching compression process: port=%u, core=%u, queues=%u-%u\n", port, lcore_id, first,
+                     last - 1);
+            result = rte_eal_remote_launch((lcore_function_t*)compress_core, config, lcore_id);
             if (result) {
-                rte_exit(EXIT_FAILURE, "Error: Could not launch write process on lcore %d: (%d) %s\n", lcore_id, result,
-                         rte_strerror(-result));
+                rte_exit(EXIT_FAILURE, "Error: Could not launch compression process on lcore %d: (%d) %s\n",
+                         lcore_id, result, rte_strerror(-result));
             }
 
             //Add the core to the list
             lcoreid_list[nb_lcores] = lcore_id;
             nb_lcores++;
+        }
+    }
+
+    /* The writing cores are launched last, and stop once they got the end of stream of each of their queues */
+
+    /* Writing cores */
+    for (w = 0; w < nb_write_cores; w++) {
+
+        /* A writing core per queue, or shared writing cores spread over the sockets of the ports */
+        i = args.writer_cores ? w % nb_ports : w / nb_queues_per_port;
+        port = args.port_list[i];
+        socket = port_socket_id(port);
+
+        //Configure writing core
+        struct write_core_config* config = &(write_core_configs[w]);
+        config->format = args.format;
+        if (nb_compress_cores) {
+            /* Write the compressed buffers */
+            config->pbuf_full_ring = shared_full_ring ? shared_full_ring : zbuf_full_rings[w];
+            config->pbuf_free_rings = zbuf_free_rings;
+        } else {
+            config->pbuf_full_ring = shared_full_ring ? shared_full_ring : pbuf_full_rings[w];
+            config->pbuf_free_rings = pbuf_free_rings;
+        }
+        config->outputs = &output_files[w * nb_queues * nb_devices];
+        config->nb_outputs = nb_queues * nb_devices;
+        config->devices = args.devices;
+        config->nb_devices = nb_devices;
+        /* Shared writing cores count the ends of stream of all the queues together */
+        config->eos_seen = shared_full_ring ? &eos_counts[0] : &eos_counts[w];
+        config->nb_producers = shared_full_ring ? nb_queues : 1;
+        config->burst_size = nb_pbufs;
+        config->disk_blk_size = args.disk_blk_size;
+        config->snaplen = args.snaplen;
+        config->rotate_bytes = args.rotate_bytes;
+        config->rotate_seconds = args.rotate_seconds;
+        config->flush_ms = args.flush_ms;
+        config->flush_sync = args.flush_sync;
+        config->io_engine = args.io_engine;
+        config->io_depth = args.io_depth;
+        config->zero_copy = args.zero_copy;
+        config->sidecars = (args.flow_index ? 1 << SIDECAR_FLOWS : 0) | (args.time_index ? 1 << SIDECAR_TIMES : 0);
+        config->sample_rate = args.sample.mode == SAMPLE_NONE ? 1 : args.sample.adaptive ? 0 : args.sample.rate;
+        config->compress = nb_compress_cores ? &args.compress : NULL;
+        /* Shared writing cores may write any buffer */
+        config->buffers = nb_compress_cores ? zbuffers : buffers;
+        config->nb_buffers = nb_queues * nb_pbufs;
+        if (!shared_full_ring) {
+            config->buffers += w * nb_pbufs;
+            config->nb_buffers = nb_pbufs;
+        }
+        config->stats = &(write_core_stats[w]);
+
+        for (k = 0; k < nb_queues * nb_devices; k++) {
+            struct output_file* output = &config->outputs[k];
+            output->port = args.port_list[k / nb_devices / nb_queues_per_port];
+            output->queue = k / nb_devices % nb_queues_per_port;
+            output->interface_id = k / nb_devices;
+            l = port_socket_id(output->port);
+            if (args.nb_devices) {
+                output->template = args.devices[k % nb_devices].template;
+            } else {
+                output->template = socket_templates[l] ? socket_templates[l] : args.output_file_template;
+            }
+            output->file_header = file_header;
+            output->file_header_len = file_header_len;
+            output->file_header_size = file_header_size;
+            output->retiring_fd = -1;
+            output->retired_fd = -1;
+            output->next_fd = -1;
+            memset(output->sidecar_fds, -1, sizeof(output->sidecar_fds));
+            memset(output->retired_sidecar_fds, -1, sizeof(output->retired_sidecar_fds));
+            memset(output->next_sidecar_fds, -1, sizeof(output->next_sidecar_fds));
+        }
 
-            lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
+        //Launch writing core
+        lcore_id = pick_lcore(lcore_used, socket);
+        if (shared_full_ring) {
+            LOG_INFO("Launching write process: worker=%u, core=%u, shared by all queues\n", w, lcore_id);
+        } else {
+            LOG_INFO("Launching write process: worker=%u, port=%u, core=%u, queue=%u\n", w, port, lcore_id,
+                     w % nb_queues_per_port);
+        }
+        result = rte_eal_remote_launch((lcore_function_t*)write_core, config, lcore_id);
+        if (result) {
+            rte_exit(EXIT_FAILURE, "Error: Could not launch write process on lcore %d: (%d) %s\n", lcore_id, result,
+                     rte_strerror(-result));
         }
+
+        //Add the core to the list
+        lcoreid_list[nb_lcores] = lcore_id;
+        nb_lcores++;
     }
 
     //Initialize stats timer
@@ -600,18 +1583,49 @@ next:
         .port_list = args.port_list,
         .capture_core_stats = capture_core_stats,
         .write_core_stats = write_core_stats,
+        .nb_write_cores = nb_write_cores,
+        .shared_writers = shared_full_ring != NULL,
+        .devices = args.nb_devices ? args.devices : NULL,
+        .nb_devices = args.nb_devices,
+        .compress_core_stats = compress_core_stats,
+        .nb_compress_cores = nb_compress_cores,
         .nb_ports = nb_ports,
         .nb_queues = nb_queues,
         .nb_queues_per_port = nb_queues_per_port,
         .log_file = args.log_file,
     };
 
+    //Initialize housekeeping timer
+    struct housekeeping_data hd = {
+        .write_core_configs = write_core_configs,
+        .nb_write_cores = nb_write_cores,
+        .clocks = clocks,
+        .nb_clocks = nb_ports + 1,
+        .trigger = args.recorder_pre ? &trigger : NULL,
+    };
+
+    if (telemetry_init(&sd, args.metrics_addr) < 0) {
+        rte_exit(EXIT_FAILURE, "Cannot serve the metrics on %s.\n", args.metrics_addr);
+    }
+    if (args.recorder_pre) {
+        trigger_init(&trigger, &sd);
+    }
+
+    rte_timer_subsystem_init();
+    rte_timer_init(&housekeeping_timer);
+    rte_timer_reset(&housekeeping_timer, rte_get_timer_hz() * HOUSEKEEPING_PERIOD_MS / 1000, PERIODICAL,
+                    rte_lcore_id(), housekeeping, &hd);
+    rte_timer_init(&calibration_timer);
+    rte_timer_reset(&calibration_timer, rte_get_timer_hz() * TIMESTAMP_CALIBRATION_PERIOD_MS / 1000, PERIODICAL,
+                    rte_lcore_id(), calibrate_clocks, &hd);
+
     if (args.stats) {
         start_stats_display(&sd, &stop_condition);
     }
 
     while (!stop_condition) {
-        sleep(5);
+        rte_timer_manage();
+        usleep(HOUSEKEEPING_PERIOD_MS * 1000);
     }
 
     //Wait for all the cores to complete and exit
@@ -623,8 +1637,20 @@ next:
         }
     }
 
+    rte_timer_stop(&housekeeping_timer);
+    rte_timer_stop(&calibration_timer);
+    telemetry_log_histograms(true);
+    telemetry_log_stalls();
+    telemetry_exit();
+    for (i = 0; i < nb_write_cores; i++) {
+        write_core_close_files(&write_core_configs[i]);
+    }
+
     //Finalize
     free(write_core_stats);
+    free(output_files);
+    free(eos_counts);
+    rte_free(file_header);
     free(capture_core_stats);
     free(write_core_configs);
     free(capture_core_configs);
@@ -632,8 +1658,30 @@ next:
     free(tx_pools);
     free(pbuf_free_rings);
     free(pbuf_full_rings);
+    free(compress_core_configs);
+    free(compress_core_stats);
+    free(zbuf_free_rings);
+    free(zbuf_full_rings);
+    for (i = 0; i <= nb_ports; i++) {
+        rte_free(clocks[i]);
+    }
+    free(clocks);
+    filter_exit(&filter);
+    filter_exit(&trigger_filter);
+    if (args.flow_rules) {
+        for (i = 0; i < nb_ports; i++) {
+            flow_uninstall(args.port_list[i]);
+        }
+        free(args.flow_rules);
+    }
     free(num_rx_desc_matrix);
     free(args.output_file_template);
+    for (i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+        free(socket_templates[i]);
+    }
+    for (d = 0; d < args.nb_devices; d++) {
+        free(args.devices[d].template);
+    }
     free(args.port_list);
 
     return 0;
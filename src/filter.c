@@ -0,0 +1,77 @@
+#include "filter.h"
+
+#ifdef RTE_HAS_LIBPCAP
+#include <pcap/pcap.h>
+
+#include <rte_errno.h>
+#include <rte_malloc.h>
+
+int
+filter_init(struct filter* filter, const char* expression, uint32_t snaplen) {
+    struct bpf_program program;
+    struct rte_bpf_prm* prm;
+    struct rte_bpf_jit jit;
+    pcap_t* pcap;
+
+    memset(filter, 0, sizeof(*filter));
+
+    /* Compile to classic BPF */
+    pcap = pcap_open_dead(DLT_EN10MB, snaplen);
+    if (pcap == NULL) {
+        LOG_ERR("Cannot open libpcap\n");
+        return -ENOMEM;
+    }
+
+    if (pcap_compile(pcap, &program, expression, 1, PCAP_NETMASK_UNKNOWN)) {
+        LOG_ERR("Invalid filter '%s': %s\n", expression, pcap_geterr(pcap));
+        pcap_close(pcap);
+        return -EINVAL;
+    }
+    pcap_close(pcap);
+
+    /* Convert to eBPF and load */
+    prm = rte_bpf_convert(&program);
+    pcap_freecode(&program);
+    if (prm == NULL) {
+        LOG_ERR("Cannot convert filter '%s': %s\n", expression, rte_strerror(rte_errno));
+        return -rte_errno;
+    }
+
+    filter->bpf = rte_bpf_load(prm);
+    rte_free(prm);
+    if (filter->bpf == NULL) {
+        LOG_ERR("Cannot load filter '%s': %s\n", expression, rte_strerror(rte_errno));
+        return -rte_errno;
+    }
+
+    if (rte_bpf_get_jit(filter->bpf, &jit) == 0 && jit.func != NULL) {
+        filter->func = jit.func;
+    } else {
+        LOG_WARN("Filter is not JIT compiled, falling back to the interpreter\n");
+    }
+
+    return 0;
+}
+
+void
+filter_exit(struct filter* filter) {
+    if (filter->bpf) {
+        rte_bpf_destroy(filter->bpf);
+    }
+    memset(filter, 0, sizeof(*filter));
+}
+
+#else
+
+int
+filter_init(struct filter* filter, __attribute__((unused)) const char* expression,
+            __attribute__((unused)) uint32_t snaplen) {
+    memset(filter, 0, sizeof(*filter));
+    LOG_ERR("Packet filters require DPDK built with libpcap\n");
+    return -ENOTSUP;
+}
+
+void
+filter_exit(__attribute__((unused)) struct filter* filter) {}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef DPDKCAP_FILTER_H
+#define DPDKCAP_FILTER_H
+
+#include <rte_bpf.h>
+#include <rte_mbuf.h>
+
+#include "utils.h"
+
+/* A packet filter, compiled from a tcpdump expression */
+struct filter {
+    struct rte_bpf* bpf;
+    uint64_t (*func)(void*); /* JIT compiled code, NULL if interpreted */
+};
+
+/*
+ * Compiles a tcpdump expression into a filter, JIT compiled when possible.
+ * Returns -ENOTSUP if DPDK was built without libpcap.
+ */
+int filter_init(struct filter* filter, const char* expression, uint32_t snaplen);
+
+void filter_exit(struct filter* filter);
+
+/*
+ * Runs the filter over a burst of mbufs. The accepted mbufs are moved to the
+ * front of bufs, the rejected ones are freed. Returns the number of
+ * accepted mbufs.
+ */
+static inline uint16_t
+filter_burst(const struct filter* filter, struct rte_mbuf** bufs, uint16_t nb_rx) {
+    uint64_t rc[nb_rx];
+    struct rte_mbuf* rejected[nb_rx];
+    uint16_t i, nb_accepted = 0, nb_rejected = 0;
+
+    if (likely(filter->func != NULL)) {
+        for (i = 0; i < nb_rx; i++) {
+            rc[i] = filter->func(bufs[i]);
+        }
+    } else {
+        rte_bpf_exec_burst(filter->bpf, (void**)bufs, rc, nb_rx);
+    }
+
+    for (i = 0; i < nb_rx; i++) {
+        if (rc[i]) {
+            bufs[nb_accepted++] = bufs[i];
+        } else {
+            rejected[nb_rejected++] = bufs[i];
+        }
+    }
+
+    if (nb_rejected) {
+        rte_pktmbuf_free_bulk(rejected, nb_rejected);
+    }
+
+    return nb_accepted;
+}
+
+/* Returns whether a packet of a burst matches the filter, leaving the burst untouched */
+static inline bool
+filter_match_any(const struct filter* filter, struct rte_mbuf** bufs, uint16_t nb_rx) {
+    uint64_t rc[nb_rx];
+    uint16_t i;
+
+    if (likely(filter->func != NULL)) {
+        for (i = 0; i < nb_rx; i++) {
+            if (filter->func(bufs[i])) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    rte_bpf_exec_burst(filter->bpf, (void**)bufs, rc, nb_rx);
+    for (i = 0; i < nb_rx; i++) {
+        if (rc[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
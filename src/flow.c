@@ -0,0 +1,464 @@
+#include <arpa/inet.h>
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_string_fns.h>
+
+#include "flow.h"
+
+#define FLOW_MAX_TOKENS 16
+
+static int
+parse_prefix(char* arg, uint8_t* addr, uint8_t* len, uint8_t* ip_version) {
+    char* slash = strchr(arg, '/');
+    unsigned long prefix_len;
+    uint8_t version, max_len;
+    char* end;
+
+    if (slash) {
+        *slash++ = '\0';
+    }
+
+    memset(addr, 0, 16);
+    if (inet_pton(AF_INET, arg, addr) == 1) {
+        version = 4;
+        max_len = 32;
+    } else if (inet_pton(AF_INET6, arg, addr) == 1) {
+        version = 6;
+        max_len = 128;
+    } else {
+        return -EINVAL;
+    }
+
+    prefix_len = max_len;
+    if (slash) {
+        errno = 0;
+        prefix_len = strtoul(slash, &end, 10);
+        if (errno || *end != '\0' || end == slash || prefix_len > max_len) {
+            return -EINVAL;
+        }
+    }
+
+    /* Both addresses of a rule have the same family */
+    if (*ip_version && *ip_version != version) {
+        return -EINVAL;
+    }
+    *ip_version = version;
+    *len = prefix_len;
+    return 0;
+}
+
+static int
+parse_number(const char* arg, unsigned long max, uint16_t* value) {
+    unsigned long number;
+    char* end;
+
+    errno = 0;
+    number = strtoul(arg, &end, 0);
+    if (errno || *end != '\0' || end == arg || number > max) {
+        return -EINVAL;
+    }
+    *value = number;
+    return 0;
+}
+
+static int
+parse_proto(const char* arg, uint8_t* proto) {
+    uint16_t value;
+
+    if (!strcmp(arg, "tcp")) {
+        *proto = IPPROTO_TCP;
+    } else if (!strcmp(arg, "udp")) {
+        *proto = IPPROTO_UDP;
+    } else if (parse_number(arg, UINT8_MAX, &value) == 0) {
+        *proto = value;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int
+parse_rule(char* arg, struct flow_rule* rule) {
+    char* tokens[FLOW_MAX_TOKENS];
+    char* field;
+    char* value;
+    int nb_tokens, i, retval = 0;
+
+    memset(rule, 0, sizeof(*rule));
+
+    nb_tokens = rte_strsplit(arg, strlen(arg), tokens, FLOW_MAX_TOKENS, ' ');
+    if (nb_tokens < 1) {
+        return -EINVAL;
+    }
+
+    if (!strcmp(tokens[0], "keep")) {
+        rule->action = FLOW_KEEP;
+    } else if (!strcmp(tokens[0], "drop")) {
+        rule->action = FLOW_DROP;
+    } else {
+        return -EINVAL;
+    }
+
+    for (i = 1; i < nb_tokens && !retval; i++) {
+        field = tokens[i];
+        if (*field == '\0') {
+            continue;
+        }
+
+        if (!strcmp(field, "tcp") || !strcmp(field, "udp")) {
+            rule->fields |= FLOW_FIELD_PROTO;
+            retval = parse_proto(field, &rule->proto);
+            continue;
+        }
+
+        /* Other fields take a value */
+        if (++i >= nb_tokens) {
+            return -EINVAL;
+        }
+        value = tokens[i];
+
+        if (!strcmp(field, "ether")) {
+            rule->fields |= FLOW_FIELD_ETHER;
+            retval = parse_number(value, UINT16_MAX, &rule->ether_type);
+        } else if (!strcmp(field, "vlan")) {
+            rule->fields |= FLOW_FIELD_VLAN;
+            retval = parse_number(value, 4095, &rule->vlan_id);
+        } else if (!strcmp(field, "proto")) {
+            rule->fields |= FLOW_FIELD_PROTO;
+            retval = parse_proto(value, &rule->proto);
+        } else if (!strcmp(field, "src")) {
+            rule->fields |= FLOW_FIELD_SRC;
+            retval = parse_prefix(value, rule->src, &rule->src_len, &rule->ip_version);
+        } else if (!strcmp(field, "dst")) {
+            rule->fields |= FLOW_FIELD_DST;
+            retval = parse_prefix(value, rule->dst, &rule->dst_len, &rule->ip_version);
+        } else if (!strcmp(field, "sport")) {
+            rule->fields |= FLOW_FIELD_SPORT;
+            retval = parse_number(value, UINT16_MAX, &rule->sport);
+        } else if (!strcmp(field, "dport")) {
+            rule->fields |= FLOW_FIELD_DPORT;
+            retval = parse_number(value, UINT16_MAX, &rule->dport);
+        } else {
+            return -EINVAL;
+        }
+    }
+    if (retval) {
+        return retval;
+    }
+
+    /* Ports need a transport protocol */
+    if ((rule->fields & (FLOW_FIELD_SPORT | FLOW_FIELD_DPORT))
+        && (!(rule->fields & FLOW_FIELD_PROTO) || (rule->proto != IPPROTO_TCP && rule->proto != IPPROTO_UDP))) {
+        return -EINVAL;
+    }
+
+    /* IP fields need an IP EtherType */
+    if ((rule->fields & FLOW_FIELD_ETHER) && (rule->fields & ~(FLOW_FIELD_ETHER | FLOW_FIELD_VLAN))) {
+        if (rule->ether_type == RTE_ETHER_TYPE_IPV4 && rule->ip_version != 6) {
+            rule->ip_version = 4;
+        } else if (rule->ether_type == RTE_ETHER_TYPE_IPV6 && rule->ip_version != 4) {
+            rule->ip_version = 6;
+        } else {
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+int
+flow_parse_opt(const char* arg, struct flow_rules* rules) {
+    char buf[1024];
+    char* tokens[FLOW_MAX_RULES + 1];
+    int nb_tokens, i;
+
+    memset(rules, 0, sizeof(*rules));
+
+    if (strlen(arg) >= sizeof(buf)) {
+        return -EINVAL;
+    }
+    strcpy(buf, arg);
+
+    nb_tokens = rte_strsplit(buf, strlen(buf), tokens, FLOW_MAX_RULES + 1, ';');
+    if (nb_tokens < 1 || nb_tokens > FLOW_MAX_RULES) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < nb_tokens; i++) {
+        while (*tokens[i] == ' ') {
+            tokens[i]++;
+        }
+        if (parse_rule(tokens[i], &rules->rules[i]) < 0) {
+            LOG_ERR("Invalid flow rule %d\n", i + 1);
+            return -EINVAL;
+        }
+        if (rules->rules[i].action == FLOW_KEEP) {
+            rules->has_keep = true;
+        }
+    }
+    rules->nb_rules = nb_tokens;
+
+    return 0;
+}
+
+/* Pattern items and their specs/masks, for one IP version and VLAN tag count of a rule */
+struct flow_pattern {
+    struct rte_flow_item items[5 + PACKET_MAX_VLAN_TAGS];
+    struct rte_flow_item_eth eth_spec, eth_mask;
+    struct rte_flow_item_vlan vlan_spec[PACKET_MAX_VLAN_TAGS], vlan_mask[PACKET_MAX_VLAN_TAGS];
+    struct rte_flow_item_ipv4 ipv4_spec, ipv4_mask;
+    struct rte_flow_item_ipv6 ipv6_spec, ipv6_mask;
+    struct rte_flow_item_tcp tcp_spec, tcp_mask;
+    struct rte_flow_item_udp udp_spec, udp_mask;
+};
+
+static void
+prefix_mask(uint8_t* mask, uint8_t len, unsigned int size) {
+    memset(mask, 0, size);
+    memset(mask, 0xff, len / 8);
+    if (len % 8) {
+        mask[len / 8] = 0xff << (8 - len % 8);
+    }
+}
+
+/*
+ * Builds the pattern of a rule for an IP version (0 for none) and a number
+ * of VLAN tags. The outermost tag carries the VLAN id of the rule, and the
+ * innermost header the EtherType.
+ */
+static void
+build_pattern(const struct flow_rule* rule, uint8_t ip_version, unsigned int nb_vlans, struct flow_pattern* p) {
+    uint8_t mask[16];
+    unsigned int n = 0, t;
+    uint16_t ether_type;
+    bool match_ether;
+
+    memset(p, 0, sizeof(*p));
+
+    ether_type = ip_version == 4 ? RTE_ETHER_TYPE_IPV4 : ip_version == 6 ? RTE_ETHER_TYPE_IPV6 : rule->ether_type;
+    match_ether = ip_version || (rule->fields & FLOW_FIELD_ETHER);
+
+    /* L2 */
+    p->items[n].type = RTE_FLOW_ITEM_TYPE_ETH;
+    if (match_ether && !nb_vlans) {
+        p->eth_spec.type = rte_cpu_to_be_16(ether_type);
+        p->eth_mask.type = 0xffff;
+        p->items[n].spec = &p->eth_spec;
+        p->items[n].mask = &p->eth_mask;
+    }
+    n++;
+
+    for (t = 0; t < nb_vlans; t++) {
+        if (t == 0 && (rule->fields & FLOW_FIELD_VLAN)) {
+            p->vlan_spec[t].tci = rte_cpu_to_be_16(rule->vlan_id);
+            p->vlan_mask[t].tci = rte_cpu_to_be_16(0x0fff);
+        }
+        if (match_ether && t == nb_vlans - 1) {
+            p->vlan_spec[t].inner_type = rte_cpu_to_be_16(ether_type);
+            p->vlan_mask[t].inner_type = 0xffff;
+        }
+        p->items[n].type = RTE_FLOW_ITEM_TYPE_VLAN;
+        p->items[n].spec = &p->vlan_spec[t];
+        p->items[n].mask = &p->vlan_mask[t];
+        n++;
+    }
+
+    /* L3 */
+    if (ip_version == 4) {
+        if (rule->fields & FLOW_FIELD_SRC) {
+            memcpy(&p->ipv4_spec.hdr.src_addr, rule->src, 4);
+            prefix_mask(mask, rule->src_len, 4);
+            memcpy(&p->ipv4_mask.hdr.src_addr, mask, 4);
+        }
+        if (rule->fields & FLOW_FIELD_DST) {
+            memcpy(&p->ipv4_spec.hdr.dst_addr, rule->dst, 4);
+            prefix_mask(mask, rule->dst_len, 4);
+            memcpy(&p->ipv4_mask.hdr.dst_addr, mask, 4);
+        }
+        if (rule->fields & FLOW_FIELD_PROTO) {
+            p->ipv4_spec.hdr.next_proto_id = rule->proto;
+            p->ipv4_mask.hdr.next_proto_id = 0xff;
+        }
+        p->items[n].type = RTE_FLOW_ITEM_TYPE_IPV4;
+        p->items[n].spec = &p->ipv4_spec;
+        p->items[n].mask = &p->ipv4_mask;
+        n++;
+    } else if (ip_version == 6) {
+        if (rule->fields & FLOW_FIELD_SRC) {
+            memcpy(&p->ipv6_spec.hdr.src_addr, rule->src, 16);
+            prefix_mask(mask, rule->src_len, 16);
+            memcpy(&p->ipv6_mask.hdr.src_addr, mask, 16);
+        }
+        if (rule->fields & FLOW_FIELD_DST) {
+            memcpy(&p->ipv6_spec.hdr.dst_addr, rule->dst, 16);
+            prefix_mask(mask, rule->dst_len, 16);
+            memcpy(&p->ipv6_mask.hdr.dst_addr, mask, 16);
+        }
+        if (rule->fields & FLOW_FIELD_PROTO) {
+            p->ipv6_spec.hdr.proto = rule->proto;
+            p->ipv6_mask.hdr.proto = 0xff;
+        }
+        p->items[n].type = RTE_FLOW_ITEM_TYPE_IPV6;
+        p->items[n].spec = &p->ipv6_spec;
+        p->items[n].mask = &p->ipv6_mask;
+        n++;
+    }
+
+    /* L4 */
+    if (ip_version && (rule->fields & FLOW_FIELD_PROTO) && rule->proto == IPPROTO_TCP) {
+        p->tcp_spec.hdr.src_port = rte_cpu_to_be_16(rule->sport);
+        p->tcp_spec.hdr.dst_port = rte_cpu_to_be_16(rule->dport);
+        p->tcp_mask.hdr.src_port = rule->fields & FLOW_FIELD_SPORT ? 0xffff : 0;
+        p->tcp_mask.hdr.dst_port = rule->fields & FLOW_FIELD_DPORT ? 0xffff : 0;
+        p->items[n].type = RTE_FLOW_ITEM_TYPE_TCP;
+        p->items[n].spec = &p->tcp_spec;
+        p->items[n].mask = &p->tcp_mask;
+        n++;
+    } else if (ip_version && (rule->fields & FLOW_FIELD_PROTO) && rule->proto == IPPROTO_UDP) {
+        p->udp_spec.hdr.src_port = rte_cpu_to_be_16(rule->sport);
+        p->udp_spec.hdr.dst_port = rte_cpu_to_be_16(rule->dport);
+        p->udp_mask.hdr.src_port = rule->fields & FLOW_FIELD_SPORT ? 0xffff : 0;
+        p->udp_mask.hdr.dst_port = rule->fields & FLOW_FIELD_DPORT ? 0xffff : 0;
+        p->items[n].type = RTE_FLOW_ITEM_TYPE_UDP;
+        p->items[n].spec = &p->udp_spec;
+        p->items[n].mask = &p->udp_mask;
+        n++;
+    }
+
+    p->items[n].type = RTE_FLOW_ITEM_TYPE_END;
+}
+
+/*
+ * Validates or creates the rte_flow rules of a rule: one per IP version
+ * when IP fields are matched without addresses, and one per number of VLAN
+ * tags when the EtherType or IP fields are matched. The capture cores look
+ * past up to PACKET_MAX_VLAN_TAGS tags, so the NIC must match tagged
+ * packets as well.
+ */
+static int
+apply_rule(uint16_t port, const struct flow_rule* rule, uint32_t priority, const struct rte_flow_action* actions,
+           bool create, struct rte_flow_error* error) {
+    const struct rte_flow_attr attr = {.priority = priority, .ingress = 1};
+    struct flow_pattern pattern;
+    uint8_t versions[2];
+    unsigned int nb_versions, v, nb_vlans, min_vlans, max_vlans;
+    int retval;
+
+    if (rule->ip_version) {
+        versions[0] = rule->ip_version;
+        nb_versions = 1;
+    } else if (rule->fields & ~(FLOW_FIELD_ETHER | FLOW_FIELD_VLAN)) {
+        versions[0] = 4;
+        versions[1] = 6;
+        nb_versions = 2;
+    } else {
+        versions[0] = 0;
+        nb_versions = 1;
+    }
+
+    /* Without EtherType nor IP fields, a pattern matches whatever follows its last item */
+    min_vlans = rule->fields & FLOW_FIELD_VLAN ? 1 : 0;
+    max_vlans = versions[0] || (rule->fields & FLOW_FIELD_ETHER) ? PACKET_MAX_VLAN_TAGS : min_vlans;
+
+    for (v = 0; v < nb_versions; v++) {
+        for (nb_vlans = min_vlans; nb_vlans <= max_vlans; nb_vlans++) {
+            build_pattern(rule, versions[v], nb_vlans, &pattern);
+            if (create) {
+                retval = rte_flow_create(port, &attr, pattern.items, actions, error) ? 0 : -rte_errno;
+            } else {
+                retval = rte_flow_validate(port, &attr, pattern.items, actions, error);
+            }
+            if (retval) {
+                return retval;
+            }
+        }
+    }
+    return 0;
+}
+
+int
+flow_install(uint16_t port, const struct flow_rules* rules, uint16_t nb_queues) {
+    const struct flow_rule catch_all = {.action = FLOW_DROP};
+    struct rte_flow_action keep_actions[2], drop_actions[2];
+    struct rte_flow_action_queue queue = {.index = 0};
+    struct rte_flow_action_rss rss;
+    struct rte_flow_error error;
+    uint16_t queues[nb_queues];
+    const struct rte_flow_action* actions;
+    unsigned int i, nb_offloaded;
+    uint16_t q;
+    int retval;
+
+    /* Kept packets are spread over the queues as usual */
+    for (q = 0; q < nb_queues; q++) {
+        queues[q] = q;
+    }
+    memset(&rss, 0, sizeof(rss));
+    rss.func = RTE_ETH_HASH_FUNCTION_DEFAULT;
+    rss.types = RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP | RTE_ETH_RSS_UDP;
+    rss.queue_num = nb_queues;
+    rss.queue = queues;
+
+    memset(keep_actions, 0, sizeof(keep_actions));
+    if (nb_queues > 1) {
+        keep_actions[0].type = RTE_FLOW_ACTION_TYPE_RSS;
+        keep_actions[0].conf = &rss;
+    } else {
+        keep_actions[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+        keep_actions[0].conf = &queue;
+    }
+    keep_actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    memset(drop_actions, 0, sizeof(drop_actions));
+    drop_actions[0].type = RTE_FLOW_ACTION_TYPE_DROP;
+    drop_actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    /* Offload the rules in order, until one is not supported */
+    for (nb_offloaded = 0; nb_offloaded < rules->nb_rules; nb_offloaded++) {
+        actions = rules->rules[nb_offloaded].action == FLOW_KEEP ? keep_actions : drop_actions;
+        memset(&error, 0, sizeof(error));
+        retval = apply_rule(port, &rules->rules[nb_offloaded], nb_offloaded, actions, false, &error);
+        if (retval) {
+            LOG_WARN("Port %u cannot offload flow rule %u (%s), rules %u to %u are applied in software\n", port,
+                     nb_offloaded + 1, error.message ? error.message : rte_strerror(-retval), nb_offloaded + 1,
+                     rules->nb_rules);
+            break;
+        }
+    }
+
+    for (i = 0; i < nb_offloaded; i++) {
+        actions = rules->rules[i].action == FLOW_KEEP ? keep_actions : drop_actions;
+        retval = apply_rule(port, &rules->rules[i], i, actions, true, &error);
+        if (retval) {
+            LOG_ERR("Port %u: cannot create flow rule %u: %s\n", port, i + 1,
+                    error.message ? error.message : rte_strerror(-retval));
+            rte_flow_flush(port, &error);
+            return retval;
+        }
+    }
+
+    /* Everything else is dropped by the hardware, unless software has rules to apply */
+    if (nb_offloaded == rules->nb_rules && rules->has_keep) {
+        retval = apply_rule(port, &catch_all, rules->nb_rules, drop_actions, false, &error);
+        if (!retval) {
+            retval = apply_rule(port, &catch_all, rules->nb_rules, drop_actions, true, &error);
+        }
+        if (retval) {
+            LOG_WARN("Port %u cannot drop unmatched packets (%s), rules are applied in software\n", port,
+                     error.message ? error.message : rte_strerror(-retval));
+            return 0;
+        }
+    }
+
+    LOG_INFO("Port %u: %u of %u flow rules offloaded\n", port, nb_offloaded, rules->nb_rules);
+    return nb_offloaded;
+}
+
+void
+flow_uninstall(uint16_t port) {
+    struct rte_flow_error error;
+
+    rte_flow_flush(port, &error);
+}
@@ -0,0 +1,157 @@
+#ifndef DPDKCAP_FLOW_H
+#define DPDKCAP_FLOW_H
+
+#include <rte_mbuf.h>
+
+#include "packet.h"
+#include "utils.h"
+
+#define FLOW_MAX_RULES   32
+
+/* Rule actions */
+#define FLOW_KEEP        0
+#define FLOW_DROP        1
+
+/* Rule fields */
+#define FLOW_FIELD_ETHER (1 << 0)
+#define FLOW_FIELD_VLAN  (1 << 1)
+#define FLOW_FIELD_PROTO (1 << 2)
+#define FLOW_FIELD_SRC   (1 << 3)
+#define FLOW_FIELD_DST   (1 << 4)
+#define FLOW_FIELD_SPORT (1 << 5)
+#define FLOW_FIELD_DPORT (1 << 6)
+
+/* A rule matching on some header fields. Values are in host order. */
+struct flow_rule {
+    uint16_t action;
+    uint16_t fields;
+    uint16_t ether_type;
+    uint16_t vlan_id;
+    uint8_t ip_version; /* 4 or 6 when addresses are matched, 0 otherwise */
+    uint8_t proto;
+    uint16_t sport;
+    uint16_t dport;
+    uint8_t src_len;
+    uint8_t dst_len;
+    uint8_t src[16];
+    uint8_t dst[16];
+};
+
+/*
+ * An ordered list of rules: the first matching rule decides. Packets which
+ * do not match any rule are dropped if there is a keep rule, kept otherwise.
+ */
+struct flow_rules {
+    unsigned int nb_rules;
+    bool has_keep;
+    struct flow_rule rules[FLOW_MAX_RULES];
+};
+
+/*
+ * Parses a list of rules separated by ';'. Each rule is "keep" or "drop"
+ * followed by field/value pairs among: ether TYPE, vlan ID, proto
+ * tcp|udp|NUM (or just tcp/udp), src ADDR[/LEN], dst ADDR[/LEN], sport
+ * PORT and dport PORT (which require tcp or udp).
+ */
+int flow_parse_opt(const char* arg, struct flow_rules* rules);
+
+/*
+ * Installs the rules as rte_flow rules on a configured port, spreading the
+ * kept packets over its queues. When the port cannot offload a rule, that
+ * rule and the following ones are left to software. Returns the number of
+ * rules offloaded, or a negative value on error.
+ */
+int flow_install(uint16_t port, const struct flow_rules* rules, uint16_t nb_queues);
+
+void flow_uninstall(uint16_t port);
+
+static inline bool
+flow_prefix_match(const uint8_t* addr, const uint8_t* prefix, uint8_t len) {
+    uint8_t bytes = len / 8, bits = len % 8;
+
+    if (memcmp(addr, prefix, bytes)) {
+        return false;
+    }
+    return !bits || !((addr[bytes] ^ prefix[bytes]) & (0xff << (8 - bits)));
+}
+
+static inline bool
+flow_rule_match(const struct flow_rule* rule, const struct rte_mbuf* mbuf, const struct packet_info* info) {
+    const uint8_t* data = rte_pktmbuf_mtod(mbuf, const uint8_t*);
+    const uint8_t* l3 = data + info->l3_offset;
+    const uint8_t* l4 = data + info->l4_offset;
+
+    if ((rule->fields & FLOW_FIELD_ETHER) && info->ether_type != rule->ether_type) {
+        return false;
+    }
+    if ((rule->fields & FLOW_FIELD_VLAN) && (!info->nb_vlans || info->vlan_id != rule->vlan_id)) {
+        return false;
+    }
+    if (rule->ip_version && info->ip_version != rule->ip_version) {
+        return false;
+    }
+    if ((rule->fields & FLOW_FIELD_PROTO) && (!info->ip_version || info->l4_proto != rule->proto)) {
+        return false;
+    }
+    if ((rule->fields & FLOW_FIELD_SRC)
+        && !flow_prefix_match(l3 + (info->ip_version == 4 ? 12 : 8), rule->src, rule->src_len)) {
+        return false;
+    }
+    if ((rule->fields & FLOW_FIELD_DST)
+        && !flow_prefix_match(l3 + (info->ip_version == 4 ? 16 : 24), rule->dst, rule->dst_len)) {
+        return false;
+    }
+    if (rule->fields & (FLOW_FIELD_SPORT | FLOW_FIELD_DPORT)) {
+        if (!info->l4_offset) {
+            return false;
+        }
+        if ((rule->fields & FLOW_FIELD_SPORT) && rte_be_to_cpu_16(*(const uint16_t*)l4) != rule->sport) {
+            return false;
+        }
+        if ((rule->fields & FLOW_FIELD_DPORT) && rte_be_to_cpu_16(*(const uint16_t*)(l4 + 2)) != rule->dport) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline bool
+flow_keep(const struct flow_rules* rules, const struct rte_mbuf* mbuf) {
+    struct packet_info info;
+    unsigned int i;
+
+    packet_parse(mbuf, &info);
+    for (i = 0; i < rules->nb_rules; i++) {
+        if (flow_rule_match(&rules->rules[i], mbuf, &info)) {
+            return rules->rules[i].action == FLOW_KEEP;
+        }
+    }
+    return !rules->has_keep;
+}
+
+/*
+ * Applies the rules to a burst of mbufs in software. The kept mbufs are
+ * moved to the front of bufs, the dropped ones are freed. Returns the
+ * number of kept mbufs.
+ */
+static inline uint16_t
+flow_burst(const struct flow_rules* rules, struct rte_mbuf** bufs, uint16_t nb_rx) {
+    struct rte_mbuf* dropped[nb_rx];
+    uint16_t i, nb_kept = 0, nb_dropped = 0;
+
+    for (i = 0; i < nb_rx; i++) {
+        if (flow_keep(rules, bufs[i])) {
+            bufs[nb_kept++] = bufs[i];
+        } else {
+            dropped[nb_dropped++] = bufs[i];
+        }
+    }
+
+    if (nb_dropped) {
+        rte_pktmbuf_free_bulk(dropped, nb_dropped);
+    }
+
+    return nb_kept;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#include "flow_index.h"
+
+#include <errno.h>
+
+#include <rte_malloc.h>
+
+int
+flow_index_init(struct flow_index* index, int socket_id) {
+    index->slots = rte_zmalloc_socket(NULL, FLOW_INDEX_SLOTS * sizeof(uint16_t), RTE_CACHE_LINE_SIZE, socket_id);
+    return index->slots ? 0 : -ENOMEM;
+}
+
+void
+flow_index_exit(struct flow_index* index) {
+    rte_free(index->slots);
+    index->slots = NULL;
+}
@@ -0,0 +1,99 @@
+#ifndef DPDKCAP_FLOW_INDEX_H
+#define DPDKCAP_FLOW_INDEX_H
+
+#include <rte_hash_crc.h>
+#include <rte_mbuf.h>
+
+#include "index_format.h"
+#include "packet.h"
+#include "pcap.h"
+#include "utils.h"
+
+/* Flows indexed per packet buffer, which is flushed before running out of them */
+#define FLOW_INDEX_ENTRIES 8192
+
+/* Slots of the table of a capturing core: a power of 2, twice FLOW_INDEX_ENTRIES */
+#define FLOW_INDEX_SLOTS   16384
+
+/*
+ * Flows of the buffer filled by a capturing core, aggregated into one
+ * record each. The open-addressing table maps flow hashes to the records of
+ * the buffer, and is cleared once the buffer is handed over. Flows whose
+ * hashes collide share a record, the query tool tells their packets apart.
+ */
+struct flow_index {
+    uint16_t* slots; /* record + 1, 0 when free */
+};
+
+/* Allocates the table of a capturing core on its socket */
+int flow_index_init(struct flow_index* index, int socket_id);
+
+void flow_index_exit(struct flow_index* index);
+
+static inline void
+flow_index_reset(struct flow_index* index) {
+    memset(index->slots, 0, FLOW_INDEX_SLOTS * sizeof(uint16_t));
+}
+
+/* Hashes the flow key of an IP packet, returns false for other packets */
+static inline bool
+flow_index_hash(const struct rte_mbuf* mbuf, uint32_t* hash) {
+    const uint8_t* data = rte_pktmbuf_mtod(mbuf, const uint8_t*);
+    struct flow_index_key key;
+    struct packet_info info;
+    uint16_t sport = 0, dport = 0;
+
+    packet_parse(mbuf, &info);
+    if (!info.ip_version) {
+        return false;
+    }
+    if (info.class == PACKET_CLASS_TCP || info.class == PACKET_CLASS_UDP) {
+        sport = *(const uint16_t*)(data + info.l4_offset);
+        dport = *(const uint16_t*)(data + info.l4_offset + 2);
+    }
+
+    if (info.ip_version == 4) {
+        flow_index_key_init(&key, 4, info.l4_proto, data + info.l3_offset + 12, data + info.l3_offset + 16, sport,
+                            dport);
+    } else {
+        flow_index_key_init(&key, 6, info.l4_proto, data + info.l3_offset + 8, data + info.l3_offset + 24, sport,
+                            dport);
+    }
+    *hash = rte_hash_crc(&key, sizeof(key), FLOW_INDEX_SEED);
+    return true;
+}
+
+/*
+ * Adds a packet record of the buffer, from start to end, to the record of
+ * its flow
+ */
+static inline void
+flow_index_add(struct flow_index* index, struct pcap_buffer* buffer, const struct rte_mbuf* mbuf, uint32_t start,
+               uint32_t end, uint64_t ns) {
+    struct flow_index_record* record;
+    uint32_t hash, slot;
+
+    if (!flow_index_hash(mbuf, &hash)) {
+        return;
+    }
+
+    for (slot = hash & (FLOW_INDEX_SLOTS - 1); index->slots[slot]; slot = (slot + 1) & (FLOW_INDEX_SLOTS - 1)) {
+        record = &buffer->flows[index->slots[slot] - 1];
+        if (record->hash == hash) {
+            record->length = end - record->offset;
+            record->first_ns = RTE_MIN(record->first_ns, ns);
+            record->last_ns = RTE_MAX(record->last_ns, ns);
+            return;
+        }
+    }
+
+    record = &buffer->flows[buffer->nb_flows++];
+    index->slots[slot] = buffer->nb_flows;
+    record->hash = hash;
+    record->offset = start;
+    record->length = end - start;
+    record->first_ns = ns;
+    record->last_ns = ns;
+}
+
+#endif
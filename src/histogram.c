@@ -0,0 +1,63 @@
+#include "histogram.h"
+
+uint64_t
+histogram_bucket_min(unsigned int bucket) {
+    unsigned int shift;
+
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+uint64_t
+histogram_percentile(const struct histogram* histogram, double q) {
+    uint64_t rank, seen = 0;
+    unsigned int b;
+
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    rank = RTE_MAX((uint64_t)(q * histogram->count + 0.5), 1UL);
+    for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) {
+            return b + 1 < HISTOGRAM_BUCKETS ? RTE_MIN(histogram_bucket_min(b + 1), histogram->max) : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static double
+cycles_to_us(uint64_t cycles) {
+    return (double)cycles * 1000000 / rte_get_tsc_hz();
+}
+
+void
+histogram_log(const char* name, const struct histogram* histogram, bool verbose) {
+    uint64_t count = histogram->count;
+    unsigned int b;
+
+    if (count == 0) {
+        LOG_INFO("%s: no samples\n", name);
+        return;
+    }
+
+    LOG_INFO("%s: %lu samples, mean %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+             name, count, cycles_to_us(histogram->sum / count), cycles_to_us(histogram_percentile(histogram, 0.5)),
+             cycles_to_us(histogram_percentile(histogram, 0.9)), cycles_to_us(histogram_percentile(histogram, 0.99)),
+             cycles_to_us(histogram_percentile(histogram, 0.999)), cycles_to_us(histogram->max));
+
+    if (!verbose) {
+        return;
+    }
+    for (b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (histogram->buckets[b]) {
+            LOG_INFO("  [%.3f, %.3f) us: %lu\n", cycles_to_us(histogram_bucket_min(b)),
+                     cycles_to_us(b + 1 < HISTOGRAM_BUCKETS ? histogram_bucket_min(b + 1) : histogram->max + 1),
+                     histogram->buckets[b]);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef DPDKCAP_HISTOGRAM_H
+#define DPDKCAP_HISTOGRAM_H
+
+#include <rte_cycles.h>
+
+#include "utils.h"
+
+/*
+ * Log-bucketed histogram of TSC cycles: values below HISTOGRAM_SUB_BUCKETS
+ * have their own bucket, and each power of two above is split into
+ * HISTOGRAM_SUB_BUCKETS buckets, so buckets are at most 12.5% wide.
+ */
+#define HISTOGRAM_SUB_BITS    3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS     ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/* Updated by a single lcore, read by the main lcore */
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+static inline unsigned int
+histogram_bucket(uint64_t cycles) {
+    unsigned int shift;
+
+    if (cycles < HISTOGRAM_SUB_BUCKETS) {
+        return cycles;
+    }
+    shift = 63 - __builtin_clzll(cycles) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((cycles >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+static inline void
+histogram_record(struct histogram* histogram, uint64_t cycles) {
+    histogram->count++;
+    histogram->sum += cycles;
+    if (unlikely(cycles > histogram->max)) {
+        histogram->max = cycles;
+    }
+    histogram->buckets[histogram_bucket(cycles)]++;
+}
+
+/* Lowest value of a bucket, in cycles */
+uint64_t histogram_bucket_min(unsigned int bucket);
+
+/* Value below which a fraction q of the values fall, in cycles (bucket upper bound) */
+uint64_t histogram_percentile(const struct histogram* histogram, double q);
+
+/*
+ * Logs the percentiles of a histogram, and its non-empty buckets when
+ * verbose, in microseconds
+ */
+void histogram_log(const char* name, const struct histogram* histogram, bool verbose);
+
+#endif
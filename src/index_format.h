@@ -0,0 +1,94 @@
+#ifndef DPDKCAP_INDEX_FORMAT_H
+#define DPDKCAP_INDEX_FORMAT_H
+
+/*
+ * On-disk format of the index sidecars of the output files, shared with the
+ * tools: plain C, without DPDK. Integers are in host byte order.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+/* A sidecar is named after its output file, followed by its suffix */
+#define FLOW_INDEX_SUFFIX  ".flows"
+#define TIME_INDEX_SUFFIX  ".times"
+
+#define FLOW_INDEX_MAGIC   "DCAPFLOW"
+#define TIME_INDEX_MAGIC   "DCAPTIME"
+#define INDEX_VERSION      1
+
+/* Seed of the CRC32C (Castagnoli, without final inversion) of the flow keys */
+#define FLOW_INDEX_SEED    0x6a09e667
+
+/* Header of a sidecar, followed by its records */
+struct index_header {
+    char magic[8];          /* FLOW_INDEX_MAGIC or TIME_INDEX_MAGIC, not terminated */
+    uint32_t version;       /* INDEX_VERSION */
+    uint32_t disk_blk_size; /* alignment of the reads of the output file */
+    uint32_t file_index;    /* index of the output file among the files of its queue */
+    uint16_t port;
+    uint16_t queue;
+    uint32_t seed;        /* FLOW_INDEX_SEED in a flow index */
+    uint32_t sample_rate; /* 1 in sample_rate packets captured, 0 when the rate adapts to the load */
+} __attribute__((packed));
+
+/*
+ * A flow within a packet buffer written into the output file: the packet
+ * records of the flow lie within [offset, offset + length)
+ */
+struct flow_index_record {
+    uint32_t hash;     /* of the flow key */
+    uint32_t length;   /* from the first packet record of the flow to the end of the last one, 0 if not written */
+    uint64_t offset;   /* of the first packet record in the output file */
+    uint64_t first_ns; /* timestamps of the packets of the flow */
+    uint64_t last_ns;
+} __attribute__((packed));
+
+/*
+ * A packet buffer written into the output file, in the order of the file:
+ * the binary search key of time ranges
+ */
+struct time_index_record {
+    uint64_t offset;   /* of the buffer in the output file */
+    uint32_t length;   /* of the buffer, including its padding, 0 if not written */
+    uint32_t packets;  /* packet records of the buffer, before its padding */
+    uint64_t first_ns; /* earliest and latest timestamps of the packets */
+    uint64_t last_ns;
+    uint32_t sample_rate; /* 1 in sample_rate packets captured into the buffer */
+} __attribute__((packed));
+
+/*
+ * Flow key, the same for both directions: the endpoint with the lower
+ * address (then port) comes first. IPv4 addresses take the first 4 bytes.
+ */
+struct flow_index_key {
+    uint8_t addrs[2][16];
+    uint16_t ports[2]; /* network order, 0 without TCP or UDP header */
+    uint8_t proto;
+    uint8_t version; /* 4 or 6 */
+    uint16_t reserved;
+};
+
+static inline void
+flow_index_key_init(struct flow_index_key* key, uint8_t version, uint8_t proto, const void* src, const void* dst,
+                    uint16_t sport, uint16_t dport) {
+    unsigned int len = version == 4 ? 4 : 16;
+    int cmp = memcmp(src, dst, len);
+
+    memset(key, 0, sizeof(*key));
+    key->version = version;
+    key->proto = proto;
+    if (cmp > 0 || (cmp == 0 && sport > dport)) {
+        memcpy(key->addrs[0], dst, len);
+        memcpy(key->addrs[1], src, len);
+        key->ports[0] = dport;
+        key->ports[1] = sport;
+    } else {
+        memcpy(key->addrs[0], src, len);
+        memcpy(key->addrs[1], dst, len);
+        key->ports[0] = sport;
+        key->ports[1] = dport;
+    }
+}
+
+#endif
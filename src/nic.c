@@ -16,13 +16,41 @@ static const struct rte_eth_conf port_conf_default = {
         },
 };
 
+/*
+ * Returns the NUMA socket of a port, or the caller's socket when unknown
+ */
+int
+port_socket_id(uint16_t port) {
+    int socket = rte_eth_dev_socket_id(port);
+
+    if (socket == SOCKET_ID_ANY) {
+        socket = rte_socket_id();
+    }
+    return socket;
+}
+
+/*
+ * Installs the flow rules of a port. Returns whether some of them must be
+ * applied in software.
+ */
+static uint16_t
+install_flow_rules(uint16_t port, const struct flow_rules* flow_rules, uint16_t rx_queues) {
+    int retval = flow_install(port, flow_rules, rx_queues);
+
+    if (retval < 0) {
+        LOG_WARN("Port %u: flow rules are applied in software\n", port);
+    }
+    return retval < (int)flow_rules->nb_rules;
+}
+
 /*
  * Initializes a given port using global settings and with the RX buffers
  * coming from the mbuf_pool passed as a parameter.
  */
 int
 port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, struct rte_mempool** mbuf_pools,
-          unsigned int flow_control) {
+          unsigned int flow_control, uint16_t* hw_timestamp, const struct flow_rules* flow_rules,
+          uint16_t* flow_software) {
     struct rte_ether_addr addr;
     struct rte_eth_conf port_conf = port_conf_default;
     struct rte_eth_dev_info dev_info;
@@ -30,9 +58,11 @@ port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, stru
     struct rte_eth_txconf txq_conf;
     struct rte_eth_fc_conf fc_conf;
     struct rte_eth_link link;
-    uint16_t socket, q, tx_queues = 0;
+    uint16_t q, tx_queues = 0;
+    int socket;
     int retval, retry = 5;
     int status = 0;
+    bool flow_early;
 
     if (flow_control) {
         tx_queues = rx_queues;
@@ -47,7 +77,7 @@ port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, stru
     }
 
     /* Get the device info and validate config*/
-    socket = rte_eth_dev_socket_id(port);
+    socket = port_socket_id(port);
     status = rte_eth_dev_info_get(port, &dev_info);
     if (status < 0) {
         LOG_ERR("Cannot get device info for port %d: %s\n", port, rte_strerror(-status));
@@ -95,6 +125,10 @@ port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, stru
         port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
         port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
         port_conf.rx_adv_conf.rss_conf.rss_hf = dev_info.flow_type_rss_offloads;
+        /* The RSS hash keys the flow sampling */
+        if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_RSS_HASH) {
+            port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_RSS_HASH;
+        }
     }
 
     /* Check if the number of requested RX descriptors is valid */
@@ -115,6 +149,16 @@ port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, stru
         port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_SCATTER;
     }
 
+    /* Enable RX timestamps */
+    if (*hw_timestamp) {
+        if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_TIMESTAMP) {
+            port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_TIMESTAMP;
+        } else {
+            LOG_WARN("Port %u does not support RX timestamps\n", port);
+            *hw_timestamp = 0;
+        }
+    }
+
     /* Configure the Ethernet device. */
     retval = rte_eth_dev_configure(port, rx_queues, tx_queues, &port_conf);
     if (retval) {
@@ -149,6 +193,14 @@ port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, stru
         }
     }
 
+    /* Drop unwanted traffic in the NIC, before it flows in when the rules are kept on a stopped port */
+    *flow_software = 0;
+    flow_early = flow_rules && (dev_info.dev_capa & RTE_ETH_DEV_CAPA_FLOW_RULE_KEEP);
+    if (flow_early) {
+        LOG_INFO("Port %u: installing the flow rules before starting the port\n", port);
+        *flow_software = install_flow_rules(port, flow_rules, rx_queues);
+    }
+
     /* Stats bindings (if more than one queue) */
     if (dev_info.max_rx_queues > 1) {
         for (q = 0; q < rx_queues; q++) {
@@ -207,5 +259,11 @@ port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, stru
         return retval;
     }
 
+    /* Otherwise, the PMD may only accept rules on a started port */
+    if (flow_rules && !flow_early) {
+        LOG_INFO("Port %u: installing the flow rules once the port is started\n", port);
+        *flow_software = install_flow_rules(port, flow_rules, rx_queues);
+    }
+
     return 0;
 }
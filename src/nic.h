@@ -3,11 +3,21 @@
 
 #include <rte_ethdev.h>
 
+#include "flow.h"
 #include "utils.h"
 
 #define TX_DESC_DEFAULT 1024
 
+int port_socket_id(uint16_t port);
+
+/*
+ * Configures and starts a port. hw_timestamp requests the RX timestamp
+ * offload, and is cleared if the port does not support it. flow_rules, if
+ * not NULL, are offloaded to the port as far as possible: flow_software is
+ * set if the capture cores must still apply them.
+ */
 int port_init(uint16_t port, const uint16_t rx_queues, unsigned int num_rxdesc, struct rte_mempool** mbuf_pools,
-              unsigned int flow_control);
+              unsigned int flow_control, uint16_t* hw_timestamp, const struct flow_rules* flow_rules,
+              uint16_t* flow_software);
 
 #endif
@@ -0,0 +1,172 @@
+#ifndef DPDKCAP_PACKET_H
+#define DPDKCAP_PACKET_H
+
+#include <netinet/in.h>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include "utils.h"
+
+#define PACKET_MAX_VLAN_TAGS 2
+
+#define ETHER_TYPE_QINQ_OLD  0x9100
+
+/* Protocol classes, from the least to the most specific */
+enum packet_class {
+    PACKET_CLASS_L2 = 0, /* Not IP, or IP header could not be parsed */
+    PACKET_CLASS_IP,     /* IP, but neither TCP nor UDP (or a non-first fragment) */
+    PACKET_CLASS_TCP,
+    PACKET_CLASS_UDP,
+    PACKET_CLASS_MAX,
+};
+
+/* Result of a packet header walk. Offsets are from the start of the frame. */
+struct packet_info {
+    uint16_t ether_type;     /* innermost EtherType (host order) */
+    uint16_t vlan_id;        /* outermost VLAN id, 0 if untagged */
+    uint8_t nb_vlans;
+    uint8_t ip_version;      /* 4, 6 or 0 if not IP */
+    uint8_t l4_proto;        /* IP protocol, 0 if not IP */
+    uint8_t class;           /* enum packet_class */
+    uint16_t l3_offset;
+    uint16_t l4_offset;
+    uint16_t payload_offset; /* end of the deepest header parsed */
+};
+
+/*
+ * Walks the L2/L3/L4 headers found in the first segment of an mbuf.
+ * Headers which do not fit in the first segment are considered absent.
+ */
+static inline void
+packet_parse(const struct rte_mbuf* mbuf, struct packet_info* info) {
+    const uint8_t* data = rte_pktmbuf_mtod(mbuf, const uint8_t*);
+    const uint16_t len = mbuf->data_len;
+    const struct rte_vlan_hdr* vlan;
+    const struct rte_ipv4_hdr* ipv4;
+    const struct rte_ipv6_hdr* ipv6;
+    const struct rte_tcp_hdr* tcp;
+    uint16_t offset, hlen;
+    uint8_t next;
+
+    memset(info, 0, sizeof(*info));
+
+    if (unlikely(len < RTE_ETHER_HDR_LEN)) {
+        info->payload_offset = len;
+        return;
+    }
+
+    info->ether_type = rte_be_to_cpu_16(((const struct rte_ether_hdr*)data)->ether_type);
+    offset = RTE_ETHER_HDR_LEN;
+
+    /* VLAN and QinQ tags */
+    while ((info->ether_type == RTE_ETHER_TYPE_VLAN || info->ether_type == RTE_ETHER_TYPE_QINQ
+            || info->ether_type == ETHER_TYPE_QINQ_OLD)
+           && info->nb_vlans < PACKET_MAX_VLAN_TAGS && offset + sizeof(struct rte_vlan_hdr) <= len) {
+        vlan = (const struct rte_vlan_hdr*)(data + offset);
+        if (!info->nb_vlans) {
+            info->vlan_id = rte_be_to_cpu_16(vlan->vlan_tci) & 0x0fff;
+        }
+        info->ether_type = rte_be_to_cpu_16(vlan->eth_proto);
+        info->nb_vlans++;
+        offset += sizeof(struct rte_vlan_hdr);
+    }
+
+    info->l3_offset = offset;
+    info->payload_offset = offset;
+
+    if (info->ether_type == RTE_ETHER_TYPE_IPV4) {
+        if (offset + sizeof(struct rte_ipv4_hdr) > len) {
+            return;
+        }
+        ipv4 = (const struct rte_ipv4_hdr*)(data + offset);
+        hlen = (ipv4->version_ihl & 0x0f) * 4;
+        if (hlen < sizeof(struct rte_ipv4_hdr) || offset + hlen > len) {
+            return;
+        }
+        info->ip_version = 4;
+        info->l4_proto = ipv4->next_proto_id;
+        info->class = PACKET_CLASS_IP;
+        offset += hlen;
+        info->payload_offset = offset;
+
+        /* Only the first fragment carries the L4 header */
+        if (rte_be_to_cpu_16(ipv4->fragment_offset) & 0x1fff) {
+            return;
+        }
+    } else if (info->ether_type == RTE_ETHER_TYPE_IPV6) {
+        if (offset + sizeof(struct rte_ipv6_hdr) > len) {
+            return;
+        }
+        ipv6 = (const struct rte_ipv6_hdr*)(data + offset);
+        info->ip_version = 6;
+        info->class = PACKET_CLASS_IP;
+        next = ipv6->proto;
+        offset += sizeof(struct rte_ipv6_hdr);
+        info->payload_offset = offset;
+
+        /* Skip the common extension headers */
+        for (;;) {
+            if (next == IPPROTO_HOPOPTS || next == IPPROTO_ROUTING || next == IPPROTO_DSTOPTS) {
+                if (offset + 8 > len) {
+                    break;
+                }
+                hlen = (data[offset + 1] + 1) * 8;
+            } else if (next == IPPROTO_AH) {
+                if (offset + 8 > len) {
+                    break;
+                }
+                hlen = (data[offset + 1] + 2) * 4;
+            } else if (next == IPPROTO_FRAGMENT) {
+                if (offset + 8 > len) {
+                    break;
+                }
+                /* Non-first fragment: no L4 header */
+                if (rte_be_to_cpu_16(*(const uint16_t*)(data + offset + 2)) & 0xfff8) {
+                    info->l4_proto = data[offset];
+                    info->payload_offset = offset + 8;
+                    return;
+                }
+                hlen = 8;
+            } else {
+                break;
+            }
+            if (offset + hlen > len) {
+                break;
+            }
+            next = data[offset];
+            offset += hlen;
+            info->payload_offset = offset;
+        }
+        info->l4_proto = next;
+    } else {
+        return;
+    }
+
+    if (info->l4_proto == IPPROTO_TCP) {
+        if (offset + sizeof(struct rte_tcp_hdr) > len) {
+            return;
+        }
+        tcp = (const struct rte_tcp_hdr*)(data + offset);
+        hlen = (tcp->data_off >> 4) * 4;
+        if (hlen < sizeof(struct rte_tcp_hdr) || offset + hlen > len) {
+            return;
+        }
+        info->class = PACKET_CLASS_TCP;
+        info->l4_offset = offset;
+        info->payload_offset = offset + hlen;
+    } else if (info->l4_proto == IPPROTO_UDP) {
+        if (offset + sizeof(struct rte_udp_hdr) > len) {
+            return;
+        }
+        info->class = PACKET_CLASS_UDP;
+        info->l4_offset = offset;
+        info->payload_offset = offset + sizeof(struct rte_udp_hdr);
+    }
+}
+
+#endif
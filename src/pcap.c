@@ -1,8 +1,23 @@
+#include <rte_cycles.h>
 #include <rte_memcpy.h>
+#include <rte_ring.h>
 #include <stdlib.h>
 
 #include "pcap.h"
 
+/* pcapng option codes */
+#define PCAPNG_OPT_ENDOFOPT   0
+#define PCAPNG_OPT_COMMENT    1
+#define PCAPNG_SHB_USERAPPL   4
+#define PCAPNG_IF_NAME        2
+#define PCAPNG_IF_DESCRIPTION 3
+#define PCAPNG_IF_TSRESOL     9
+#define PCAPNG_ISB_IFRECV     4
+#define PCAPNG_ISB_IFDROP     5
+#define PCAPNG_ISB_OSDROP     7
+
+#define BUF_AT(buf, len)      ((buf) ? (buf) + (len) : NULL)
+
 void
 add_pad_packet(struct pcap_packet_header* pkthdr, int pad_len) {
     pad_len -= sizeof(struct pcap_packet_header);
@@ -40,3 +55,196 @@ pcap_header_init(unsigned char* file_header, unsigned int snaplen, unsigned int
     unsigned int pad_len = disk_blk_size - sizeof(struct pcap_file_header);
     add_pad_packet(pkthdr, pad_len);
 }
+
+/*
+ * Pads a pcap buffer up to the next disk block boundary with a padding
+ * packet, so that the buffer only holds whole packets and can be written
+ * on its own.
+ */
+void
+pcap_buffer_pad(struct pcap_buffer* buffer, unsigned int disk_blk_size) {
+    unsigned int underrun = buffer->offset % disk_blk_size;
+
+    if (!underrun) {
+        return;
+    }
+
+    underrun = disk_blk_size - underrun;
+    /* Make room for at least a packet header */
+    if (underrun < sizeof(struct pcap_packet_header)) {
+        underrun += disk_blk_size;
+    }
+
+    memset(buffer->buffer + buffer->offset, 0, underrun);
+    add_pad_packet((struct pcap_packet_header*)(buffer->buffer + buffer->offset), underrun);
+    buffer->offset += underrun;
+}
+
+struct pcap_buffer pcap_buffer_eos;
+
+bool
+pcap_buffer_enqueue_last(struct rte_ring* ring, struct pcap_buffer* buffer) {
+    uint64_t deadline = rte_get_tsc_cycles() + PCAP_EOS_TIMEOUT_MS * rte_get_tsc_hz() / 1000;
+
+    if (buffer != PCAP_BUFFER_EOS) {
+        buffer->enqueued_at = rte_rdtsc();
+    }
+    while (!rte_ring_enqueue_bulk(ring, (void**)&buffer, 1, NULL)) {
+        if (rte_get_tsc_cycles() > deadline) {
+            return false;
+        }
+        rte_pause();
+    }
+    return true;
+}
+
+/*
+ * Writes a pcapng option into buf, if not NULL. Returns its padded length.
+ */
+static unsigned int
+pcapng_option(unsigned char* buf, uint16_t code, const void* value, uint16_t length) {
+    unsigned int padded = RTE_ALIGN_CEIL(length, 4);
+
+    if (buf) {
+        *(uint16_t*)buf = code;
+        *(uint16_t*)(buf + 2) = length;
+        memset(buf + 4, 0, padded);
+        if (length) {
+            memcpy(buf + 4, value, length);
+        }
+    }
+    return 4 + padded;
+}
+
+/*
+ * Writes the block type and total length at the start and end of a block
+ */
+static void
+pcapng_block_close(unsigned char* buf, uint32_t type, uint32_t length) {
+    if (buf) {
+        *(uint32_t*)buf = type;
+        *(uint32_t*)(buf + 4) = length;
+        *(uint32_t*)(buf + length - 4) = length;
+    }
+}
+
+unsigned int
+pcapng_header_build(unsigned char* buf, const char* application, unsigned int snaplen,
+                    const struct pcapng_interface* interfaces, unsigned int nb_interfaces) {
+    const uint8_t tsresol = 9; /* nanoseconds */
+    unsigned int len, start, i;
+
+    /* Section Header Block: type, length, byte order, version, unknown section length */
+    len = 8;
+    if (buf) {
+        *(uint32_t*)(buf + 8) = PCAPNG_BYTE_ORDER_MAGIC;
+        *(uint16_t*)(buf + 12) = 1;
+        *(uint16_t*)(buf + 14) = 0;
+        *(int64_t*)(buf + 16) = -1;
+    }
+    len += 16;
+    len += pcapng_option(BUF_AT(buf, len), PCAPNG_SHB_USERAPPL, application, strlen(application));
+    len += pcapng_option(BUF_AT(buf, len), PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    len += 4;
+    pcapng_block_close(buf, PCAPNG_BLOCK_SHB, len);
+
+    /* Interface Description Blocks: type, length, Ethernet link type, snaplen */
+    for (i = 0; i < nb_interfaces; i++) {
+        start = len;
+        if (buf) {
+            *(uint16_t*)(buf + len + 8) = 1;
+            *(uint16_t*)(buf + len + 10) = 0;
+            *(uint32_t*)(buf + len + 12) = snaplen;
+        }
+        len += 16;
+        len += pcapng_option(BUF_AT(buf, len), PCAPNG_IF_NAME, interfaces[i].name, strlen(interfaces[i].name));
+        len += pcapng_option(BUF_AT(buf, len), PCAPNG_IF_DESCRIPTION, interfaces[i].description,
+                             strlen(interfaces[i].description));
+        len += pcapng_option(BUF_AT(buf, len), PCAPNG_IF_TSRESOL, &tsresol, 1);
+        if (interfaces[i].comment[0]) {
+            len += pcapng_option(BUF_AT(buf, len), PCAPNG_OPT_COMMENT, interfaces[i].comment,
+                                 strlen(interfaces[i].comment));
+        }
+        len += pcapng_option(BUF_AT(buf, len), PCAPNG_OPT_ENDOFOPT, NULL, 0);
+        len += 4;
+        pcapng_block_close(BUF_AT(buf, start), PCAPNG_BLOCK_IDB, len - start);
+    }
+
+    return len;
+}
+
+unsigned int
+pcapng_pad_length(uint64_t len, unsigned int disk_blk_size) {
+    unsigned int pad = (disk_blk_size - len % disk_blk_size) % disk_blk_size;
+
+    if (!pad) {
+        return 0;
+    }
+
+    /* A padding block is either empty (16 bytes) or carries a comment (24 bytes and more) */
+    while (pad < PCAPNG_PAD_MIN || pad == PCAPNG_PAD_MIN + 4) {
+        pad += disk_blk_size;
+    }
+    return pad;
+}
+
+/*
+ * Pads with a Name Resolution Block holding no record, and a blank comment
+ * filling the rest of the padding
+ */
+void
+pcapng_pad(unsigned char* buf, unsigned int pad_len) {
+    unsigned int len = 8, comment_len;
+
+    *(uint32_t*)(buf + len) = 0; /* nrb_record_end */
+    len += 4;
+
+    if (pad_len > PCAPNG_PAD_MIN) {
+        comment_len = pad_len - PCAPNG_PAD_MIN - 8;
+        *(uint16_t*)(buf + len) = PCAPNG_OPT_COMMENT;
+        *(uint16_t*)(buf + len + 2) = comment_len;
+        memset(buf + len + 4, ' ', comment_len);
+        len += 4 + comment_len;
+        len += pcapng_option(buf + len, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    }
+
+    len += 4;
+    pcapng_block_close(buf, PCAPNG_BLOCK_NRB, len);
+}
+
+/*
+ * Pads a pcapng buffer up to the next disk block boundary
+ */
+void
+pcapng_buffer_pad(struct pcap_buffer* buffer, unsigned int disk_blk_size) {
+    unsigned int pad_len = pcapng_pad_length(buffer->offset, disk_blk_size);
+
+    if (pad_len) {
+        pcapng_pad(buffer->buffer + buffer->offset, pad_len);
+        buffer->offset += pad_len;
+    }
+}
+
+unsigned int
+pcapng_isb_build(unsigned char* buf, const struct pcapng_interface_stats* stats) {
+    unsigned int len = 8;
+
+    *(uint32_t*)(buf + 8) = stats->interface_id;
+    *(uint32_t*)(buf + 12) = (uint32_t)(stats->timestamp >> 32);
+    *(uint32_t*)(buf + 16) = (uint32_t)stats->timestamp;
+    len += 12;
+
+    len += pcapng_option(buf + len, PCAPNG_ISB_IFRECV, &stats->received, sizeof(uint64_t));
+    if (stats->has_drops) {
+        len += pcapng_option(buf + len, PCAPNG_ISB_IFDROP, &stats->if_dropped, sizeof(uint64_t));
+        len += pcapng_option(buf + len, PCAPNG_ISB_OSDROP, &stats->os_dropped, sizeof(uint64_t));
+    }
+    if (stats->comment) {
+        len += pcapng_option(buf + len, PCAPNG_OPT_COMMENT, stats->comment, strlen(stats->comment));
+    }
+    len += pcapng_option(buf + len, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    len += 4;
+
+    pcapng_block_close(buf, PCAPNG_BLOCK_ISB, len);
+    return len;
+}
@@ -20,14 +20,181 @@ struct pcap_packet_header {
     uint32_t packet_length_wire;
 } __rte_packed;
 
+/* Output formats */
+#define PCAP_FORMAT_PCAP          0
+#define PCAP_FORMAT_PCAPNG        1
+
+/* pcapng blocks */
+#define PCAPNG_BLOCK_SHB          0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB          0x00000001
+#define PCAPNG_BLOCK_NRB          0x00000004
+#define PCAPNG_BLOCK_ISB          0x00000005
+#define PCAPNG_BLOCK_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC   0x1A2B3C4D
+
+/* Smallest padding block: an empty Name Resolution Block */
+#define PCAPNG_PAD_MIN            16
+
+/* Enhanced Packet Block, followed by the padded data and the block length */
+struct pcapng_enhanced_packet_block {
+    uint32_t block_type;
+    uint32_t block_total_length;
+    uint32_t interface_id;
+    uint32_t timestamp_high;
+    uint32_t timestamp_low;
+    uint32_t captured_len;
+    uint32_t original_len;
+} __rte_packed;
+
+/* Longest comment of an interface, terminated */
+#define PCAPNG_COMMENT_LENGTH     96
+
+/* Description of a captured interface: a port queue */
+struct pcapng_interface {
+    char name[32];
+    char description[64];
+    char comment[PCAPNG_COMMENT_LENGTH]; /* empty for none */
+};
+
+/* Interface statistics written when closing a pcapng file */
+struct pcapng_interface_stats {
+    uint32_t interface_id;
+    uint64_t timestamp; /* nanoseconds */
+    uint64_t received;
+    uint64_t if_dropped;
+    uint64_t os_dropped;
+    bool has_drops;
+    const char* comment;
+};
+
+/* Maximum number of packets in a zero-copy pcap buffer */
+#define PCAP_BUFFER_ZC_MAX_PACKETS 65536
+
+struct rte_mbuf;
+struct flow_index_record;
+
 struct pcap_buffer {
     uint32_t offset;
     uint32_t packets;
+    uint32_t size;  /* capacity of buffer */
+    uint32_t index; /* index among all the pcap buffers */
+    uint32_t origin; /* index of the queue which fills the buffer */
+    uint32_t device; /* output device, while written with io_uring */
+    uint64_t queued_at; /* TSC, while written with io_uring */
+    int fd;             /* output file, while written with io_uring */
+    uint64_t flows_at;  /* of its records in the flow index, while written with io_uring, or UINT64_MAX */
+    uint64_t times_at;  /* of its record in the time index, while written with io_uring, or UINT64_MAX */
+    uint64_t rx_at;       /* TSC of the burst of the first packet */
+    uint64_t enqueued_at; /* TSC of the enqueue to the writing cores */
+    uint64_t first_ns;    /* earliest and latest packet timestamps */
+    uint64_t last_ns;
+    uint32_t sample_rate; /* 1 in sample_rate packets kept into the buffer */
     unsigned char* buffer;
+    /*
+     * Zero-copy mode: the buffer holds the packet headers, and mbufs[i] the
+     * data of the i-th packet. When mbufs[i] is NULL, the data was copied
+     * right after the packet header.
+     */
+    struct rte_mbuf** mbufs;
+    uint32_t nb_mbufs; /* number of non-NULL mbufs */
+    /*
+     * Flow index: one record per flow of the buffer, with offsets from the
+     * start of the buffer until the writing core adds the file offset
+     */
+    struct flow_index_record* flows;
+    uint32_t nb_flows;
 } __rte_cache_aligned;
 
+/*
+ * End of stream: enqueued by each queue after its last buffer, and forwarded
+ * by the compression cores, so that the writing cores know when they are done
+ */
+extern struct pcap_buffer pcap_buffer_eos;
+#define PCAP_BUFFER_EOS (&pcap_buffer_eos)
+
+/* Time without room in a ring before the last buffers of a queue are given up */
+#define PCAP_EOS_TIMEOUT_MS 10000
+
+struct rte_ring;
+
+/*
+ * Enqueues one of the last buffers of a queue, or its end of stream, waiting
+ * for room for up to PCAP_EOS_TIMEOUT_MS. Returns false on timeout.
+ */
+bool pcap_buffer_enqueue_last(struct rte_ring* ring, struct pcap_buffer* buffer);
+
 void add_pad_packet(struct pcap_packet_header* pkthdr, int pad_len);
 
 void pcap_header_init(unsigned char* file_header, unsigned int snaplen, unsigned int disk_blk_size);
 
+void pcap_buffer_pad(struct pcap_buffer* buffer, unsigned int disk_blk_size);
+
+/*
+ * Writes a pcapng Section Header Block and one Interface Description Block
+ * per interface into buf, if not NULL. Returns the length of the blocks.
+ */
+unsigned int pcapng_header_build(unsigned char* buf, const char* application, unsigned int snaplen,
+                                 const struct pcapng_interface* interfaces, unsigned int nb_interfaces);
+
+/* Returns the length of the padding needed after len bytes to reach a disk block boundary */
+unsigned int pcapng_pad_length(uint64_t len, unsigned int disk_blk_size);
+
+/* Writes a padding block of the given length (from pcapng_pad_length()) */
+void pcapng_pad(unsigned char* buf, unsigned int pad_len);
+
+void pcapng_buffer_pad(struct pcap_buffer* buffer, unsigned int disk_blk_size);
+
+/* Writes an Interface Statistics Block. Returns its length. */
+unsigned int pcapng_isb_build(unsigned char* buf, const struct pcapng_interface_stats* stats);
+
+/*
+ * Writes a packet record header at the start of a packet, and returns the
+ * length of the header. The packet data follows, then the record is
+ * completed with the packet trailer.
+ */
+static inline unsigned int
+pcap_packet_header_write(unsigned char* pos, uint16_t format, uint32_t interface_id, uint64_t ns, uint32_t caplen,
+                         uint32_t length) {
+    struct pcap_packet_header* header;
+    struct pcapng_enhanced_packet_block* epb;
+
+    if (format == PCAP_FORMAT_PCAPNG) {
+        epb = (struct pcapng_enhanced_packet_block*)pos;
+        epb->block_type = PCAPNG_BLOCK_EPB;
+        epb->block_total_length = sizeof(*epb) + RTE_ALIGN_CEIL(caplen, 4) + 4;
+        epb->interface_id = interface_id;
+        epb->timestamp_high = (uint32_t)(ns >> 32);
+        epb->timestamp_low = (uint32_t)ns;
+        epb->captured_len = caplen;
+        epb->original_len = length;
+        return sizeof(*epb);
+    }
+
+    header = (struct pcap_packet_header*)pos;
+    header->seconds = (uint32_t)(ns / 1000000000);
+    header->nanoseconds = (uint32_t)(ns % 1000000000);
+    header->packet_length = caplen;
+    header->packet_length_wire = length;
+    return sizeof(*header);
+}
+
+/*
+ * Writes the end of a packet record right after the packet data, and
+ * returns its length
+ */
+static inline unsigned int
+pcap_packet_trailer_write(unsigned char* pos, uint16_t format, uint32_t caplen) {
+    unsigned int pad;
+
+    if (format != PCAP_FORMAT_PCAPNG) {
+        return 0;
+    }
+
+    /* Zero the padding, then the block length */
+    pad = RTE_ALIGN_CEIL(caplen, 4) - caplen;
+    *(uint32_t*)pos = 0;
+    *(uint32_t*)(pos + pad) = sizeof(struct pcapng_enhanced_packet_block) + caplen + pad + 4;
+    return pad + 4;
+}
+
 #endif
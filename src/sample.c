@@ -0,0 +1,75 @@
+#include "sample.h"
+
+#include <errno.h>
+
+#include <rte_common.h>
+
+static const char* sample_mode_names[] = {
+    [SAMPLE_NONE] = "none",
+    [SAMPLE_COUNT] = "count",
+    [SAMPLE_RANDOM] = "random",
+    [SAMPLE_FLOW] = "flow",
+};
+
+int
+sample_parse_opt(const char* arg, struct sample_config* config) {
+    const char* rate = strchr(arg, ':');
+    unsigned long value;
+    char* end;
+    uint16_t mode;
+
+    if (!rate) {
+        return -EINVAL;
+    }
+    for (mode = SAMPLE_COUNT; mode <= SAMPLE_FLOW; mode++) {
+        if (strlen(sample_mode_names[mode]) == (size_t)(rate - arg)
+            && !strncmp(arg, sample_mode_names[mode], rate - arg)) {
+            break;
+        }
+    }
+    if (mode > SAMPLE_FLOW) {
+        return -EINVAL;
+    }
+    config->mode = mode;
+    rate++;
+
+    config->adaptive = !strncmp(rate, "auto", 4) && (rate[4] == '\0' || rate[4] == ':');
+    if (config->adaptive) {
+        config->rate = SAMPLE_RATE_MAX_DEFAULT;
+        if (rate[4] == '\0') {
+            return 0;
+        }
+        rate += 5;
+    }
+
+    errno = 0;
+    value = strtoul(rate, &end, 10);
+    if (errno || *end || end == rate || value == 0 || value > UINT32_MAX) {
+        return -EINVAL;
+    }
+    /* Adaptive rates are powers of 2 */
+    if (config->adaptive && value > 1UL << 31) {
+        return -EINVAL;
+    }
+    config->rate = config->adaptive ? rte_align32pow2(value) : value;
+    return 0;
+}
+
+void
+sample_describe(const struct sample_config* config, char* buf, size_t len) {
+    if (config->mode == SAMPLE_NONE) {
+        snprintf(buf, len, "Not sampled");
+    } else if (config->adaptive) {
+        snprintf(buf, len, "Sampled by %s, 1 in 1 to %u packets depending on load", sample_mode_names[config->mode],
+                 config->rate);
+    } else {
+        snprintf(buf, len, "Sampled by %s, 1 in %u packets", sample_mode_names[config->mode], config->rate);
+    }
+}
+
+void
+sample_init(struct sample* sample, const struct sample_config* config) {
+    sample->mode = config->mode;
+    sample->rate_max = config->rate;
+    sample_set_rate(sample, config->adaptive ? 1 : config->rate);
+}
@@ -0,0 +1,138 @@
+#ifndef DPDKCAP_SAMPLE_H
+#define DPDKCAP_SAMPLE_H
+
+#include <rte_hash_crc.h>
+#include <rte_mbuf.h>
+#include <rte_random.h>
+
+#include "flow_index.h"
+#include "utils.h"
+
+/* Sampling modes, keeping 1 in rate packets */
+#define SAMPLE_NONE             0
+#define SAMPLE_COUNT            1 /* every rate-th packet of the queue */
+#define SAMPLE_RANDOM           2 /* each packet with a probability of 1 / rate */
+#define SAMPLE_FLOW             3 /* all the packets of 1 in rate flows, or none */
+
+/* Highest rate of the adaptive sampling, by default */
+#define SAMPLE_RATE_MAX_DEFAULT 1024
+
+/*
+ * Adaptive sampling: the rate doubles when fewer than SAMPLE_FREE_LOW
+ * eighths of the buffers of the queue are free once a buffer is taken, and
+ * halves when more than SAMPLE_FREE_HIGH eighths are
+ */
+#define SAMPLE_FREE_LOW         2
+#define SAMPLE_FREE_HIGH        6
+
+#define SAMPLE_SEED             0x510e527f
+
+/* Packet sampling, enabled when mode is not SAMPLE_NONE */
+struct sample_config {
+    uint16_t mode;     /* SAMPLE_* */
+    uint16_t adaptive; /* the rate follows the free buffers of the queue, from 1 up to rate */
+    uint32_t rate;     /* 1 in rate packets kept, a power of 2 when adaptive */
+};
+
+struct sample {
+    uint16_t mode;
+    uint32_t rate;
+    uint32_t rate_max;  /* rate when not adaptive */
+    uint32_t count;     /* packets left out since the last one kept, for SAMPLE_COUNT */
+    uint64_t threshold; /* 2^32 / rate: the 32-bit hashes and random numbers below are kept */
+};
+
+/* Parses "MODE:RATE" or "MODE:auto[:MAX]", MODE being count, random or flow */
+int sample_parse_opt(const char* arg, struct sample_config* config);
+
+/* Describes a sampling configuration, e.g. for the pcapng interface comments */
+void sample_describe(const struct sample_config* config, char* buf, size_t len);
+
+/* Starts at the configured rate, or at 1 when adaptive */
+void sample_init(struct sample* sample, const struct sample_config* config);
+
+static inline void
+sample_set_rate(struct sample* sample, uint32_t rate) {
+    sample->rate = rate;
+    sample->threshold = (1ULL << 32) / rate;
+    sample->count = 0;
+}
+
+/*
+ * Adjusts an adaptive rate to the free buffers of the queue, once a buffer
+ * is taken. The rates are powers of 2, so the flows kept at a rate are kept
+ * at the lower rates. Returns true when the rate changed.
+ */
+static inline bool
+sample_adapt(struct sample* sample, uint32_t nb_free, uint32_t nb_pbufs) {
+    uint32_t rate = sample->rate;
+
+    if (nb_free * 8 < nb_pbufs * SAMPLE_FREE_LOW && rate < sample->rate_max) {
+        rate *= 2;
+    } else if (nb_free * 8 > nb_pbufs * SAMPLE_FREE_HIGH && rate > 1) {
+        rate /= 2;
+    }
+    if (rate == sample->rate) {
+        return false;
+    }
+    sample_set_rate(sample, rate);
+    return true;
+}
+
+/*
+ * Hash of the flow of a packet. The RSS hash is mixed, since its low bits
+ * picked the queue and are much the same for all the packets of the queue.
+ * Without RSS hash, the software flow key hash is used, which is the same
+ * for both directions; non-IP packets are then all in the same flow.
+ */
+static inline uint32_t
+sample_flow_hash(const struct rte_mbuf* mbuf) {
+    uint32_t hash = 0;
+
+    if (mbuf->ol_flags & RTE_MBUF_F_RX_RSS_HASH) {
+        return rte_hash_crc_4byte(mbuf->hash.rss, SAMPLE_SEED);
+    }
+    flow_index_hash(mbuf, &hash);
+    return hash;
+}
+
+static inline bool
+sample_keep(struct sample* sample, const struct rte_mbuf* mbuf) {
+    switch (sample->mode) {
+        case SAMPLE_COUNT:
+            if (++sample->count < sample->rate) {
+                return false;
+            }
+            sample->count = 0;
+            return true;
+        case SAMPLE_RANDOM: return (rte_rand() >> 32) < sample->threshold;
+        default: return sample_flow_hash(mbuf) < sample->threshold;
+    }
+}
+
+/*
+ * Leaves out the packets of a burst not sampled. The kept mbufs are moved
+ * to the front of bufs, the others are freed. Returns the number of kept
+ * mbufs.
+ */
+static inline uint16_t
+sample_burst(struct sample* sample, struct rte_mbuf** bufs, uint16_t nb_rx) {
+    struct rte_mbuf* left_out[nb_rx];
+    uint16_t i, nb_kept = 0, nb_left_out = 0;
+
+    for (i = 0; i < nb_rx; i++) {
+        if (sample_keep(sample, bufs[i])) {
+            bufs[nb_kept++] = bufs[i];
+        } else {
+            left_out[nb_left_out++] = bufs[i];
+        }
+    }
+
+    if (nb_left_out) {
+        rte_pktmbuf_free_bulk(left_out, nb_left_out);
+    }
+
+    return nb_kept;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#include <errno.h>
+
+#include <rte_string_fns.h>
+
+#include "slice.h"
+
+static const char* slice_class_names[PACKET_CLASS_MAX] = {
+    [PACKET_CLASS_L2] = "l2",
+    [PACKET_CLASS_IP] = "ip",
+    [PACKET_CLASS_TCP] = "tcp",
+    [PACKET_CLASS_UDP] = "udp",
+};
+
+int
+slice_parse_opt(const char* arg, struct slice_config* slice) {
+    char buf[128];
+    char* tokens[PACKET_CLASS_MAX + 1];
+    char* value;
+    char* end;
+    unsigned long bytes;
+    int nb_tokens, i, c;
+
+    memset(slice, 0, sizeof(*slice));
+    slice->enabled = 1;
+
+    if (!strcmp(arg, SLICE_POLICY_HEADERS)) {
+        return 0;
+    }
+
+    if (strlen(arg) >= sizeof(buf)) {
+        return -EINVAL;
+    }
+    strcpy(buf, arg);
+
+    nb_tokens = rte_strsplit(buf, strlen(buf), tokens, PACKET_CLASS_MAX + 1, ',');
+    if (nb_tokens < 1 || nb_tokens > PACKET_CLASS_MAX) {
+        return -EINVAL;
+    }
+
+    for (i = 0; i < nb_tokens; i++) {
+        value = strchr(tokens[i], '=');
+        if (!value) {
+            return -EINVAL;
+        }
+        *value++ = '\0';
+
+        errno = 0;
+        bytes = strtoul(value, &end, 10);
+        if (errno || *end != '\0' || bytes > UINT16_MAX) {
+            return -EINVAL;
+        }
+
+        for (c = 0; c < PACKET_CLASS_MAX; c++) {
+            if (!strcmp(tokens[i], slice_class_names[c])) {
+                break;
+            }
+        }
+        if (c == PACKET_CLASS_MAX) {
+            return -EINVAL;
+        }
+        slice->payload[c] = bytes;
+    }
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef DPDKCAP_SLICE_H
+#define DPDKCAP_SLICE_H
+
+#include <rte_mbuf.h>
+
+#include "packet.h"
+#include "utils.h"
+
+#define SLICE_POLICY_HEADERS "headers"
+
+/* Header-only slicing policy */
+struct slice_config {
+    uint16_t enabled;
+    uint16_t payload[PACKET_CLASS_MAX]; /* payload bytes kept after the headers */
+};
+
+/*
+ * Parses a slicing policy. The policy is either "headers" (keep headers
+ * only) or a list of <class>=<bytes> with class in l2, ip, tcp, udp.
+ * Classes which are not listed keep no payload.
+ */
+int slice_parse_opt(const char* arg, struct slice_config* slice);
+
+/*
+ * Returns the number of bytes to capture from a packet, given the
+ * slicing policy and the upper bound caplen (packet length or snaplen).
+ */
+static inline uint32_t
+slice_length(const struct rte_mbuf* mbuf, const struct slice_config* slice, uint32_t caplen) {
+    struct packet_info info;
+    uint32_t len;
+
+    packet_parse(mbuf, &info);
+    len = info.payload_offset + slice->payload[info.class];
+
+    return RTE_MIN(len, caplen);
+}
+
+#endif
@@ -14,7 +14,7 @@ print_stats(__attribute__((unused)) struct rte_timer* timer, struct stats_data*
 
     nb_stat_update++;
 
-    for (i = 0; i < data->nb_queues; i++) {
+    for (i = 0; i < data->nb_write_cores; i++) {
         total_packets += data->write_core_stats[i].packets;
         total_bytes += data->write_core_stats[i].bytes;
     }
@@ -27,11 +27,34 @@ print_stats(__attribute__((unused)) struct rte_timer* timer, struct stats_data*
     printf("Total bytes written: %s\n", bytes_format(total_bytes));
 
     printf("-- PER WRITING CORE --\n");
-    for (i = 0; i < data->nb_queues; i++) {
+    for (i = 0; i < data->nb_write_cores; i++) {
         printf("Writing core %d: %s ", data->write_core_stats[i].core_id, data->write_core_stats[i].output_file);
         printf("(%s)\n", bytes_format(data->write_core_stats[i].current_file_bytes));
     }
 
+    if (data->nb_devices) {
+        printf("-- PER OUTPUT DIRECTORY --\n");
+    }
+    for (i = 0; i < data->nb_devices; i++) {
+        const struct output_device* dev = &data->devices[i];
+
+        printf("Output directory %s (weight %u): %s, ", dev->dir, dev->weight, bytes_format(dev->bytes));
+        printf("%lu demotions, %lu errors%s\n", dev->demotions, dev->errors, dev->full ? ", FULL" : "");
+    }
+
+    if (data->nb_compress_cores) {
+        printf("-- PER COMPRESSION CORE --\n");
+    }
+    for (i = 0; i < data->nb_compress_cores; i++) {
+        const struct compress_core_stats* cs = &data->compress_core_stats[i];
+
+        printf("Compression core %d (port %d): %s in, ", cs->core_id, cs->port, bytes_format(cs->bytes_in));
+        printf("%s out, ratio %.2f, ", bytes_format(cs->bytes_out),
+               cs->bytes_out ? (double)cs->bytes_in / cs->bytes_out : 0.);
+        printf("%s/s while busy, %lu errors\n",
+               bytes_format(cs->cycles ? cs->bytes_in * rte_get_tsc_hz() / cs->cycles : 0), cs->errors);
+    }
+
     printf("-- PER PORT --\n");
     for (i = 0; i < data->nb_ports; i++) {
         rte_eth_stats_get(data->port_list[i], &port_stats);
@@ -46,7 +69,28 @@ print_stats(__attribute__((unused)) struct rte_timer* timer, struct stats_data*
                port_stats.ierrors, port_stats.imissed, port_stats.rx_nombuf);
         printf("Per queue:\n");
         for (j = 0; j < data->nb_queues_per_port; j++) {
+            const struct capture_core_stats* cs = &data->capture_core_stats[i * data->nb_queues_per_port + j];
+
             printf("  Queue %d RX: %lu RX-Error: %lu\n", j, port_stats.q_ipackets[j], port_stats.q_errors[j]);
+            printf("    Stalls: full ring %lu (%lu ms), no free buffer %lu (%lu ms), fewest free buffers: %u\n",
+                   cs->full_ring_stalls, cs->full_ring_stall_cycles * 1000 / rte_get_tsc_hz(), cs->free_ring_stalls,
+                   cs->free_ring_stall_cycles * 1000 / rte_get_tsc_hz(),
+                   cs->free_pbufs_low == UINT32_MAX ? 0 : cs->free_pbufs_low);
+            if (cs->duplicates) {
+                printf("    Duplicates dropped: %lu\n", cs->duplicates);
+            }
+            if (cs->sample_rate) {
+                printf("    Sampling: 1 in %u, left out %lu\n", cs->sample_rate, cs->sampled_out);
+            }
+            if (cs->history_buffers || cs->dumped_buffers) {
+                printf("    Flight recorder: %lu buffers kept, %lu dumped, %lu evicted\n", cs->history_buffers,
+                       cs->dumped_buffers, cs->evicted_buffers);
+            }
+            if (cs->overload_episodes) {
+                printf("    Overloads: %lu (%lu ms), dropped %lu (%s), truncated %lu\n", cs->overload_episodes,
+                       cs->overload_cycles * 1000 / rte_get_tsc_hz(), cs->shed_packets, bytes_format(cs->shed_bytes),
+                       cs->truncated_packets);
+            }
         }
         printf("  (%d queues hidden)\n", RTE_ETHDEV_QUEUE_STAT_CNTRS - data->nb_queues_per_port);
     }
@@ -8,6 +8,7 @@
 #include <rte_timer.h>
 
 #include "core_capture.h"
+#include "core_compress.h"
 #include "core_write.h"
 #include "utils.h"
 
@@ -18,8 +19,14 @@ struct stats_data {
     uint16_t* port_list;
     struct write_core_stats* write_core_stats;
     struct capture_core_stats* capture_core_stats;
+    struct compress_core_stats* compress_core_stats;
+    uint16_t nb_compress_cores;
     uint16_t nb_ports;
     uint16_t nb_queues;
+    uint16_t nb_write_cores;
+    bool shared_writers;
+    struct output_device* devices; /* NULL unless striping */
+    uint16_t nb_devices;
     uint16_t nb_queues_per_port;
     char* log_file;
 } __rte_cache_aligned;
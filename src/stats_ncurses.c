@@ -5,6 +5,8 @@
 static uint64_t* last_per_cap_core_pkts;
 static uint64_t* last_per_wr_core_pkts;
 static uint64_t* last_per_wr_core_bytes;
+static uint64_t* last_per_cmp_core_bytes;
+static uint64_t* last_per_device_bytes;
 
 static void
 wcapture_stats(WINDOW* window, struct stats_data* data) {
@@ -30,8 +32,52 @@ wcapture_stats(WINDOW* window, struct stats_data* data) {
             wprintw(window, "      SW: RX: %s", ul_format(data->capture_core_stats[j].packets));
             wprintw(window, "    Buffer: %s\n", ul_format(data->capture_core_stats[j].buffer_packets));
 
-            wprintw(window, "      Buffers Free: %s\n",
+            wprintw(window, "      Buffers Free: %s",
                     ul_format(rte_ring_count(data->capture_core_stats[j].pbuf_free_ring)));
+            if (data->capture_core_stats[j].free_pbufs_low != UINT32_MAX) {
+                wprintw(window, "  Lowest: %s", ul_format(data->capture_core_stats[j].free_pbufs_low));
+            }
+            wprintw(window, "\n");
+
+            wprintw(window, "      Stalls: Full ring: %s", ul_format(data->capture_core_stats[j].full_ring_stalls));
+            wprintw(window, " (%s ms)",
+                    ul_format(data->capture_core_stats[j].full_ring_stall_cycles * 1000 / rte_get_tsc_hz()));
+            wprintw(window, "  No buffer: %s", ul_format(data->capture_core_stats[j].free_ring_stalls));
+            wprintw(window, " (%s ms)\n",
+                    ul_format(data->capture_core_stats[j].free_ring_stall_cycles * 1000 / rte_get_tsc_hz()));
+
+            if (data->capture_core_stats[j].history_buffers || data->capture_core_stats[j].dumped_buffers) {
+                wprintw(window, "      History: %s", ul_format(data->capture_core_stats[j].history_buffers));
+                wprintw(window, "  Dumped: %s", ul_format(data->capture_core_stats[j].dumped_buffers));
+                wprintw(window, "  Evicted: %s\n", ul_format(data->capture_core_stats[j].evicted_buffers));
+            }
+
+            if (data->capture_core_stats[j].overload_episodes) {
+                wprintw(window, "      Overloads: %s", ul_format(data->capture_core_stats[j].overload_episodes));
+                wprintw(window, " (%s ms)",
+                        ul_format(data->capture_core_stats[j].overload_cycles * 1000 / rte_get_tsc_hz()));
+                wprintw(window, "  Dropped: %s", ul_format(data->capture_core_stats[j].shed_packets));
+                wprintw(window, "  Truncated: %s\n", ul_format(data->capture_core_stats[j].truncated_packets));
+            }
+
+            if (data->capture_core_stats[j].filtered) {
+                wprintw(window, "      Filtered: %s\n", ul_format(data->capture_core_stats[j].filtered));
+            }
+
+            if (data->capture_core_stats[j].duplicates) {
+                wprintw(window, "      Duplicates: %s\n", ul_format(data->capture_core_stats[j].duplicates));
+            }
+
+            if (data->capture_core_stats[j].sample_rate) {
+                wprintw(window, "      Sampling: 1 in %u", data->capture_core_stats[j].sample_rate);
+                wprintw(window, "  Left out: %s\n", ul_format(data->capture_core_stats[j].sampled_out));
+            }
+
+            if (data->capture_core_stats[j].zc_packets || data->capture_core_stats[j].zc_copied) {
+                wprintw(window, "      Zero-copy: %s", ul_format(data->capture_core_stats[j].zc_packets));
+                wprintw(window, "  Copied: %s", ul_format(data->capture_core_stats[j].zc_copied));
+                wprintw(window, "  Held mbufs: %s\n", ul_format(data->capture_core_stats[j].zc_held));
+            }
 
             uint64_t pframes = data->capture_core_stats[j].pause_frames;
             if (pframes == ~0UL) {
@@ -54,16 +100,26 @@ wcapture_stats(WINDOW* window, struct stats_data* data) {
 static void
 wwrite_stats(WINDOW* window, struct stats_data* data) {
     uint64_t total_packets, total_bytes;
-    unsigned int i, j;
+    unsigned int i, j, first, last;
+    /* Writing cores shared by all the queues are shown as a single group */
+    bool shared = data->shared_writers;
 
     // Calculate aggregated stats from writing cores
-    for (i = 0; i < data->nb_ports; i++) {
+    for (i = 0; i < (shared ? 1U : data->nb_ports); i++) {
         total_packets = 0;
         total_bytes = 0;
 
-        wprintw(window, "PORT %d:\n", data->port_list[i]);
+        if (shared) {
+            first = 0;
+            last = data->nb_write_cores;
+            wprintw(window, "ALL PORTS:\n");
+        } else {
+            first = i * data->nb_queues_per_port;
+            last = (i + 1) * data->nb_queues_per_port;
+            wprintw(window, "PORT %d:\n", data->port_list[i]);
+        }
 
-        for (j = i * data->nb_queues_per_port; j < (i + 1) * data->nb_queues_per_port; j++) {
+        for (j = first; j < last; j++) {
             total_packets += data->write_core_stats[j].packets;
             total_bytes += data->write_core_stats[j].bytes;
         }
@@ -71,8 +127,12 @@ wwrite_stats(WINDOW* window, struct stats_data* data) {
         wprintw(window, "  Total packets written: %s\n", ul_format(total_packets));
         wprintw(window, "  Total bytes written: %s\n", bytes_format(total_bytes));
 
-        for (j = i * data->nb_queues_per_port; j < (i + 1) * data->nb_queues_per_port; j++) {
-            wprintw(window, "  - Queue %2d handled by core %2d:\n", j, data->write_core_stats[j].core_id);
+        for (j = first; j < last; j++) {
+            if (shared) {
+                wprintw(window, "  - Writing core %2d:\n", data->write_core_stats[j].core_id);
+            } else {
+                wprintw(window, "  - Queue %2d handled by core %2d:\n", j, data->write_core_stats[j].core_id);
+            }
 
             wprintw(window, "      Buffers Pending: %s\n",
                     ul_format(rte_ring_count(data->write_core_stats[j].pbuf_full_ring)));
@@ -96,6 +156,52 @@ wwrite_stats(WINDOW* window, struct stats_data* data) {
     }
 }
 
+static void
+wcompress_stats(WINDOW* window, struct stats_data* data) {
+    unsigned int i;
+
+    for (i = 0; i < data->nb_compress_cores; i++) {
+        const struct compress_core_stats* cs = &data->compress_core_stats[i];
+
+        wprintw(window, "COMPRESSION CORE %d (port %d):\n", cs->core_id, cs->port);
+        wprintw(window, "  In: %s", bytes_format(cs->bytes_in));
+        wprintw(window, "  Out: %s", bytes_format(cs->bytes_out));
+        wprintw(window, "  Ratio: %.2f\n", cs->bytes_out ? (double)cs->bytes_in / cs->bytes_out : 0.);
+        wprintw(window, "  Bytes/s: %s",
+                ul_format((cs->bytes_in - last_per_cmp_core_bytes[i]) * 1000 / STATS_PERIOD_MS));
+        wprintw(window, "  Busy: %s/s\n",
+                bytes_format(cs->cycles ? cs->bytes_in * rte_get_tsc_hz() / cs->cycles : 0));
+        if (cs->errors) {
+            wprintw(window, "  Errors: %s\n", ul_format(cs->errors));
+        }
+
+        last_per_cmp_core_bytes[i] = cs->bytes_in;
+
+        wprintw(window, "\n");
+    }
+}
+
+static void
+wdevice_stats(WINDOW* window, struct stats_data* data) {
+    unsigned int i;
+
+    for (i = 0; i < data->nb_devices; i++) {
+        const struct output_device* dev = &data->devices[i];
+
+        wprintw(window, "OUTPUT DIRECTORY %s (weight %u)%s:\n", dev->dir, dev->weight, dev->full ? " FULL" : "");
+        wprintw(window, "  Bytes: %s", bytes_format(dev->bytes));
+        wprintw(window, "  Bytes/s: %s\n", ul_format((dev->bytes - last_per_device_bytes[i]) * 1000 / STATS_PERIOD_MS));
+        if (dev->demotions || dev->errors) {
+            wprintw(window, "  Demotions: %s", ul_format(dev->demotions));
+            wprintw(window, "  Errors: %s\n", ul_format(dev->errors));
+        }
+
+        last_per_device_bytes[i] = dev->bytes;
+
+        wprintw(window, "\n");
+    }
+}
+
 static WINDOW *border_write, *border_capture;
 static WINDOW *window_write, *window_capture;
 
@@ -148,6 +254,8 @@ printscreen(__attribute__((unused)) struct rte_timer* timer, __attribute__((unus
     box(border_capture, 0, 0);
     mvwprintw(border_capture, 0, 2, "Capture stats");
 
+    wcompress_stats(window_write, data);
+    wdevice_stats(window_write, data);
     wwrite_stats(window_write, data);
     wcapture_stats(window_capture, data);
 
@@ -164,8 +272,10 @@ start_stats_display(struct stats_data* data, bool volatile* stop_condition) {
     int ch;
 
     last_per_cap_core_pkts = calloc(data->nb_queues, sizeof(uint64_t));
-    last_per_wr_core_pkts = calloc(data->nb_queues, sizeof(uint64_t));
-    last_per_wr_core_bytes = calloc(data->nb_queues, sizeof(uint64_t));
+    last_per_wr_core_pkts = calloc(data->nb_write_cores, sizeof(uint64_t));
+    last_per_wr_core_bytes = calloc(data->nb_write_cores, sizeof(uint64_t));
+    last_per_cmp_core_bytes = calloc(data->nb_compress_cores, sizeof(uint64_t));
+    last_per_device_bytes = calloc(data->nb_devices, sizeof(uint64_t));
 
     initscr();
     cbreak();
@@ -205,4 +315,6 @@ start_stats_display(struct stats_data* data, bool volatile* stop_condition) {
     free(last_per_cap_core_pkts);
     free(last_per_wr_core_pkts);
     free(last_per_wr_core_bytes);
+    free(last_per_cmp_core_bytes);
+    free(last_per_device_bytes);
 }
@@ -0,0 +1,86 @@
+#include "stripe.h"
+
+#include <errno.h>
+
+#include <rte_lcore.h>
+
+int
+stripe_parse_opt(char* arg, struct output_device* devices) {
+    char *saveptr, *token, *sep, *end;
+    unsigned long weight;
+    int nb_devices = 0;
+
+    for (token = strtok_r(arg, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+        if (nb_devices == STRIPE_MAX_DEVICES) {
+            return -E2BIG;
+        }
+
+        weight = STRIPE_WEIGHT_DEFAULT;
+        sep = strrchr(token, ':');
+        if (sep) {
+            errno = 0;
+            weight = strtoul(sep + 1, &end, 10);
+            if (errno || end == sep + 1 || *end != '\0' || weight == 0 || weight > UINT16_MAX) {
+                return -EINVAL;
+            }
+            *sep = '\0';
+        }
+        if (*token == '\0') {
+            return -EINVAL;
+        }
+
+        devices[nb_devices].dir = token;
+        devices[nb_devices].weight = weight;
+        nb_devices++;
+    }
+    return nb_devices ? nb_devices : -EINVAL;
+}
+
+void
+stripe_init(struct stripe* stripe, struct output_device* devices, unsigned int nb_devices) {
+    memset(stripe, 0, sizeof(*stripe));
+    stripe->devices = devices;
+    stripe->nb_devices = nb_devices;
+}
+
+void
+stripe_complete(struct stripe* stripe, unsigned int device, uint64_t cycles, int result) {
+    struct output_device* dev = &stripe->devices[device];
+    struct stripe_state* state = &stripe->states[device];
+    uint64_t sample, cheapest = 0;
+    unsigned int d;
+
+    if (unlikely(result < 0)) {
+        __atomic_fetch_add(&dev->errors, 1, __ATOMIC_RELAXED);
+        /* A single device keeps being retried, as space may be freed */
+        if (result == -ENOSPC && stripe->nb_devices > 1 && !dev->full) {
+            dev->full = true;
+            LOG_ERR("Output device %s is full, no longer writing to it\n", dev->dir);
+        }
+        return;
+    }
+    __atomic_fetch_add(&dev->bytes, result, __ATOMIC_RELAXED);
+
+    if (stripe->nb_devices == 1 || result < 1024) {
+        return;
+    }
+
+    sample = cycles / (result / 1024);
+    state->cost = state->cost ? (state->cost * STRIPE_COST_HISTORY + sample) / (STRIPE_COST_HISTORY + 1) : sample;
+
+    for (d = 0; d < stripe->nb_devices; d++) {
+        if (d != device && stripe->states[d].cost && !stripe->devices[d].full
+            && (!cheapest || stripe->states[d].cost < cheapest)) {
+            cheapest = stripe->states[d].cost;
+        }
+    }
+
+    if (cheapest && state->cost > cheapest * STRIPE_SLOW_FACTOR) {
+        /* Measured again from scratch once the demotion expires */
+        state->cost = 0;
+        state->demoted_until = rte_rdtsc() + rte_get_tsc_hz() / 1000 * STRIPE_DEMOTE_MS;
+        __atomic_fetch_add(&dev->demotions, 1, __ATOMIC_RELAXED);
+        LOG_WARN("Output device %s is slow, core %u demotes it for %u ms\n", dev->dir, rte_lcore_id(),
+                 STRIPE_DEMOTE_MS);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef DPDKCAP_STRIPE_H
+#define DPDKCAP_STRIPE_H
+
+#include <rte_cycles.h>
+
+#include "utils.h"
+
+#define STRIPE_MAX_DEVICES      16
+#define STRIPE_WEIGHT_DEFAULT   1
+
+/* A device is demoted when its writes cost this many times the cheapest device's */
+#define STRIPE_SLOW_FACTOR      4
+#define STRIPE_DEMOTE_MS        1000
+
+/* Weight of the previous average in the write cost average, out of 8 */
+#define STRIPE_COST_HISTORY     7
+
+/*
+ * An output device (a directory on its own drive). Devices are shared by all
+ * the writing cores, which update the counters atomically.
+ */
+struct output_device {
+    const char* dir;
+    char* template; /* output template within dir */
+    unsigned int weight;
+    bool volatile full;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t demotions;
+};
+
+/* Striping state of a device, private to a writing core */
+struct stripe_state {
+    int64_t current;        /* smooth weighted round robin */
+    uint64_t cost;          /* average write cycles per KiB, 0 until measured */
+    uint64_t demoted_until; /* TSC */
+};
+
+/* Spreads the buffers of a writing core over the devices */
+struct stripe {
+    struct output_device* devices;
+    unsigned int nb_devices;
+    struct stripe_state states[STRIPE_MAX_DEVICES];
+};
+
+/*
+ * Parses a list of DIR[:WEIGHT] separated by ','. Returns the number of
+ * devices, or a negative value on error.
+ */
+int stripe_parse_opt(char* arg, struct output_device* devices);
+
+void stripe_init(struct stripe* stripe, struct output_device* devices, unsigned int nb_devices);
+
+/*
+ * Accounts for a write to a device which took the given number of cycles,
+ * result being the number of bytes written or a negative errno. Full
+ * devices are dropped, and devices much slower than the others are demoted
+ * for STRIPE_DEMOTE_MS.
+ */
+void stripe_complete(struct stripe* stripe, unsigned int device, uint64_t cycles, int result);
+
+static inline int
+stripe_pick(struct stripe* stripe, uint64_t now, bool demoted) {
+    struct stripe_state* state;
+    int64_t total = 0;
+    unsigned int d;
+    int best = -1;
+
+    for (d = 0; d < stripe->nb_devices; d++) {
+        state = &stripe->states[d];
+        if (stripe->devices[d].full || (!demoted && now < state->demoted_until)) {
+            continue;
+        }
+        state->current += stripe->devices[d].weight;
+        total += stripe->devices[d].weight;
+        if (best < 0 || state->current > stripe->states[best].current) {
+            best = d;
+        }
+    }
+
+    if (best >= 0) {
+        stripe->states[best].current -= total;
+    }
+    return best;
+}
+
+/*
+ * Picks the device of the next buffer by smooth weighted round robin, among
+ * the devices which are neither full nor demoted. Demoted devices are still
+ * used when no other device is left. Returns -1 when all devices are full.
+ */
+static inline int
+stripe_next(struct stripe* stripe, uint64_t now) {
+    int device;
+
+    if (likely(stripe->nb_devices == 1)) {
+        return 0;
+    }
+
+    device = stripe_pick(stripe, now, false);
+    if (unlikely(device < 0)) {
+        device = stripe_pick(stripe, now, true);
+    }
+    return device;
+}
+
+#endif
@@ -0,0 +1,830 @@
+#define _GNU_SOURCE
+#include "telemetry.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <rte_telemetry.h>
+#include <rte_version.h>
+
+#if RTE_VERSION < RTE_VERSION_NUM(23, 3, 0, 0)
+#define rte_tel_data_add_dict_uint rte_tel_data_add_dict_u64
+#endif
+
+#define METRICS_TIMEOUT_MS 100
+
+/* Read by the telemetry thread, NULL once the capture is over */
+static struct stats_data* volatile tel_data;
+
+static int metrics_fd = -1;
+static pthread_t metrics_thread;
+static volatile bool metrics_stop;
+static char metrics_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+/*
+ * rte_telemetry commands
+ */
+
+static int
+tel_capture(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct stats_data* data = tel_data;
+    struct rte_tel_data* queue;
+    char name[32];
+    unsigned int i;
+
+    if (!data) {
+        return -EINVAL;
+    }
+
+    rte_tel_data_start_dict(d);
+    for (i = 0; i < data->nb_queues; i++) {
+        const struct capture_core_stats* cs = &data->capture_core_stats[i];
+
+        queue = rte_tel_data_alloc();
+        if (!queue) {
+            return -ENOMEM;
+        }
+        rte_tel_data_start_dict(queue);
+        rte_tel_data_add_dict_uint(queue, "port", data->port_list[i / data->nb_queues_per_port]);
+        rte_tel_data_add_dict_uint(queue, "queue", i % data->nb_queues_per_port);
+        rte_tel_data_add_dict_uint(queue, "core", cs->core_id);
+        rte_tel_data_add_dict_uint(queue, "packets", cs->packets);
+        rte_tel_data_add_dict_uint(queue, "filtered", cs->filtered);
+        if (cs->pause_frames != ~0UL) {
+            rte_tel_data_add_dict_uint(queue, "pause_frames", cs->pause_frames);
+        }
+        rte_tel_data_add_dict_uint(queue, "duplicates", cs->duplicates);
+        if (cs->sample_rate) {
+            rte_tel_data_add_dict_uint(queue, "sampled_out", cs->sampled_out);
+            rte_tel_data_add_dict_uint(queue, "sample_rate", cs->sample_rate);
+        }
+        rte_tel_data_add_dict_uint(queue, "zc_packets", cs->zc_packets);
+        rte_tel_data_add_dict_uint(queue, "zc_copied", cs->zc_copied);
+        rte_tel_data_add_dict_uint(queue, "zc_held", cs->zc_held);
+        rte_tel_data_add_dict_uint(queue, "free_pbufs", rte_ring_count(cs->pbuf_free_ring));
+        if (cs->free_pbufs_low != UINT32_MAX) {
+            rte_tel_data_add_dict_uint(queue, "free_pbufs_low", cs->free_pbufs_low);
+        }
+        rte_tel_data_add_dict_uint(queue, "full_ring_stalls", cs->full_ring_stalls);
+        rte_tel_data_add_dict_uint(queue, "full_ring_stall_cycles", cs->full_ring_stall_cycles);
+        rte_tel_data_add_dict_uint(queue, "free_ring_stalls", cs->free_ring_stalls);
+        rte_tel_data_add_dict_uint(queue, "free_ring_stall_cycles", cs->free_ring_stall_cycles);
+        rte_tel_data_add_dict_uint(queue, "overload_episodes", cs->overload_episodes);
+        rte_tel_data_add_dict_uint(queue, "overload_cycles", cs->overload_cycles);
+        rte_tel_data_add_dict_uint(queue, "shed_packets", cs->shed_packets);
+        rte_tel_data_add_dict_uint(queue, "shed_bytes", cs->shed_bytes);
+        rte_tel_data_add_dict_uint(queue, "truncated_packets", cs->truncated_packets);
+        if (cs->overload_episodes) {
+            rte_tel_data_add_dict_uint(queue, "last_overload", cs->last_overload);
+        }
+        rte_tel_data_add_dict_uint(queue, "history_buffers", cs->history_buffers);
+        rte_tel_data_add_dict_uint(queue, "evicted_buffers", cs->evicted_buffers);
+        rte_tel_data_add_dict_uint(queue, "dumped_buffers", cs->dumped_buffers);
+
+        snprintf(name, sizeof(name), "queue%u", i);
+        rte_tel_data_add_dict_container(d, name, queue, 0);
+    }
+    return 0;
+}
+
+static int
+tel_write(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct stats_data* data = tel_data;
+    struct rte_tel_data* writer;
+    char name[32];
+    unsigned int i;
+
+    if (!data) {
+        return -EINVAL;
+    }
+
+    rte_tel_data_start_dict(d);
+    for (i = 0; i < data->nb_write_cores; i++) {
+        const struct write_core_stats* ws = &data->write_core_stats[i];
+
+        writer = rte_tel_data_alloc();
+        if (!writer) {
+            return -ENOMEM;
+        }
+        rte_tel_data_start_dict(writer);
+        rte_tel_data_add_dict_uint(writer, "core", ws->core_id);
+        rte_tel_data_add_dict_uint(writer, "packets", ws->packets);
+        rte_tel_data_add_dict_uint(writer, "bytes", ws->bytes);
+        rte_tel_data_add_dict_uint(writer, "files", ws->files);
+        rte_tel_data_add_dict_uint(writer, "syncs", ws->syncs);
+        rte_tel_data_add_dict_uint(writer, "sync_cycles", ws->sync_cycles);
+        rte_tel_data_add_dict_uint(writer, "flow_records", ws->flow_records);
+        rte_tel_data_add_dict_uint(writer, "current_file_bytes", ws->current_file_bytes);
+        rte_tel_data_add_dict_uint(writer, "pending_pbufs", rte_ring_count(ws->pbuf_full_ring));
+        rte_tel_data_add_dict_string(writer, "file", ws->output_file);
+
+        snprintf(name, sizeof(name), "writer%u", i);
+        rte_tel_data_add_dict_container(d, name, writer, 0);
+    }
+    return 0;
+}
+
+static int
+tel_compress(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct stats_data* data = tel_data;
+    struct rte_tel_data* compressor;
+    char name[32];
+    unsigned int i;
+
+    if (!data) {
+        return -EINVAL;
+    }
+
+    rte_tel_data_start_dict(d);
+    for (i = 0; i < data->nb_compress_cores; i++) {
+        const struct compress_core_stats* cs = &data->compress_core_stats[i];
+
+        compressor = rte_tel_data_alloc();
+        if (!compressor) {
+            return -ENOMEM;
+        }
+        rte_tel_data_start_dict(compressor);
+        rte_tel_data_add_dict_uint(compressor, "port", cs->port);
+        rte_tel_data_add_dict_uint(compressor, "core", cs->core_id);
+        rte_tel_data_add_dict_uint(compressor, "buffers", cs->buffers);
+        rte_tel_data_add_dict_uint(compressor, "bytes_in", cs->bytes_in);
+        rte_tel_data_add_dict_uint(compressor, "bytes_out", cs->bytes_out);
+        rte_tel_data_add_dict_uint(compressor, "busy_cycles", cs->cycles);
+        rte_tel_data_add_dict_uint(compressor, "errors", cs->errors);
+
+        snprintf(name, sizeof(name), "compressor%u", i);
+        rte_tel_data_add_dict_container(d, name, compressor, 0);
+    }
+    return 0;
+}
+
+static int
+tel_devices(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct stats_data* data = tel_data;
+    struct rte_tel_data* device;
+    char name[32];
+    unsigned int i;
+
+    if (!data) {
+        return -EINVAL;
+    }
+
+    rte_tel_data_start_dict(d);
+    for (i = 0; i < data->nb_devices; i++) {
+        const struct output_device* dev = &data->devices[i];
+
+        device = rte_tel_data_alloc();
+        if (!device) {
+            return -ENOMEM;
+        }
+        rte_tel_data_start_dict(device);
+        rte_tel_data_add_dict_string(device, "dir", dev->dir);
+        rte_tel_data_add_dict_uint(device, "weight", dev->weight);
+        rte_tel_data_add_dict_uint(device, "bytes", dev->bytes);
+        rte_tel_data_add_dict_uint(device, "errors", dev->errors);
+        rte_tel_data_add_dict_uint(device, "demotions", dev->demotions);
+        rte_tel_data_add_dict_uint(device, "full", dev->full);
+
+        snprintf(name, sizeof(name), "device%u", i);
+        rte_tel_data_add_dict_container(d, name, device, 0);
+    }
+    return 0;
+}
+
+static int
+tel_ports(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct stats_data* data = tel_data;
+    struct rte_eth_stats port_stats;
+    struct rte_tel_data* port;
+    char name[32];
+    unsigned int i;
+
+    if (!data) {
+        return -EINVAL;
+    }
+
+    rte_tel_data_start_dict(d);
+    for (i = 0; i < data->nb_ports; i++) {
+        if (rte_eth_stats_get(data->port_list[i], &port_stats)) {
+            continue;
+        }
+
+        port = rte_tel_data_alloc();
+        if (!port) {
+            return -ENOMEM;
+        }
+        rte_tel_data_start_dict(port);
+        rte_tel_data_add_dict_uint(port, "rx_packets", port_stats.ipackets);
+        rte_tel_data_add_dict_uint(port, "rx_bytes", port_stats.ibytes);
+        rte_tel_data_add_dict_uint(port, "rx_errors", port_stats.ierrors);
+        rte_tel_data_add_dict_uint(port, "rx_missed", port_stats.imissed);
+        rte_tel_data_add_dict_uint(port, "rx_nombuf", port_stats.rx_nombuf);
+
+        snprintf(name, sizeof(name), "port%u", data->port_list[i]);
+        rte_tel_data_add_dict_container(d, name, port, 0);
+    }
+    return 0;
+}
+
+static void
+tel_histogram(struct rte_tel_data* d, const char* name, const struct histogram* histogram) {
+    struct rte_tel_data* percentiles = rte_tel_data_alloc();
+
+    if (!percentiles) {
+        return;
+    }
+    rte_tel_data_start_dict(percentiles);
+    rte_tel_data_add_dict_uint(percentiles, "count", histogram->count);
+    rte_tel_data_add_dict_uint(percentiles, "sum", histogram->sum);
+    rte_tel_data_add_dict_uint(percentiles, "p50", histogram_percentile(histogram, 0.5));
+    rte_tel_data_add_dict_uint(percentiles, "p90", histogram_percentile(histogram, 0.9));
+    rte_tel_data_add_dict_uint(percentiles, "p99", histogram_percentile(histogram, 0.99));
+    rte_tel_data_add_dict_uint(percentiles, "p999", histogram_percentile(histogram, 0.999));
+    rte_tel_data_add_dict_uint(percentiles, "max", histogram->max);
+    rte_tel_data_add_dict_container(d, name, percentiles, 0);
+}
+
+static int
+tel_latency(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct stats_data* data = tel_data;
+    char name[32];
+    unsigned int i;
+
+    if (!data) {
+        return -EINVAL;
+    }
+
+    /* In TSC cycles */
+    rte_tel_data_start_dict(d);
+    rte_tel_data_add_dict_uint(d, "tsc_hz", rte_get_tsc_hz());
+    for (i = 0; i < data->nb_queues; i++) {
+        snprintf(name, sizeof(name), "queue%u_rx_to_enqueue", i);
+        tel_histogram(d, name, &data->capture_core_stats[i].rx_to_enqueue);
+    }
+    for (i = 0; i < data->nb_write_cores; i++) {
+        snprintf(name, sizeof(name), "writer%u_ring_wait", i);
+        tel_histogram(d, name, &data->write_core_stats[i].ring_wait);
+        snprintf(name, sizeof(name), "writer%u_write", i);
+        tel_histogram(d, name, &data->write_core_stats[i].write);
+    }
+    return 0;
+}
+
+/*
+ * Prometheus text format
+ */
+
+/* A 64-bit counter of a stats structure */
+struct metric {
+    const char* name;
+    const char* type;
+    const char* help;
+    size_t offset;
+};
+
+typedef void (*metric_labels_t)(FILE* out, const struct stats_data* data, unsigned int i);
+
+static const struct metric capture_metrics[] = {
+    {"capture_packets_total", "counter", "Packets received by a queue",
+     offsetof(struct capture_core_stats, packets)},
+    {"capture_filtered_total", "counter", "Packets rejected by the flow rules or the filter",
+     offsetof(struct capture_core_stats, filtered)},
+    {"capture_duplicates_total", "counter", "Copies of recent packets dropped by a queue",
+     offsetof(struct capture_core_stats, duplicates)},
+    {"capture_sampled_out_total", "counter", "Packets left out by the sampling of a queue",
+     offsetof(struct capture_core_stats, sampled_out)},
+    {"capture_zero_copy_packets_total", "counter", "Packets passed to the writing cores without copy",
+     offsetof(struct capture_core_stats, zc_packets)},
+    {"capture_zero_copy_copied_total", "counter", "Packets copied because too many mbufs were held",
+     offsetof(struct capture_core_stats, zc_copied)},
+    {"capture_full_ring_stalls_total", "counter", "Times a queue waited for room in the ring of the writing cores",
+     offsetof(struct capture_core_stats, full_ring_stalls)},
+    {"capture_full_ring_stall_cycles_total", "counter", "TSC cycles a queue waited for room in the ring",
+     offsetof(struct capture_core_stats, full_ring_stall_cycles)},
+    {"capture_free_ring_stalls_total", "counter", "Times a queue waited for a free packet buffer",
+     offsetof(struct capture_core_stats, free_ring_stalls)},
+    {"capture_free_ring_stall_cycles_total", "counter", "TSC cycles a queue waited for a free packet buffer",
+     offsetof(struct capture_core_stats, free_ring_stall_cycles)},
+    {"capture_overload_episodes_total", "counter", "Times a queue started shedding packets for lack of a free buffer",
+     offsetof(struct capture_core_stats, overload_episodes)},
+    {"capture_overload_cycles_total", "counter", "TSC cycles a queue spent shedding packets",
+     offsetof(struct capture_core_stats, overload_cycles)},
+    {"capture_shed_packets_total", "counter", "Packets dropped by a queue while overloaded",
+     offsetof(struct capture_core_stats, shed_packets)},
+    {"capture_shed_bytes_total", "counter", "Wire bytes of the packets dropped while overloaded",
+     offsetof(struct capture_core_stats, shed_bytes)},
+    {"capture_truncated_packets_total", "counter", "Packets kept truncated to their headers while overloaded",
+     offsetof(struct capture_core_stats, truncated_packets)},
+    {"capture_last_overload_timestamp_seconds", "gauge", "Start of the last overload episode of a queue",
+     offsetof(struct capture_core_stats, last_overload)},
+    {"capture_history_buffers", "gauge", "Buffers of a queue kept by the flight recorder",
+     offsetof(struct capture_core_stats, history_buffers)},
+    {"capture_evicted_buffers_total", "counter", "Buffers of the flight recorder emptied without being written",
+     offsetof(struct capture_core_stats, evicted_buffers)},
+    {"capture_dumped_buffers_total", "counter", "Buffers of the flight recorder written upon a trigger",
+     offsetof(struct capture_core_stats, dumped_buffers)},
+};
+
+static const struct metric write_metrics[] = {
+    {"write_packets_total", "counter", "Packets written by a writing core",
+     offsetof(struct write_core_stats, packets)},
+    {"write_bytes_total", "counter", "Bytes written by a writing core", offsetof(struct write_core_stats, bytes)},
+    {"write_files_total", "counter", "Files opened by a writing core", offsetof(struct write_core_stats, files)},
+    {"write_current_file_bytes", "gauge", "Size of the last file of a writing core",
+     offsetof(struct write_core_stats, current_file_bytes)},
+    {"write_syncs_total", "counter", "fdatasync() of the files of a writing core",
+     offsetof(struct write_core_stats, syncs)},
+    {"write_sync_cycles_total", "counter", "TSC cycles a writing core spent in fdatasync()",
+     offsetof(struct write_core_stats, sync_cycles)},
+    {"write_flow_records_total", "counter", "Flow index records written by a writing core",
+     offsetof(struct write_core_stats, flow_records)},
+};
+
+static const struct metric compress_metrics[] = {
+    {"compress_buffers_total", "counter", "Buffers compressed by a compression core",
+     offsetof(struct compress_core_stats, buffers)},
+    {"compress_bytes_in_total", "counter", "Bytes before compression", offsetof(struct compress_core_stats, bytes_in)},
+    {"compress_bytes_out_total", "counter", "Bytes after compression",
+     offsetof(struct compress_core_stats, bytes_out)},
+    {"compress_busy_cycles_total", "counter", "TSC cycles spent compressing",
+     offsetof(struct compress_core_stats, cycles)},
+    {"compress_errors_total", "counter", "Buffers which could not be compressed",
+     offsetof(struct compress_core_stats, errors)},
+};
+
+static const struct metric device_metrics[] = {
+    {"device_bytes_total", "counter", "Bytes written into an output directory",
+     offsetof(struct output_device, bytes)},
+    {"device_errors_total", "counter", "Failed writes into an output directory",
+     offsetof(struct output_device, errors)},
+    {"device_demotions_total", "counter", "Times an output directory was skipped for being slow",
+     offsetof(struct output_device, demotions)},
+};
+
+static void
+print_header(FILE* out, const char* name, const char* type, const char* help) {
+    fprintf(out, "# HELP dpdkcap_%s %s\n# TYPE dpdkcap_%s %s\n", name, help, name, type);
+}
+
+static void
+capture_labels(FILE* out, const struct stats_data* data, unsigned int i) {
+    fprintf(out, "{port=\"%u\",queue=\"%u\",core=\"%u\"}", data->port_list[i / data->nb_queues_per_port],
+            i % data->nb_queues_per_port, data->capture_core_stats[i].core_id);
+}
+
+static void
+write_labels(FILE* out, const struct stats_data* data, unsigned int i) {
+    fprintf(out, "{writer=\"%u\",core=\"%u\"}", i, data->write_core_stats[i].core_id);
+}
+
+static void
+compress_labels(FILE* out, const struct stats_data* data, unsigned int i) {
+    fprintf(out, "{port=\"%u\",core=\"%u\"}", data->compress_core_stats[i].port, data->compress_core_stats[i].core_id);
+}
+
+static void
+device_labels(FILE* out, const struct stats_data* data, unsigned int i) {
+    fprintf(out, "{dir=\"%s\"}", data->devices[i].dir);
+}
+
+static void
+print_metrics(FILE* out, const struct stats_data* data, const struct metric* metrics, unsigned int nb_metrics,
+              const void* stats, size_t stride, unsigned int nb, metric_labels_t labels) {
+    unsigned int m, i;
+
+    if (nb == 0) {
+        return;
+    }
+
+    for (m = 0; m < nb_metrics; m++) {
+        print_header(out, metrics[m].name, metrics[m].type, metrics[m].help);
+        for (i = 0; i < nb; i++) {
+            fprintf(out, "dpdkcap_%s", metrics[m].name);
+            labels(out, data, i);
+            fprintf(out, " %lu\n", *(const uint64_t*)((const char*)stats + i * stride + metrics[m].offset));
+        }
+    }
+}
+
+static void
+print_port_metrics(FILE* out, const struct stats_data* data) {
+    struct rte_eth_stats port_stats[data->nb_ports];
+    struct rte_eth_xstat_name* names;
+    struct rte_eth_xstat* xstats;
+    unsigned int i;
+    int j, nb_xstats;
+
+    for (i = 0; i < data->nb_ports; i++) {
+        if (rte_eth_stats_get(data->port_list[i], &port_stats[i])) {
+            memset(&port_stats[i], 0, sizeof(port_stats[i]));
+        }
+    }
+
+#define PRINT_PORT_COUNTER(field, name, help)                                                                          \
+    print_header(out, name, "counter", help);                                                                          \
+    for (i = 0; i < data->nb_ports; i++) {                                                                             \
+        fprintf(out, "dpdkcap_" name "{port=\"%u\"} %lu\n", data->port_list[i], port_stats[i].field);               \
+    }
+
+    PRINT_PORT_COUNTER(ipackets, "port_rx_packets_total", "Packets received by a port");
+    PRINT_PORT_COUNTER(ibytes, "port_rx_bytes_total", "Bytes received by a port");
+    PRINT_PORT_COUNTER(ierrors, "port_rx_errors_total", "Erroneous packets received by a port");
+    PRINT_PORT_COUNTER(imissed, "port_rx_missed_total", "Packets dropped by a port for lack of descriptors");
+    PRINT_PORT_COUNTER(rx_nombuf, "port_rx_nombuf_total", "Mbuf allocation failures of a port");
+#undef PRINT_PORT_COUNTER
+
+    /* Extended statistics, named by the driver */
+    print_header(out, "port_xstat", "untyped", "Extended statistics of a port");
+    for (i = 0; i < data->nb_ports; i++) {
+        nb_xstats = rte_eth_xstats_get(data->port_list[i], NULL, 0);
+        if (nb_xstats <= 0) {
+            continue;
+        }
+        names = calloc(nb_xstats, sizeof(*names));
+        xstats = calloc(nb_xstats, sizeof(*xstats));
+        if (names && xstats && rte_eth_xstats_get_names(data->port_list[i], names, nb_xstats) == nb_xstats
+            && rte_eth_xstats_get(data->port_list[i], xstats, nb_xstats) == nb_xstats) {
+            for (j = 0; j < nb_xstats; j++) {
+                fprintf(out, "dpdkcap_port_xstat{port=\"%u\",name=\"%s\"} %lu\n", data->port_list[i],
+                        names[xstats[j].id].name, xstats[j].value);
+            }
+        }
+        free(names);
+        free(xstats);
+    }
+}
+
+/*
+ * Renders all the metrics. Returns a buffer to be freed, or NULL.
+ */
+static char*
+render_metrics(const struct stats_data* data, size_t* len) {
+    char* buf = NULL;
+    unsigned int i;
+    FILE* out;
+
+    out = open_memstream(&buf, len);
+    if (!out) {
+        return NULL;
+    }
+
+    print_metrics(out, data, capture_metrics, RTE_DIM(capture_metrics), data->capture_core_stats,
+                  sizeof(struct capture_core_stats), data->nb_queues, capture_labels);
+
+    print_header(out, "capture_pause_frames_total", "counter", "Pause frames sent by a queue");
+    for (i = 0; i < data->nb_queues; i++) {
+        if (data->capture_core_stats[i].pause_frames != ~0UL) {
+            fprintf(out, "dpdkcap_capture_pause_frames_total");
+            capture_labels(out, data, i);
+            fprintf(out, " %lu\n", data->capture_core_stats[i].pause_frames);
+        }
+    }
+
+    print_header(out, "capture_zero_copy_held_mbufs", "gauge", "Mbufs of a queue held by the writing cores");
+    for (i = 0; i < data->nb_queues; i++) {
+        fprintf(out, "dpdkcap_capture_zero_copy_held_mbufs");
+        capture_labels(out, data, i);
+        fprintf(out, " %u\n", data->capture_core_stats[i].zc_held);
+    }
+
+    print_header(out, "capture_free_pbufs", "gauge", "Packet buffers available to a queue");
+    for (i = 0; i < data->nb_queues; i++) {
+        fprintf(out, "dpdkcap_capture_free_pbufs");
+        capture_labels(out, data, i);
+        fprintf(out, " %u\n", rte_ring_count(data->capture_core_stats[i].pbuf_free_ring));
+    }
+
+    print_header(out, "capture_free_pbufs_low", "gauge", "Fewest packet buffers left to a queue");
+    for (i = 0; i < data->nb_queues; i++) {
+        if (data->capture_core_stats[i].free_pbufs_low != UINT32_MAX) {
+            fprintf(out, "dpdkcap_capture_free_pbufs_low");
+            capture_labels(out, data, i);
+            fprintf(out, " %u\n", data->capture_core_stats[i].free_pbufs_low);
+        }
+    }
+
+    print_metrics(out, data, write_metrics, RTE_DIM(write_metrics), data->write_core_stats,
+                  sizeof(struct write_core_stats), data->nb_write_cores, write_labels);
+
+    /* Shared writing cores report the same ring */
+    print_header(out, "write_pending_pbufs", "gauge", "Full packet buffers waiting for a writing core");
+    for (i = 0; i < data->nb_write_cores; i++) {
+        fprintf(out, "dpdkcap_write_pending_pbufs");
+        write_labels(out, data, i);
+        fprintf(out, " %u\n", rte_ring_count(data->write_core_stats[i].pbuf_full_ring));
+    }
+
+    print_metrics(out, data, compress_metrics, RTE_DIM(compress_metrics), data->compress_core_stats,
+                  sizeof(struct compress_core_stats), data->nb_compress_cores, compress_labels);
+
+    print_metrics(out, data, device_metrics, RTE_DIM(device_metrics), data->devices, sizeof(struct output_device),
+                  data->nb_devices, device_labels);
+    if (data->nb_devices) {
+        print_header(out, "device_full", "gauge", "Whether an output directory ran out of space");
+        for (i = 0; i < data->nb_devices; i++) {
+            fprintf(out, "dpdkcap_device_full");
+            device_labels(out, data, i);
+            fprintf(out, " %d\n", data->devices[i].full);
+        }
+    }
+
+    print_port_metrics(out, data);
+
+    print_header(out, "tsc_hz", "gauge", "Frequency of the TSC cycles counters");
+    fprintf(out, "dpdkcap_tsc_hz %lu\n", rte_get_tsc_hz());
+
+    if (fclose(out)) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * Prometheus endpoint
+ */
+
+static void
+send_all(int fd, const char* buf, size_t len) {
+    ssize_t sent;
+
+    while (len) {
+        sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return;
+        }
+        buf += sent;
+        len -= sent;
+    }
+}
+
+static void
+serve_scrape(int fd) {
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = METRICS_TIMEOUT_MS * 1000};
+    char request[METRICS_REQUEST_MAX + 1];
+    char header[160];
+    size_t len = 0, body_len;
+    ssize_t received;
+    char* body;
+    struct stats_data* data = tel_data;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Only the request line matters, the rest of the request is ignored */
+    while (len < METRICS_REQUEST_MAX) {
+        received = recv(fd, request + len, METRICS_REQUEST_MAX - len, 0);
+        if (received <= 0) {
+            break;
+        }
+        len += received;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    if (strncmp(request, "GET ", 4)) {
+        snprintf(header, sizeof(header), "HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n");
+        send_all(fd, header, strlen(header));
+        return;
+    }
+
+    body = data ? render_metrics(data, &body_len) : NULL;
+    if (!body) {
+        snprintf(header, sizeof(header), "HTTP/1.0 500 Internal Server Error\r\nConnection: close\r\n\r\n");
+        send_all(fd, header, strlen(header));
+        return;
+    }
+
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+             "Connection: close\r\n\r\n",
+             body_len);
+    send_all(fd, header, strlen(header));
+    send_all(fd, body, body_len);
+    free(body);
+}
+
+static int
+metrics_listen_unix(const char* path) {
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd, ret;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG_ERR("Metrics socket path too long: %s\n", path);
+        return -ENAMETOOLONG;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Only replace the socket left over by a previous run, never a file */
+    if (!lstat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode)) {
+            LOG_ERR("Metrics socket path %s exists and is not a socket\n", path);
+            return -EEXIST;
+        }
+        if (unlink(path) < 0) {
+            ret = -errno;
+            LOG_ERR("Could not remove the metrics socket %s: %d (%s)\n", path, -ret, strerror(-ret));
+            return ret;
+        }
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        ret = -errno;
+        LOG_ERR("Could not bind the metrics socket %s: %d (%s)\n", path, -ret, strerror(-ret));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return ret;
+    }
+
+    strcpy(metrics_path, path);
+    return fd;
+}
+
+static int
+metrics_listen_tcp(const char* arg) {
+    struct addrinfo hints, *res;
+    char host[256] = "127.0.0.1";
+    const char* port = arg;
+    const char* sep = strrchr(arg, ':');
+    int fd, ret, one = 1;
+
+    if (sep) {
+        snprintf(host, sizeof(host), "%.*s", (int)(sep - arg), arg);
+        port = sep + 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret) {
+        LOG_ERR("Invalid metrics address %s: %s\n", arg, gai_strerror(ret));
+        return -EINVAL;
+    }
+
+    fd = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd >= 0) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (fd < 0 || bind(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        ret = -errno;
+        LOG_ERR("Could not bind the metrics address %s: %d (%s)\n", arg, -ret, strerror(-ret));
+        if (fd >= 0) {
+            close(fd);
+        }
+        freeaddrinfo(res);
+        return ret;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+/*
+ * Serves the scrapes off the main lcore, one client at a time: a slow
+ * scraper only delays the next scrape, not the timers of the capture.
+ */
+static void*
+metrics_thread_main(void* UNUSED(arg)) {
+    struct pollfd pfd = {.fd = metrics_fd, .events = POLLIN};
+    int fd;
+
+    while (!metrics_stop) {
+        if (poll(&pfd, 1, METRICS_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+        fd = accept4(metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd >= 0) {
+            serve_scrape(fd);
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+int
+telemetry_init(struct stats_data* data, const char* addr) {
+    int fd, ret;
+
+    tel_data = data;
+
+    rte_telemetry_register_cmd("/dpdkcap/capture", tel_capture, "Returns the statistics of the captured queues");
+    rte_telemetry_register_cmd("/dpdkcap/write", tel_write, "Returns the statistics of the writing cores");
+    rte_telemetry_register_cmd("/dpdkcap/compress", tel_compress, "Returns the statistics of the compression cores");
+    rte_telemetry_register_cmd("/dpdkcap/devices", tel_devices, "Returns the statistics of the output directories");
+    rte_telemetry_register_cmd("/dpdkcap/ports", tel_ports, "Returns the statistics of the captured ports");
+    rte_telemetry_register_cmd("/dpdkcap/latency", tel_latency,
+                               "Returns the latency percentiles of the capturing and writing cores, in TSC cycles");
+
+    if (!addr) {
+        return 0;
+    }
+
+    fd = addr[0] == '/' ? metrics_listen_unix(addr) : metrics_listen_tcp(addr);
+    if (fd < 0) {
+        return fd;
+    }
+
+    if (listen(fd, 8) < 0) {
+        ret = -errno;
+        LOG_ERR("Could not listen on the metrics endpoint: %d (%s)\n", -ret, strerror(-ret));
+        close(fd);
+        return ret;
+    }
+
+    metrics_fd = fd;
+    ret = pthread_create(&metrics_thread, NULL, metrics_thread_main, NULL);
+    if (ret) {
+        LOG_ERR("Could not start the metrics thread: %d (%s)\n", ret, strerror(ret));
+        close(fd);
+        metrics_fd = -1;
+        return -ret;
+    }
+    pthread_setname_np(metrics_thread, "dpdkcap-metrics");
+
+    LOG_INFO("Serving Prometheus metrics on %s\n", addr);
+    return 0;
+}
+
+void
+telemetry_log_histograms(bool verbose) {
+    struct stats_data* data = tel_data;
+    char name[64];
+    unsigned int i;
+
+    if (!data) {
+        return;
+    }
+
+    LOG_INFO("Latency histograms:\n");
+    for (i = 0; i < data->nb_queues; i++) {
+        snprintf(name, sizeof(name), "Port %u queue %u RX to enqueue", data->port_list[i / data->nb_queues_per_port],
+                 i % data->nb_queues_per_port);
+        histogram_log(name, &data->capture_core_stats[i].rx_to_enqueue, verbose);
+    }
+    for (i = 0; i < data->nb_write_cores; i++) {
+        snprintf(name, sizeof(name), "Writing core %u ring wait", data->write_core_stats[i].core_id);
+        histogram_log(name, &data->write_core_stats[i].ring_wait, verbose);
+        snprintf(name, sizeof(name), "Writing core %u write", data->write_core_stats[i].core_id);
+        histogram_log(name, &data->write_core_stats[i].write, verbose);
+    }
+}
+
+void
+telemetry_log_stalls(void) {
+    struct stats_data* data = tel_data;
+    const struct capture_core_stats* cs;
+    uint64_t hz = rte_get_tsc_hz();
+    unsigned int i;
+
+    if (!data) {
+        return;
+    }
+
+    for (i = 0; i < data->nb_queues; i++) {
+        cs = &data->capture_core_stats[i];
+        LOG_INFO("Port %u queue %u stalls: full ring %lu (%lu ms), no free buffer %lu (%lu ms), "
+                 "fewest free buffers %u\n",
+                 data->port_list[i / data->nb_queues_per_port], i % data->nb_queues_per_port, cs->full_ring_stalls,
+                 cs->full_ring_stall_cycles * 1000 / hz, cs->free_ring_stalls, cs->free_ring_stall_cycles * 1000 / hz,
+                 cs->free_pbufs_low == UINT32_MAX ? 0 : cs->free_pbufs_low);
+        if (cs->overload_episodes) {
+            LOG_INFO("Port %u queue %u overloads: %lu (%lu ms), %lu packets (%lu bytes) dropped, %lu truncated\n",
+                     data->port_list[i / data->nb_queues_per_port], i % data->nb_queues_per_port,
+                     cs->overload_episodes, cs->overload_cycles * 1000 / hz, cs->shed_packets, cs->shed_bytes,
+                     cs->truncated_packets);
+        }
+    }
+}
+
+void
+telemetry_exit(void) {
+    tel_data = NULL;
+
+    if (metrics_fd >= 0) {
+        metrics_stop = true;
+        pthread_join(metrics_thread, NULL);
+        close(metrics_fd);
+        metrics_fd = -1;
+    }
+    if (metrics_path[0]) {
+        unlink(metrics_path);
+        metrics_path[0] = '\0';
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef DPDKCAP_TELEMETRY_H
+#define DPDKCAP_TELEMETRY_H
+
+#include "stats.h"
+
+/* Largest request read from a scraper */
+#define METRICS_REQUEST_MAX 1024
+
+/*
+ * Registers the /dpdkcap telemetry commands, and opens the Prometheus
+ * endpoint when addr is not NULL: "PORT" or "HOST:PORT" for HTTP over TCP
+ * (on 127.0.0.1 by default), or the path of a Unix socket. The scrapes are
+ * served by a thread of their own.
+ */
+int telemetry_init(struct stats_data* data, const char* addr);
+
+/*
+ * Logs the latency histograms of the capturing and writing cores, with their
+ * buckets when verbose
+ */
+void telemetry_log_histograms(bool verbose);
+
+/* Logs the stalls and the overloads of the capturing cores on the packet buffer rings */
+void telemetry_log_stalls(void);
+
+void telemetry_exit(void);
+
+#endif
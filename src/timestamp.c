@@ -0,0 +1,185 @@
+#include "timestamp.h"
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+
+/* Number of reads of both clocks per calibration, the tightest one is kept */
+#define TIMESTAMP_SAMPLES 5
+
+int
+timestamp_parse_opt(const char* arg, uint16_t* mode) {
+    if (!strcmp(arg, TIMESTAMP_MODE_COARSE)) {
+        *mode = TIMESTAMP_COARSE;
+    } else if (!strcmp(arg, TIMESTAMP_MODE_HW)) {
+        *mode = TIMESTAMP_HW;
+    } else if (!strcmp(arg, TIMESTAMP_MODE_TSC)) {
+        *mode = TIMESTAMP_TSC;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+const char*
+timestamp_mode_name(uint16_t mode) {
+    switch (mode) {
+        case TIMESTAMP_HW: return TIMESTAMP_MODE_HW;
+        case TIMESTAMP_TSC: return TIMESTAMP_MODE_TSC;
+        default: return TIMESTAMP_MODE_COARSE;
+    }
+}
+
+static inline uint64_t
+timespec_ns(const struct timespec* ts) {
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static int
+read_ticks(const struct timestamp_clock* clock, uint64_t* ticks) {
+    if (clock->tsc) {
+        *ticks = rte_rdtsc_precise();
+        return 0;
+    }
+    return rte_eth_read_clock(clock->port, ticks);
+}
+
+/*
+ * Reads the clock along with CLOCK_REALTIME
+ */
+static int
+sample(const struct timestamp_clock* clock, uint64_t* ticks, uint64_t* ns) {
+    struct timespec before, after;
+    uint64_t t, span, best = UINT64_MAX;
+    int i, retval;
+
+    for (i = 0; i < TIMESTAMP_SAMPLES; i++) {
+        clock_gettime(CLOCK_REALTIME, &before);
+        retval = read_ticks(clock, &t);
+        clock_gettime(CLOCK_REALTIME, &after);
+        if (retval) {
+            return retval;
+        }
+
+        span = timespec_ns(&after) - timespec_ns(&before);
+        if (span < best) {
+            best = span;
+            *ticks = t;
+            *ns = timespec_ns(&before) + span / 2;
+        }
+    }
+    return 0;
+}
+
+static void
+publish(struct timestamp_clock* clock, const struct timestamp_model* model) {
+    clock->seq++;
+    rte_smp_wmb();
+    clock->model = *model;
+    rte_smp_wmb();
+    clock->seq++;
+}
+
+int
+timestamp_clock_init_hw(struct timestamp_clock* clock, uint16_t port, struct timestamp_dynfield* dynfield) {
+    struct timestamp_model model;
+    uint64_t ticks, ns;
+    int retval;
+
+    memset(clock, 0, sizeof(*clock));
+    clock->port = port;
+    snprintf(clock->name, sizeof(clock->name), "port %u", port);
+
+    retval = rte_mbuf_dyn_rx_timestamp_register(&dynfield->offset, &dynfield->flag);
+    if (retval < 0) {
+        LOG_ERR("Cannot register the RX timestamp field: %s\n", rte_strerror(rte_errno));
+        return retval;
+    }
+
+    retval = sample(clock, &clock->last_ticks, &clock->last_ns);
+    if (retval) {
+        LOG_ERR("Cannot read the clock of port %u: %s\n", port, rte_strerror(-retval));
+        return retval;
+    }
+
+    rte_delay_ms(TIMESTAMP_INIT_MS);
+
+    retval = sample(clock, &ticks, &ns);
+    if (retval || ticks <= clock->last_ticks || ns <= clock->last_ns) {
+        LOG_ERR("The clock of port %u does not run\n", port);
+        return retval ? retval : -EINVAL;
+    }
+
+    model.base_ticks = ticks;
+    model.base_ns = ns;
+    model.mult = ((unsigned __int128)(ns - clock->last_ns) << TIMESTAMP_MULT_SHIFT) / (ticks - clock->last_ticks);
+    publish(clock, &model);
+
+    LOG_INFO("Port %u clock runs at %.3f MHz\n", port,
+             (double)(ticks - clock->last_ticks) * 1000.0 / (ns - clock->last_ns));
+
+    clock->last_ticks = ticks;
+    clock->last_ns = ns;
+    return 0;
+}
+
+int
+timestamp_clock_init_tsc(struct timestamp_clock* clock) {
+    struct timestamp_model model;
+    uint64_t tsc_hz = rte_get_tsc_hz();
+
+    memset(clock, 0, sizeof(*clock));
+    clock->tsc = true;
+    snprintf(clock->name, sizeof(clock->name), "TSC");
+
+    if (tsc_hz == 0) {
+        LOG_ERR("Unknown TSC frequency\n");
+        return -EINVAL;
+    }
+
+    /* Start from the nominal frequency, the calibration corrects it */
+    sample(clock, &clock->last_ticks, &clock->last_ns);
+    model.base_ticks = clock->last_ticks;
+    model.base_ns = clock->last_ns;
+    model.mult = ((unsigned __int128)NSEC_PER_SEC << TIMESTAMP_MULT_SHIFT) / tsc_hz;
+    publish(clock, &model);
+
+    LOG_INFO("TSC runs at %.3f MHz\n", tsc_hz / 1e6);
+    return 0;
+}
+
+void
+timestamp_clock_calibrate(struct timestamp_clock* clock) {
+    struct timestamp_model model;
+    uint64_t ticks, ns, predicted, elapsed;
+    __int128 mult, correction;
+    int64_t error;
+
+    if (sample(clock, &ticks, &ns) || ticks <= clock->last_ticks) {
+        return;
+    }
+
+    elapsed = ticks - clock->last_ticks;
+    predicted = timestamp_to_ns(&clock->model, ticks);
+    error = (int64_t)(ns - predicted);
+
+    model.base_ticks = ticks;
+    model.mult = clock->model.mult;
+
+    if (ns <= clock->last_ns || error > (int64_t)TIMESTAMP_STEP_NS || error < -(int64_t)TIMESTAMP_STEP_NS) {
+        /* The wall clock was stepped, follow it */
+        model.base_ns = ns;
+        clock->steps++;
+        LOG_WARN("Clock of %s stepped by %" PRId64 " ns\n", clock->name, error);
+    } else {
+        /* Follow the measured frequency, and absorb the error over the next period */
+        mult = ((__int128)(ns - clock->last_ns) << TIMESTAMP_MULT_SHIFT) / elapsed;
+        correction = ((__int128)error << TIMESTAMP_MULT_SHIFT) / elapsed;
+        model.base_ns = predicted;
+        model.mult = RTE_MAX(mult + correction, mult / 2);
+    }
+
+    publish(clock, &model);
+
+    clock->last_ticks = ticks;
+    clock->last_ns = ns;
+}
@@ -0,0 +1,110 @@
+#ifndef DPDKCAP_TIMESTAMP_H
+#define DPDKCAP_TIMESTAMP_H
+
+#include <rte_atomic.h>
+#include <rte_mbuf.h>
+#include <rte_mbuf_dyn.h>
+
+#include "utils.h"
+
+/* Timestamping modes */
+#define TIMESTAMP_COARSE                0 /* CLOCK_REALTIME_COARSE, once per burst */
+#define TIMESTAMP_HW                    1 /* NIC RX timestamps */
+#define TIMESTAMP_TSC                   2 /* TSC, read per packet */
+
+#define TIMESTAMP_MODE_COARSE           "coarse"
+#define TIMESTAMP_MODE_HW               "hw"
+#define TIMESTAMP_MODE_TSC              "tsc"
+
+#define TIMESTAMP_INIT_MS               100
+#define TIMESTAMP_CALIBRATION_PERIOD_MS 1000
+/* Errors above this are stepped rather than slewed */
+#define TIMESTAMP_STEP_NS               1000000
+
+/* Fixed point shift of the nanoseconds per tick multiplier */
+#define TIMESTAMP_MULT_SHIFT            32
+
+#define NSEC_PER_SEC                    1000000000ULL
+
+/* Linear conversion from clock ticks to UTC nanoseconds */
+struct timestamp_model {
+    uint64_t base_ticks;
+    uint64_t base_ns;
+    uint64_t mult; /* nanoseconds per tick << TIMESTAMP_MULT_SHIFT */
+};
+
+/*
+ * A clock converted to UTC. The model is updated by the main lcore and read
+ * by the capture cores through a seqlock.
+ */
+struct timestamp_clock {
+    volatile uint32_t seq;
+    struct timestamp_model model;
+
+    /* Calibration state, only used by the main lcore */
+    char name[16];
+    bool tsc; /* the TSC, rather than the device clock of a port */
+    uint16_t port;
+    uint64_t last_ticks;
+    uint64_t last_ns;
+    uint64_t steps;
+} __rte_cache_aligned;
+
+/* Location of the NIC RX timestamps in the mbufs */
+struct timestamp_dynfield {
+    int offset;
+    uint64_t flag;
+};
+
+int timestamp_parse_opt(const char* arg, uint16_t* mode);
+const char* timestamp_mode_name(uint16_t mode);
+
+/*
+ * Sets up a clock following the device clock of a port, whose RX timestamp
+ * offload must be enabled and started. Takes TIMESTAMP_INIT_MS to measure
+ * the clock frequency. Returns 0 on success.
+ */
+int timestamp_clock_init_hw(struct timestamp_clock* clock, uint16_t port, struct timestamp_dynfield* dynfield);
+
+/*
+ * Sets up a clock following the TSC, which must be invariant. The TSC is
+ * assumed to be synchronized across cores, so a single clock is shared.
+ */
+int timestamp_clock_init_tsc(struct timestamp_clock* clock);
+
+/*
+ * Recalibrates a clock against CLOCK_REALTIME. The error is slewed over the
+ * next calibration period, so the converted time stays monotonic.
+ */
+void timestamp_clock_calibrate(struct timestamp_clock* clock);
+
+static inline void
+timestamp_model_read(const struct timestamp_clock* clock, struct timestamp_model* model) {
+    uint32_t seq;
+
+    do {
+        seq = clock->seq;
+        rte_smp_rmb();
+        *model = clock->model;
+        rte_smp_rmb();
+    } while (unlikely((seq & 1) || seq != clock->seq));
+}
+
+static inline uint64_t
+timestamp_to_ns(const struct timestamp_model* model, uint64_t ticks) {
+    /* Ticks may predate the base, when a packet was stamped before a recalibration */
+    __int128 delta = (__int128)(int64_t)(ticks - model->base_ticks) * model->mult;
+
+    return model->base_ns + (int64_t)(delta >> TIMESTAMP_MULT_SHIFT);
+}
+
+static inline bool
+timestamp_hw_get(const struct rte_mbuf* mbuf, const struct timestamp_dynfield* dynfield, uint64_t* ticks) {
+    if (unlikely(!(mbuf->ol_flags & dynfield->flag))) {
+        return false;
+    }
+    *ticks = *RTE_MBUF_DYNFIELD(mbuf, dynfield->offset, const rte_mbuf_timestamp_t*);
+    return true;
+}
+
+#endif
@@ -0,0 +1,122 @@
+#include "trigger.h"
+
+#include <errno.h>
+
+#include <rte_ethdev.h>
+#include <rte_telemetry.h>
+#include <rte_version.h>
+
+#include "stats.h"
+
+#if RTE_VERSION < RTE_VERSION_NUM(23, 3, 0, 0)
+#define rte_tel_data_add_dict_uint rte_tel_data_add_dict_u64
+#endif
+
+/* Period over which the drop rate is measured */
+#define TRIGGER_DROPS_PERIOD_MS 1000
+
+static const char* const trigger_reasons[] = {
+    [TRIGGER_SIGNAL] = "signal",
+    [TRIGGER_COMMAND] = "command",
+    [TRIGGER_FILTER] = "filter",
+    [TRIGGER_DROPS] = "drops",
+};
+
+/* Read by the telemetry thread */
+static struct trigger* tr_trigger;
+static struct stats_data* tr_data;
+
+int
+trigger_parse_opt(const char* arg, uint32_t* pre_seconds, uint32_t* post_seconds) {
+    char* end;
+
+    errno = 0;
+    *pre_seconds = strtoul(arg, &end, 10);
+    if (errno || end == arg || *pre_seconds == 0) {
+        return -EINVAL;
+    }
+    *post_seconds = TRIGGER_POST_S_DEFAULT;
+    if (*end == ':') {
+        arg = end + 1;
+        *post_seconds = strtoul(arg, &end, 10);
+        if (errno || end == arg) {
+            return -EINVAL;
+        }
+    }
+    return *end ? -EINVAL : 0;
+}
+
+/*
+ * Fires a trigger, and returns the triggers fired so far
+ */
+static int
+tel_trigger(const char* UNUSED(cmd), const char* UNUSED(params), struct rte_tel_data* d) {
+    struct trigger* trigger = tr_trigger;
+
+    if (!trigger) {
+        return -EINVAL;
+    }
+
+    trigger_fire(trigger, TRIGGER_COMMAND);
+
+    rte_tel_data_start_dict(d);
+    rte_tel_data_add_dict_uint(d, "triggers", trigger_seq(trigger));
+    rte_tel_data_add_dict_uint(d, "pre_cycles", trigger->pre_cycles);
+    rte_tel_data_add_dict_uint(d, "post_cycles", trigger->post_cycles);
+    return 0;
+}
+
+/*
+ * Packets lost so far: dropped by the ports, or shed by the capturing cores
+ */
+static uint64_t
+count_drops(const struct stats_data* data) {
+    struct rte_eth_stats port_stats;
+    uint64_t drops = 0;
+    unsigned int i;
+
+    for (i = 0; i < data->nb_ports; i++) {
+        if (rte_eth_stats_get(data->port_list[i], &port_stats) == 0) {
+            drops += port_stats.imissed + port_stats.rx_nombuf;
+        }
+    }
+    for (i = 0; i < data->nb_queues; i++) {
+        drops += data->capture_core_stats[i].shed_packets;
+    }
+    return drops;
+}
+
+void
+trigger_init(struct trigger* trigger, struct stats_data* data) {
+    tr_trigger = trigger;
+    tr_data = data;
+    trigger->last_check = rte_get_tsc_cycles();
+    trigger->last_drops = count_drops(data);
+
+    rte_telemetry_register_cmd("/dpdkcap/trigger", tel_trigger,
+                               "Dumps the history of the flight recorder and the next seconds of capture");
+}
+
+void
+trigger_poll(struct trigger* trigger) {
+    uint64_t hz = rte_get_tsc_hz();
+    uint64_t now = rte_get_tsc_cycles();
+    uint64_t seq, drops;
+
+    if (trigger->drop_rate && now - trigger->last_check >= TRIGGER_DROPS_PERIOD_MS * hz / 1000) {
+        drops = count_drops(tr_data);
+        if ((drops - trigger->last_drops) * hz / (now - trigger->last_check) >= trigger->drop_rate
+            && now - trigger->fired_at > trigger->post_cycles) {
+            trigger_fire(trigger, TRIGGER_DROPS);
+        }
+        trigger->last_drops = drops;
+        trigger->last_check = now;
+    }
+
+    seq = trigger_seq(trigger);
+    if (seq != trigger->logged_seq) {
+        trigger->logged_seq = seq;
+        LOG_INFO("Flight recorder triggered (%s, %lu so far): dumping the last %lu s and the next %lu s\n",
+                 trigger_reasons[trigger->reason], seq, trigger->pre_cycles / hz, trigger->post_cycles / hz);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef DPDKCAP_TRIGGER_H
+#define DPDKCAP_TRIGGER_H
+
+#include <rte_cycles.h>
+
+#include "filter.h"
+#include "utils.h"
+
+/* Seconds of capture written after a trigger, by default */
+#define TRIGGER_POST_S_DEFAULT 10
+
+/* What fired a trigger */
+#define TRIGGER_SIGNAL         0 /* SIGUSR2 */
+#define TRIGGER_COMMAND        1 /* /dpdkcap/trigger telemetry command */
+#define TRIGGER_FILTER         2 /* packet matching the trigger filter */
+#define TRIGGER_DROPS          3 /* drop rate above the threshold */
+
+/*
+ * Flight recorder: instead of handing their buffers to the writing cores,
+ * capturing cores keep them as a circular history. When a trigger fires,
+ * they hand over the buffers of the last pre_cycles, then keep handing
+ * their buffers over for post_cycles.
+ */
+struct trigger {
+    uint64_t pre_cycles;
+    uint64_t post_cycles;
+    uint64_t drop_rate;          /* packets/s lost by the ports or shed, 0 to disable */
+    const struct filter* filter; /* run by the capturing cores, or NULL */
+    /* Fired from any core, or from a signal handler */
+    uint64_t volatile fired_at; /* TSC */
+    uint32_t volatile reason;   /* TRIGGER_* */
+    uint64_t seq;               /* triggers fired, updated with atomics */
+    /* Main lcore */
+    uint64_t logged_seq;
+    uint64_t last_drops;
+    uint64_t last_check;
+};
+
+struct stats_data;
+
+/* Parses the windows of the flight recorder: "PRE[:POST]" seconds */
+int trigger_parse_opt(const char* arg, uint32_t* pre_seconds, uint32_t* post_seconds);
+
+/* Registers the /dpdkcap/trigger telemetry command */
+void trigger_init(struct trigger* trigger, struct stats_data* data);
+
+/* Fires a trigger, async-signal-safe */
+static inline void
+trigger_fire(struct trigger* trigger, uint32_t reason) {
+    trigger->fired_at = rte_rdtsc();
+    trigger->reason = reason;
+    __atomic_add_fetch(&trigger->seq, 1, __ATOMIC_RELEASE);
+}
+
+/* Last trigger fired, 0 if none */
+static inline uint64_t
+trigger_seq(const struct trigger* trigger) {
+    return __atomic_load_n(&trigger->seq, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Fires a trigger when the ports drop packets faster than the threshold,
+ * and logs the triggers fired (main lcore)
+ */
+void trigger_poll(struct trigger* trigger);
+
+#endif
@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <sys/uio.h>
+
+#include <rte_malloc.h>
+
+#include "uring_writer.h"
+
+#ifdef HAVE_LIBURING
+
+int
+uring_writer_init(struct uring_writer* uw, unsigned int depth, struct pcap_buffer** buffers,
+                  unsigned int nb_buffers) {
+    struct iovec* iov;
+    unsigned int i;
+    int retval;
+
+    memset(uw, 0, sizeof(*uw));
+    uw->depth = depth;
+
+    retval = io_uring_queue_init(depth, &uw->ring, 0);
+    if (retval < 0) {
+        LOG_ERR("Core %d could not setup io_uring: %d (%s)\n", rte_lcore_id(), -retval, strerror(-retval));
+        return retval;
+    }
+
+    uw->requests = rte_zmalloc(NULL, depth * sizeof(struct uring_request), 0);
+    uw->free_requests = rte_zmalloc(NULL, depth * sizeof(struct uring_request*), 0);
+    iov = calloc(nb_buffers, sizeof(struct iovec));
+    if (!uw->requests || !uw->free_requests || !iov) {
+        free(iov);
+        uring_writer_exit(uw);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < depth; i++) {
+        uw->free_requests[i] = &uw->requests[i];
+    }
+
+    /* Register the hugepage pcap buffers, so the kernel does not map them on each write */
+    uw->first_index = nb_buffers ? buffers[0]->index : 0;
+    for (i = 0; i < nb_buffers; i++) {
+        iov[i].iov_base = buffers[i]->buffer;
+        iov[i].iov_len = buffers[i]->size;
+    }
+
+    retval = io_uring_register_buffers(&uw->ring, iov, nb_buffers);
+    if (retval < 0) {
+        LOG_WARN("Core %d could not register fixed buffers: %d (%s)\n", rte_lcore_id(), -retval, strerror(-retval));
+        LOG_INFO("Core %d using non-fixed io_uring writes\n", rte_lcore_id());
+    } else {
+        uw->fixed_buffers = true;
+    }
+
+    free(iov);
+    return 0;
+}
+
+void
+uring_writer_exit(struct uring_writer* uw) {
+    if (uw->fixed_buffers) {
+        io_uring_unregister_buffers(&uw->ring);
+    }
+    io_uring_queue_exit(&uw->ring);
+    rte_free(uw->requests);
+    rte_free(uw->free_requests);
+}
+
+/*
+ * Prepares the write of the remaining part of a request
+ */
+static inline int
+uring_writer_prep(struct uring_writer* uw, struct uring_request* req) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uw->ring);
+
+    if (unlikely(!sqe)) {
+        return -EBUSY;
+    }
+
+    if (uw->fixed_buffers) {
+        io_uring_prep_write_fixed(sqe, req->fd, req->buffer->buffer + req->done, req->length - req->done,
+                                  req->offset + req->done, req->buffer->index - uw->first_index);
+    } else {
+        io_uring_prep_write(sqe, req->fd, req->buffer->buffer + req->done, req->length - req->done,
+                            req->offset + req->done);
+    }
+    io_uring_sqe_set_data(sqe, req);
+    return 0;
+}
+
+int
+uring_writer_queue(struct uring_writer* uw, int fd, uint64_t offset, struct pcap_buffer* buffer) {
+    struct uring_request* req;
+    int retval;
+
+    if (unlikely(uw->inflight == uw->depth)) {
+        return -EBUSY;
+    }
+
+    req = uw->free_requests[uw->depth - uw->inflight - 1];
+    req->buffer = buffer;
+    req->fd = fd;
+    req->length = buffer->offset;
+    req->done = 0;
+    req->offset = offset;
+
+    retval = uring_writer_prep(uw, req);
+    if (likely(!retval)) {
+        uw->inflight++;
+    }
+    return retval;
+}
+
+int
+uring_writer_submit(struct uring_writer* uw) {
+    int retval = io_uring_submit(&uw->ring);
+
+    if (unlikely(retval < 0)) {
+        LOG_ERR("Core %d could not submit writes: %d (%s)\n", rte_lcore_id(), -retval, strerror(-retval));
+    }
+    return retval;
+}
+
+unsigned int
+uring_writer_reap(struct uring_writer* uw, struct pcap_buffer** buffers, int* results, unsigned int max,
+                  bool wait) {
+    struct io_uring_cqe* cqe;
+    struct uring_request* req;
+    unsigned int nb_done = 0;
+    int retval;
+
+    while (nb_done < max && uw->inflight) {
+        if (wait && !nb_done) {
+            /* Nothing else submits the ring: never wait for an entry left unsubmitted */
+            retval = io_uring_submit_and_wait(&uw->ring, 1);
+            if (retval >= 0) {
+                retval = io_uring_peek_cqe(&uw->ring, &cqe);
+            }
+        } else {
+            retval = io_uring_peek_cqe(&uw->ring, &cqe);
+        }
+        if (retval < 0) {
+            break;
+        }
+
+        req = io_uring_cqe_get_data(cqe);
+
+        if (unlikely(cqe->res > 0 && req->done + cqe->res < req->length)) {
+            /* Short write, submit the remainder before waiting for it */
+            req->done += cqe->res;
+            io_uring_cqe_seen(&uw->ring, cqe);
+            if (!uring_writer_prep(uw, req)) {
+                uring_writer_submit(uw);
+                continue;
+            }
+            results[nb_done] = -EIO;
+        } else if (unlikely(cqe->res < 0)) {
+            results[nb_done] = cqe->res;
+            io_uring_cqe_seen(&uw->ring, cqe);
+        } else {
+            results[nb_done] = req->done + cqe->res;
+            io_uring_cqe_seen(&uw->ring, cqe);
+        }
+
+        buffers[nb_done++] = req->buffer;
+        req->buffer = NULL;
+        uw->free_requests[uw->depth - uw->inflight] = req;
+        uw->inflight--;
+    }
+
+    return nb_done;
+}
+
+unsigned int
+uring_writer_inflight_fd(const struct uring_writer* uw, int fd) {
+    unsigned int i, count = 0;
+
+    for (i = 0; i < uw->depth; i++) {
+        count += (uw->requests[i].buffer != NULL && uw->requests[i].fd == fd);
+    }
+    return count;
+}
+
+#else
+
+int
+uring_writer_init(struct uring_writer* UNUSED(uw), unsigned int UNUSED(depth), struct pcap_buffer** UNUSED(buffers),
+                  unsigned int UNUSED(nb_buffers)) {
+    LOG_ERR("dpdkcap was built without io_uring support\n");
+    return -ENOTSUP;
+}
+
+void
+uring_writer_exit(struct uring_writer* UNUSED(uw)) {}
+
+int
+uring_writer_queue(struct uring_writer* UNUSED(uw), int UNUSED(fd), uint64_t UNUSED(offset),
+                   struct pcap_buffer* UNUSED(buffer)) {
+    return -ENOTSUP;
+}
+
+int
+uring_writer_submit(struct uring_writer* UNUSED(uw)) {
+    return -ENOTSUP;
+}
+
+unsigned int
+uring_writer_reap(struct uring_writer* UNUSED(uw), struct pcap_buffer** UNUSED(buffers), int* UNUSED(results),
+                  unsigned int UNUSED(max), bool UNUSED(wait)) {
+    return 0;
+}
+
+unsigned int
+uring_writer_inflight_fd(const struct uring_writer* UNUSED(uw), int UNUSED(fd)) {
+    return 0;
+}
+
+#endif
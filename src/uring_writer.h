@@ -0,0 +1,67 @@
+#ifndef DPDKCAP_URING_WRITER_H
+#define DPDKCAP_URING_WRITER_H
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "pcap.h"
+#include "utils.h"
+
+#define URING_DEPTH_DEFAULT 8
+
+/* An asynchronous write of a pcap buffer */
+struct uring_request {
+    struct pcap_buffer* buffer;
+    int fd;
+    uint32_t length;
+    uint32_t done;
+    uint64_t offset;
+};
+
+/* io_uring based writer, keeping up to depth writes in flight */
+struct uring_writer {
+#ifdef HAVE_LIBURING
+    struct io_uring ring;
+#endif
+    unsigned int depth;
+    unsigned int inflight;
+    bool fixed_buffers;
+    uint32_t first_index; /* index of the first registered buffer */
+    struct uring_request* requests;
+    struct uring_request** free_requests;
+};
+
+/*
+ * Sets up the ring and registers the pcap buffers, whose indexes must be
+ * consecutive, as fixed buffers.
+ * Returns -ENOTSUP if dpdkcap was built without liburing.
+ */
+int uring_writer_init(struct uring_writer* uw, unsigned int depth, struct pcap_buffer** buffers,
+                      unsigned int nb_buffers);
+
+void uring_writer_exit(struct uring_writer* uw);
+
+/* Queues the write of a buffer at the given file offset */
+int uring_writer_queue(struct uring_writer* uw, int fd, uint64_t offset, struct pcap_buffer* buffer);
+
+/* Submits the queued writes */
+int uring_writer_submit(struct uring_writer* uw);
+
+/*
+ * Reaps up to max completed writes. Short writes are resubmitted and only
+ * returned once complete. results holds the number of bytes written, or a
+ * negative errno. Blocks for at least one completion if wait is set.
+ */
+unsigned int uring_writer_reap(struct uring_writer* uw, struct pcap_buffer** buffers, int* results, unsigned int max,
+                               bool wait);
+
+/* Number of writes in flight on a file descriptor */
+unsigned int uring_writer_inflight_fd(const struct uring_writer* uw, int fd);
+
+static inline unsigned int
+uring_writer_free_slots(const struct uring_writer* uw) {
+    return uw->depth - uw->inflight;
+}
+
+#endif
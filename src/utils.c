@@ -1,3 +1,5 @@
+#include <errno.h>
+
 #include "utils.h"
 
 const char* bytes_unit[] = {"B", "KB", "MB", "GB", "TB"};
@@ -45,3 +47,41 @@ str_replace(const char* src, const char* find, const char* replace) {
     }
     return pos;
 }
+
+/*
+ * Parses a size in bytes, with an optional K, M, G or T (binary) suffix
+ */
+int
+parse_size(const char* str, uint64_t* size) {
+    char* end;
+    unsigned long long value;
+    unsigned int shift = 0;
+
+    errno = 0;
+    value = strtoull(str, &end, 10);
+    if (errno || end == str) {
+        return -EINVAL;
+    }
+
+    switch (*end) {
+        case 'T':
+        case 't': shift += 10; /* fall through */
+        case 'G':
+        case 'g': shift += 10; /* fall through */
+        case 'M':
+        case 'm': shift += 10; /* fall through */
+        case 'K':
+        case 'k':
+            shift += 10;
+            end++;
+            break;
+        default: break;
+    }
+
+    if (*end != '\0' || (shift && value > (UINT64_MAX >> shift))) {
+        return -EINVAL;
+    }
+
+    *size = value << shift;
+    return 0;
+}
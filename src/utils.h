@@ -50,5 +50,6 @@
 char* bytes_format(uint64_t);
 char* ul_format(uint64_t);
 char* str_replace(const char* src, const char* find, const char* replace);
+int parse_size(const char* str, uint64_t* size);
 
 #endif
@@ -0,0 +1,189 @@
+#ifndef DPDKCAP_TOOLS_CAPTURE_FILE_H
+#define DPDKCAP_TOOLS_CAPTURE_FILE_H
+
+/*
+ * Reading the pcap and pcapng files written by dpdkcap (nanosecond
+ * timestamps, host byte order)
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/index_format.h"
+
+#define NSEC_PER_SEC         1000000000ULL
+
+#define PCAP_MAGIC_NS        0xa1b23c4d
+#define PCAPNG_BLOCK_SHB     0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB     0x00000001
+#define PCAPNG_BLOCK_EPB     0x00000006
+
+#define PCAP_HEADER_LEN      24
+#define PCAP_RECORD_LEN      16
+#define PCAPNG_EPB_LEN       28
+
+/* Longest file header: a pcapng section header and its interfaces */
+#define CAPTURE_HEADER_LEN_MAX (1024 * 1024)
+
+/*
+ * Returns the length of the file header found at the start of buf: the pcap
+ * header, or the pcapng section header and interface descriptions. Returns
+ * 0 when the file was not written by dpdkcap.
+ */
+static inline uint32_t
+capture_header_len(const uint8_t* buf, uint64_t len, bool* pcapng) {
+    uint32_t type, block_len, header_len = 0;
+
+    if (len < PCAP_HEADER_LEN) {
+        return 0;
+    }
+    memcpy(&type, buf, 4);
+    if (type == PCAP_MAGIC_NS) {
+        *pcapng = false;
+        return PCAP_HEADER_LEN;
+    }
+    if (type != PCAPNG_BLOCK_SHB) {
+        return 0;
+    }
+
+    *pcapng = true;
+    while (header_len + 8 <= len) {
+        memcpy(&type, buf + header_len, 4);
+        memcpy(&block_len, buf + header_len + 4, 4);
+        if ((header_len && type == PCAPNG_BLOCK_SHB) || (type != PCAPNG_BLOCK_SHB && type != PCAPNG_BLOCK_IDB)
+            || block_len < 12 || header_len + block_len > len) {
+            break;
+        }
+        header_len += block_len;
+    }
+    return header_len;
+}
+
+/*
+ * Copies the file header of a capture file into out, and tells its format.
+ * Returns -1 on failure.
+ */
+static inline int
+capture_header_copy(int fd, const char* name, FILE* out, bool* pcapng) {
+    uint8_t* buf = malloc(CAPTURE_HEADER_LEN_MAX);
+    ssize_t nb_read;
+    uint32_t len;
+    int retval = -1;
+
+    if (!buf) {
+        return -1;
+    }
+    nb_read = pread(fd, buf, CAPTURE_HEADER_LEN_MAX, 0);
+    len = nb_read > 0 ? capture_header_len(buf, nb_read, pcapng) : 0;
+    if (!len) {
+        fprintf(stderr, "%s: not a nanosecond pcap or pcapng file written by dpdkcap\n", name);
+    } else if (fwrite(buf, 1, len, out) != len) {
+        fprintf(stderr, "Could not write the output: %s\n", strerror(errno));
+    } else {
+        retval = 0;
+    }
+
+    free(buf);
+    return retval;
+}
+
+/*
+ * Reads the record at the start of buf, within len bytes. Returns its
+ * length, or 0 when truncated. *data is NULL when the record is not a
+ * packet (pcapng padding).
+ */
+static inline uint32_t
+capture_record(const uint8_t* buf, uint64_t len, bool pcapng, const uint8_t** data, uint32_t* caplen, uint64_t* ns) {
+    uint32_t type, record_len, seconds, fraction;
+
+    *data = NULL;
+    if (len < 12) {
+        return 0;
+    }
+
+    if (pcapng) {
+        memcpy(&type, buf, 4);
+        memcpy(&record_len, buf + 4, 4);
+        if (record_len < 12 || record_len > len) {
+            return 0;
+        }
+        if (type != PCAPNG_BLOCK_EPB || record_len < PCAPNG_EPB_LEN + 4) {
+            return record_len;
+        }
+        memcpy(caplen, buf + 20, 4);
+        if (PCAPNG_EPB_LEN + *caplen > record_len) {
+            return 0;
+        }
+        memcpy(&seconds, buf + 12, 4); /* timestamp high */
+        memcpy(&fraction, buf + 16, 4);
+        *ns = (uint64_t)seconds << 32 | fraction;
+        *data = buf + PCAPNG_EPB_LEN;
+        return record_len;
+    }
+
+    if (len < PCAP_RECORD_LEN) {
+        return 0;
+    }
+    memcpy(&seconds, buf, 4);
+    memcpy(&fraction, buf + 4, 4);
+    memcpy(caplen, buf + 8, 4);
+    if (PCAP_RECORD_LEN + (uint64_t)*caplen > len) {
+        return 0;
+    }
+    *ns = seconds * NSEC_PER_SEC + fraction;
+    *data = buf + PCAP_RECORD_LEN;
+    return PCAP_RECORD_LEN + *caplen;
+}
+
+/*
+ * Parses a UTC time: "SECONDS[.FRACTION]" since the epoch, or
+ * "YYYY-MM-DDTHH:MM:SS[.FRACTION]"
+ */
+static inline int
+capture_parse_time(const char* arg, uint64_t* ns) {
+    uint64_t fraction = 0, scale = NSEC_PER_SEC;
+    struct tm tm;
+    const char* end;
+    char* num_end;
+
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(arg, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (end) {
+        *ns = (uint64_t)timegm(&tm) * NSEC_PER_SEC;
+    } else {
+        errno = 0;
+        *ns = strtoull(arg, &num_end, 10) * NSEC_PER_SEC;
+        if (errno || num_end == arg) {
+            return -1;
+        }
+        end = num_end;
+    }
+
+    if (*end == '.') {
+        for (end++; *end >= '0' && *end <= '9'; end++) {
+            if (scale > 1) {
+                scale /= 10;
+                fraction += (*end - '0') * scale;
+            }
+        }
+    }
+    *ns += fraction;
+    return *end ? -1 : 0;
+}
+
+/*
+ * Checks the header of an index sidecar, read from file
+ */
+static inline bool
+index_header_check(const struct index_header* header, const char* magic) {
+    return !memcmp(header->magic, magic, sizeof(header->magic)) && header->version == INDEX_VERSION
+        && header->disk_blk_size;
+}
+
+#endif
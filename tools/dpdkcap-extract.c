@@ -0,0 +1,263 @@
+/*
+ * Copies a time range of files written by dpdkcap with --time-index into a
+ * new file. The time index of each file is binary searched, and only the
+ * packet buffers overlapping the range are read.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+
+/* Seconds around the time given with -a, by default */
+#define AROUND_S_DEFAULT  15
+
+struct output {
+    FILE* file;
+    bool pcapng;
+    bool header_written;
+    uint64_t packets;
+    uint64_t bytes_read;
+};
+
+/*
+ * Maps a whole file, read-only. Returns NULL if it is empty or on failure.
+ */
+static const uint8_t*
+map_file(const char* name, uint64_t* size) {
+    struct stat st;
+    void* map;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    *size = st.st_size;
+    return map;
+}
+
+/*
+ * First record of the time index whose packets are not all older than
+ * from_ns. The buffers of a queue are written in order, so the records are
+ * sorted but for clock steps.
+ */
+static size_t
+time_index_search(const struct time_index_record* records, size_t nb_records, uint64_t from_ns) {
+    size_t low = 0, high = nb_records, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (records[mid].last_ns < from_ns) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int
+write_range(const uint8_t* data, uint64_t len, struct output* output) {
+    if (len && fwrite(data, 1, len, output->file) != len) {
+        fprintf(stderr, "Could not write the output: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Copies the packets of a buffer within the time range, in runs of
+ * consecutive packet records
+ */
+static int
+copy_buffer(const uint8_t* map, uint64_t size, const struct time_index_record* record, uint64_t from_ns,
+            uint64_t to_ns, struct output* output) {
+    const uint8_t *data, *run = NULL;
+    uint64_t offset = record->offset, end = record->offset + record->length, ns;
+    uint32_t p, record_len, caplen;
+
+    /* The record of a buffer which could not be written is emptied */
+    if (!record->length) {
+        return 0;
+    }
+    if (end > size) {
+        fprintf(stderr, "Buffer at %lu is beyond the end of the file\n", record->offset);
+        return 0;
+    }
+    output->bytes_read += record->length;
+
+    for (p = 0; p < record->packets && offset < end; offset += record_len) {
+        record_len = capture_record(map + offset, end - offset, output->pcapng, &data, &caplen, &ns);
+        if (!record_len) {
+            break;
+        }
+        if (data && ns >= from_ns && ns <= to_ns) {
+            if (!run) {
+                run = map + offset;
+            }
+            output->packets++;
+        } else if (run) {
+            if (write_range(run, map + offset - run, output) < 0) {
+                return -1;
+            }
+            run = NULL;
+        }
+        if (data) {
+            p++;
+        }
+    }
+
+    return run ? write_range(run, map + offset - run, output) : 0;
+}
+
+/*
+ * Copies the packets of an output file within the time range
+ */
+static int
+extract_file(const char* name, uint64_t from_ns, uint64_t to_ns, struct output* output) {
+    const struct time_index_record* records;
+    const struct index_header* header;
+    const uint8_t *index, *map;
+    char index_name[PATH_MAX];
+    uint64_t index_size, size;
+    size_t nb_records, i;
+    int fd, retval = -1;
+
+    snprintf(index_name, sizeof(index_name), "%s" TIME_INDEX_SUFFIX, name);
+    index = map_file(index_name, &index_size);
+    if (!index) {
+        return -1;
+    }
+    header = (const struct index_header*)index;
+    if (index_size < sizeof(*header) || !index_header_check(header, TIME_INDEX_MAGIC)) {
+        fprintf(stderr, "%s: not a time index\n", index_name);
+        munmap((void*)index, index_size);
+        return -1;
+    }
+    records = (const struct time_index_record*)(header + 1);
+    nb_records = (index_size - sizeof(*header)) / sizeof(*records);
+
+    map = map_file(name, &size);
+    if (!map) {
+        munmap((void*)index, index_size);
+        return -1;
+    }
+
+    if (!output->header_written) {
+        fd = open(name, O_RDONLY);
+        if (fd < 0 || capture_header_copy(fd, name, output->file, &output->pcapng) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            goto out;
+        }
+        close(fd);
+        output->header_written = true;
+    }
+
+    for (i = time_index_search(records, nb_records, from_ns); i < nb_records && records[i].first_ns <= to_ns; i++) {
+        if (copy_buffer(map, size, &records[i], from_ns, to_ns, output) < 0) {
+            goto out;
+        }
+    }
+    retval = 0;
+
+out:
+    munmap((void*)map, size);
+    munmap((void*)index, index_size);
+    return retval;
+}
+
+static void
+usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [-w OUTPUT] (-f FROM -t TO | -a TIME [-s SECONDS]) FILE...\n"
+            "Writes the packets of the files written by dpdkcap with --time-index between FROM and TO,\n"
+            "or within SECONDS (default: %u) around TIME, into OUTPUT (default: standard output).\n"
+            "Times are in UTC, as SECONDS[.FRACTION] since the epoch or YYYY-MM-DDTHH:MM:SS[.FRACTION].\n"
+            "The packets of each file are written in turn, in the order of the files.\n",
+            program, AROUND_S_DEFAULT);
+}
+
+int
+main(int argc, char* argv[]) {
+    struct output output = {0};
+    uint64_t from_ns = 0, to_ns = UINT64_MAX, around_ns = 0, seconds = AROUND_S_DEFAULT;
+    const char* output_name = NULL;
+    bool around = false;
+    char* end;
+    int opt, i, retval = 0;
+
+    while ((opt = getopt(argc, argv, "w:f:t:a:s:h")) != -1) {
+        switch (opt) {
+            case 'w': output_name = optarg; break;
+            case 'f': retval = capture_parse_time(optarg, &from_ns); break;
+            case 't': retval = capture_parse_time(optarg, &to_ns); break;
+            case 'a':
+                retval = capture_parse_time(optarg, &around_ns);
+                around = true;
+                break;
+            case 's':
+                seconds = strtoull(optarg, &end, 10);
+                retval = *end || end == optarg ? -1 : 0;
+                break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+        if (retval < 0) {
+            fprintf(stderr, "Invalid value '%s'\n", optarg);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (around) {
+        from_ns = around_ns > seconds * NSEC_PER_SEC ? around_ns - seconds * NSEC_PER_SEC : 0;
+        to_ns = around_ns + seconds * NSEC_PER_SEC;
+    }
+    if (from_ns > to_ns) {
+        fprintf(stderr, "The time range ends before it starts\n");
+        return 1;
+    }
+
+    output.file = output_name ? fopen(output_name, "w") : stdout;
+    if (!output.file) {
+        fprintf(stderr, "Could not open %s: %s\n", output_name, strerror(errno));
+        return 1;
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (extract_file(argv[i], from_ns, to_ns, &output) < 0) {
+            retval = 1;
+        }
+    }
+
+    fprintf(stderr, "%lu packets extracted, %lu bytes read\n", output.packets, output.bytes_read);
+    if (fclose(output.file)) {
+        fprintf(stderr, "Could not write the output: %s\n", strerror(errno));
+        retval = 1;
+    }
+    return retval;
+}
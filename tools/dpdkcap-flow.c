@@ -0,0 +1,419 @@
+/*
+ * Extracts a connection from files written by dpdkcap with --flow-index.
+ * Only the disk blocks of the output files listed by their flow index for
+ * the connection are read.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+
+/* Records read from a flow index at once */
+#define INDEX_BATCH          4096
+
+#define ETHER_TYPE_IPV4      0x0800
+#define ETHER_TYPE_IPV6      0x86DD
+#define ETHER_TYPE_VLAN      0x8100
+#define ETHER_TYPE_QINQ      0x88A8
+#define ETHER_TYPE_QINQ_OLD  0x9100
+#define MAX_VLAN_TAGS        2
+
+struct query {
+    struct flow_index_key key;
+    uint32_t hash;
+    /* Non-first fragments are indexed without ports */
+    struct flow_index_key fragment_key;
+    uint32_t fragment_hash;
+    uint64_t from_ns;
+    uint64_t to_ns;
+};
+
+struct output {
+    FILE* file;
+    bool pcapng;
+    bool header_written;
+    uint64_t packets;
+    uint64_t bytes_read;
+};
+
+static uint32_t crc32c_table[256];
+
+static void
+crc32c_init(void) {
+    uint32_t crc;
+    unsigned int i, b;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (b = 0; b < 8; b++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        crc32c_table[i] = crc;
+    }
+}
+
+/* CRC32C without final inversion, like rte_hash_crc() */
+static uint32_t
+crc32c(const void* data, size_t len, uint32_t crc) {
+    const uint8_t* p = data;
+
+    while (len--) {
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static inline uint16_t
+read_be16(const uint8_t* p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/*
+ * Builds the flow key of a captured frame, the way the capturing cores do,
+ * and tells whether it is a non-first fragment. Returns false for frames
+ * which are not IP.
+ */
+static bool
+packet_key(const uint8_t* data, uint32_t len, struct flow_index_key* key, bool* fragment) {
+    uint32_t offset = 14, l3, hlen;
+    uint16_t ether_type, sport = 0, dport = 0;
+    unsigned int nb_vlans = 0;
+    uint8_t version, proto;
+    bool l4 = true;
+
+    if (len < 14) {
+        return false;
+    }
+    ether_type = read_be16(data + 12);
+    while ((ether_type == ETHER_TYPE_VLAN || ether_type == ETHER_TYPE_QINQ || ether_type == ETHER_TYPE_QINQ_OLD)
+           && nb_vlans < MAX_VLAN_TAGS && offset + 4 <= len) {
+        ether_type = read_be16(data + offset + 2);
+        offset += 4;
+        nb_vlans++;
+    }
+    l3 = offset;
+
+    if (ether_type == ETHER_TYPE_IPV4) {
+        if (offset + 20 > len) {
+            return false;
+        }
+        hlen = (data[offset] & 0x0f) * 4;
+        if (hlen < 20 || offset + hlen > len) {
+            return false;
+        }
+        version = 4;
+        proto = data[offset + 9];
+        /* Only the first fragment carries the L4 header */
+        l4 = !(read_be16(data + offset + 6) & 0x1fff);
+        offset += hlen;
+    } else if (ether_type == ETHER_TYPE_IPV6) {
+        if (offset + 40 > len) {
+            return false;
+        }
+        version = 6;
+        proto = data[offset + 6];
+        offset += 40;
+        for (;;) {
+            if (proto == IPPROTO_HOPOPTS || proto == IPPROTO_ROUTING || proto == IPPROTO_DSTOPTS) {
+                if (offset + 8 > len) {
+                    break;
+                }
+                hlen = (data[offset + 1] + 1) * 8;
+            } else if (proto == IPPROTO_AH) {
+                if (offset + 8 > len) {
+                    break;
+                }
+                hlen = (data[offset + 1] + 2) * 4;
+            } else if (proto == IPPROTO_FRAGMENT) {
+                if (offset + 8 > len) {
+                    break;
+                }
+                if (read_be16(data + offset + 2) & 0xfff8) {
+                    proto = data[offset];
+                    l4 = false;
+                    break;
+                }
+                hlen = 8;
+            } else {
+                break;
+            }
+            if (offset + hlen > len) {
+                break;
+            }
+            proto = data[offset];
+            offset += hlen;
+        }
+    } else {
+        return false;
+    }
+
+    *fragment = !l4;
+    if (l4 && proto == IPPROTO_TCP && offset + 20 <= len) {
+        hlen = (data[offset + 12] >> 4) * 4;
+        if (hlen >= 20 && offset + hlen <= len) {
+            memcpy(&sport, data + offset, 2);
+            memcpy(&dport, data + offset + 2, 2);
+        }
+    } else if (l4 && proto == IPPROTO_UDP && offset + 8 <= len) {
+        memcpy(&sport, data + offset, 2);
+        memcpy(&dport, data + offset + 2, 2);
+    }
+
+    if (version == 4) {
+        flow_index_key_init(key, 4, proto, data + l3 + 12, data + l3 + 16, sport, dport);
+    } else {
+        flow_index_key_init(key, 6, proto, data + l3 + 8, data + l3 + 24, sport, dport);
+    }
+    return true;
+}
+
+/*
+ * Copies the packets of the flow found in [start, end) of a range read
+ * from the file at base
+ */
+static int
+copy_packets(const uint8_t* buf, uint64_t base, uint64_t start, uint64_t end, const struct query* query,
+             struct output* output) {
+    const uint8_t* data;
+    struct flow_index_key key;
+    uint32_t record_len, caplen;
+    uint64_t offset, ns;
+    bool fragment;
+
+    for (offset = start; offset < end; offset += record_len) {
+        record_len = capture_record(buf + (offset - base), end - offset, output->pcapng, &data, &caplen, &ns);
+        if (!record_len) {
+            break;
+        }
+        if (data && packet_key(data, caplen, &key, &fragment)
+            && (!memcmp(&key, &query->key, sizeof(key))
+                || (fragment && !memcmp(&key, &query->fragment_key, sizeof(key))))) {
+            if (fwrite(buf + (offset - base), 1, record_len, output->file) != record_len) {
+                fprintf(stderr, "Could not write the output: %s\n", strerror(errno));
+                return -1;
+            }
+            output->packets++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Reads the disk blocks holding a flow index record, and copies the
+ * packets of the flow
+ */
+static int
+extract_record(int fd, const char* name, const struct flow_index_record* record, uint32_t disk_blk_size,
+               const struct query* query, struct output* output) {
+    uint64_t start = record->offset / disk_blk_size * disk_blk_size;
+    uint64_t end = (record->offset + record->length + disk_blk_size - 1) / disk_blk_size * disk_blk_size;
+    uint8_t* buf;
+    ssize_t nb_read;
+    int retval;
+
+    if (posix_memalign((void**)&buf, disk_blk_size, end - start)) {
+        return -1;
+    }
+    nb_read = pread(fd, buf, end - start, start);
+    if (nb_read < 0 || (uint64_t)nb_read < record->offset + record->length - start) {
+        fprintf(stderr, "%s: could not read %u bytes at %lu\n", name, record->length, record->offset);
+        free(buf);
+        return 0;
+    }
+    output->bytes_read += nb_read;
+
+    retval = copy_packets(buf, start, record->offset, record->offset + record->length, query, output);
+    free(buf);
+    return retval;
+}
+
+/*
+ * Extracts the packets of the flow from an output file, by reading its
+ * flow index
+ */
+static int
+extract_file(const char* name, const struct query* query, struct output* output) {
+    struct flow_index_record* records;
+    struct index_header header;
+    char index_name[PATH_MAX];
+    FILE* index;
+    size_t nb_records, i;
+    int fd, retval = -1;
+
+    snprintf(index_name, sizeof(index_name), "%s" FLOW_INDEX_SUFFIX, name);
+    index = fopen(index_name, "r");
+    if (!index) {
+        fprintf(stderr, "Could not open %s: %s\n", index_name, strerror(errno));
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, index) != 1 || !index_header_check(&header, FLOW_INDEX_MAGIC)
+        || header.seed != FLOW_INDEX_SEED) {
+        fprintf(stderr, "%s: not a flow index\n", index_name);
+        fclose(index);
+        return -1;
+    }
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", name, strerror(errno));
+        fclose(index);
+        return -1;
+    }
+    records = malloc(INDEX_BATCH * sizeof(*records));
+    if (!records) {
+        goto out;
+    }
+
+    if (!output->header_written) {
+        if (capture_header_copy(fd, name, output->file, &output->pcapng) < 0) {
+            goto out;
+        }
+        output->header_written = true;
+    }
+
+    while ((nb_records = fread(records, sizeof(*records), INDEX_BATCH, index)) > 0) {
+        for (i = 0; i < nb_records; i++) {
+            /* The records of a buffer which could not be written are emptied */
+            if ((records[i].hash != query->hash && records[i].hash != query->fragment_hash) || !records[i].length
+                || records[i].last_ns < query->from_ns
+                || records[i].first_ns > query->to_ns) {
+                continue;
+            }
+            if (extract_record(fd, name, &records[i], header.disk_blk_size, query, output) < 0) {
+                goto out;
+            }
+        }
+    }
+    retval = 0;
+
+out:
+    free(records);
+    close(fd);
+    fclose(index);
+    return retval;
+}
+
+static int
+parse_proto(const char* arg, uint8_t* proto) {
+    unsigned long value;
+    char* end;
+
+    if (!strcmp(arg, "tcp")) {
+        *proto = IPPROTO_TCP;
+    } else if (!strcmp(arg, "udp")) {
+        *proto = IPPROTO_UDP;
+    } else {
+        errno = 0;
+        value = strtoul(arg, &end, 10);
+        if (errno || *end || end == arg || value > 255) {
+            return -1;
+        }
+        *proto = value;
+    }
+    return 0;
+}
+
+static int
+parse_port(const char* arg, uint16_t* port) {
+    unsigned long value;
+    char* end;
+
+    errno = 0;
+    value = strtoul(arg, &end, 10);
+    if (errno || *end || end == arg || value > 65535) {
+        return -1;
+    }
+    *port = htons(value);
+    return 0;
+}
+
+static void
+usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [-w OUTPUT] [-f FROM] [-t TO] PROTO SRC SPORT DST DPORT FILE...\n"
+            "Writes the packets of a connection, in both directions, from the files written by dpdkcap\n"
+            "with --flow-index, into OUTPUT (default: standard output).\n"
+            "PROTO is tcp, udp or an IP protocol number, ports are 0 for protocols without ports.\n"
+            "The non-first IP fragments between SRC and DST are also written, whatever their ports.\n"
+            "FROM and TO restrict the extraction to the flow records overlapping a time range, in UTC,\n"
+            "as SECONDS[.FRACTION] since the epoch or YYYY-MM-DDTHH:MM:SS[.FRACTION].\n",
+            program);
+}
+
+int
+main(int argc, char* argv[]) {
+    struct output output = {0};
+    struct query query = {0};
+    uint8_t src[16], dst[16], proto, version;
+    uint16_t sport, dport;
+    const char* output_name = NULL;
+    int opt, i, retval = 0;
+
+    query.to_ns = UINT64_MAX;
+    while ((opt = getopt(argc, argv, "w:f:t:h")) != -1) {
+        switch (opt) {
+            case 'w': output_name = optarg; break;
+            case 'f':
+            case 't':
+                if (capture_parse_time(optarg, opt == 'f' ? &query.from_ns : &query.to_ns) < 0) {
+                    fprintf(stderr, "Invalid time '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind < 6) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (parse_proto(argv[optind], &proto) < 0 || parse_port(argv[optind + 2], &sport) < 0
+        || parse_port(argv[optind + 4], &dport) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (inet_pton(AF_INET, argv[optind + 1], src) == 1 && inet_pton(AF_INET, argv[optind + 3], dst) == 1) {
+        version = 4;
+    } else if (inet_pton(AF_INET6, argv[optind + 1], src) == 1 && inet_pton(AF_INET6, argv[optind + 3], dst) == 1) {
+        version = 6;
+    } else {
+        fprintf(stderr, "Invalid addresses %s and %s\n", argv[optind + 1], argv[optind + 3]);
+        return 1;
+    }
+
+    crc32c_init();
+    flow_index_key_init(&query.key, version, proto, src, dst, sport, dport);
+    query.hash = crc32c(&query.key, sizeof(query.key), FLOW_INDEX_SEED);
+    flow_index_key_init(&query.fragment_key, version, proto, src, dst, 0, 0);
+    query.fragment_hash = crc32c(&query.fragment_key, sizeof(query.fragment_key), FLOW_INDEX_SEED);
+
+    output.file = output_name ? fopen(output_name, "w") : stdout;
+    if (!output.file) {
+        fprintf(stderr, "Could not open %s: %s\n", output_name, strerror(errno));
+        return 1;
+    }
+
+    for (i = optind + 5; i < argc; i++) {
+        if (extract_file(argv[i], &query, &output) < 0) {
+            retval = 1;
+        }
+    }
+
+    fprintf(stderr, "%lu packets extracted, %lu bytes read\n", output.packets, output.bytes_read);
+    if (fclose(output.file)) {
+        fprintf(stderr, "Could not write the output: %s\n", strerror(errno));
+        retval = 1;
+    }
+    return retval;
+}